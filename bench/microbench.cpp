@@ -0,0 +1,434 @@
+// CPU microbenchmarks of the math, mesh and culling code that runs every
+// frame or at load time. Nothing here needs a GL context: Shape is only
+// loaded, never initialized or drawn.
+//
+//   microbench RESOURCE_DIR [--out=FILE] [--label=TEXT] [--filter=TEXT]
+//              [--max-objects=N] [--large] [--min-ms=N]
+//
+// The object counts go up by 10x to --max-objects, 1e6 by default (about
+// 120 MB of transforms). --large goes on to 1e7, which needs over 1 GB.
+//
+// Each case runs a calibrated number of iterations per repetition, so that
+// a repetition takes at least --min-ms, and reports the median and minimum
+// over the repetitions. The JSON report (microbench.json by default) is
+// meant to be kept per commit, e.g. with --label=$(git rev-parse --short HEAD).
+
+#include <algorithm>
+#include <chrono>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Culler.h"
+#include "Frustum.h"
+#include "MatrixStack.h"
+#include "Object.h"
+#include "Shape.h"
+
+using namespace std;
+
+namespace {
+
+const int NUM_REPETITIONS = 5;
+
+struct Result
+{
+	string name;
+	long long items;      // processed per iteration (objects, triangles, ...)
+	long long iterations; // per repetition
+	double medianNs;      // per iteration
+	double minNs;
+};
+
+string filter;     // only the cases whose name contains it
+double minMs = 20.0;
+vector<Result> results;
+float sink = 0.0f; // keeps the optimizer from dropping the work
+
+// Times f(iterations), which returns something derived from all of its work
+void run(const string &name, long long items, const function<float(long long)> &f)
+{
+	if(name.find(filter) == string::npos) {
+		return;
+	}
+	// Doubles the iterations until one repetition takes long enough
+	long long iterations = 1;
+	for(;;) {
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		sink += f(iterations);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+		if(ms >= minMs) {
+			break;
+		}
+		iterations *= (ms > 0.1 * minMs) ? 2 : 10;
+	}
+	vector<double> ns;
+	for(int r = 0; r < NUM_REPETITIONS; r++) {
+		chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+		sink += f(iterations);
+		ns.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count() / iterations);
+	}
+	sort(ns.begin(), ns.end());
+	Result r = { name, items, iterations, ns[NUM_REPETITIONS / 2], ns[0] };
+	results.push_back(r);
+	cout << left << setw(40) << name << right << fixed << setprecision(1)
+		<< setw(14) << r.medianNs << " ns" << setw(12) << r.medianNs / items << " ns/item" << endl;
+}
+
+// transpose(inverse(MV)) for an MV without projective terms: the inverse
+// transpose of the upper 3x3 is its cofactor matrix over the determinant
+glm::mat3 affineNormalMatrix(const glm::mat4 &MV)
+{
+	glm::vec3 a0(MV[0]);
+	glm::vec3 a1(MV[1]);
+	glm::vec3 a2(MV[2]);
+	glm::vec3 c0 = glm::cross(a1, a2);
+	glm::vec3 c1 = glm::cross(a2, a0);
+	glm::vec3 c2 = glm::cross(a0, a1);
+	float invDet = 1.0f / glm::dot(a0, c0);
+	return glm::mat3(c0 * invDet, c1 * invDet, c2 * invDet);
+}
+
+// The view matrix of a camera at the origin turned by yaw
+glm::mat4 viewMatrix(float yaw)
+{
+	glm::vec3 forward(sin(yaw), -0.2f, cos(yaw));
+	return glm::lookAt(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f) + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+const glm::mat4 P = glm::perspective((float)(45.0 * M_PI / 180.0), 4.0f / 3.0f, 0.01f, 100.0f);
+
+void benchMatrices(double &maxNormalError)
+{
+	// The per-object placement of the CPU drawing path
+	const int n = 1024;
+	mt19937 rng(1);
+	uniform_real_distribution<float> pos(-50.0f, 50.0f);
+	uniform_real_distribution<float> size(0.1f, 2.0f);
+	vector<glm::vec3> translations(n);
+	vector<glm::vec3> scales(n);
+	for(int i = 0; i < n; i++) {
+		translations[i] = glm::vec3(pos(rng), pos(rng), pos(rng));
+		scales[i] = glm::vec3(size(rng), size(rng), size(rng));
+	}
+	glm::mat4 V = viewMatrix(0.3f);
+
+	run("matrix_stack/push_translate_scale_pop", n, [&](long long iterations) {
+		MatrixStack MV;
+		MV.multMatrix(V);
+		float sum = 0.0f;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				MV.pushMatrix();
+				MV.translate(translations[i]);
+				MV.scale(scales[i]);
+				MV.scale(1.05f);
+				sum += MV.topMatrix()[3][0];
+				MV.popMatrix();
+			}
+		}
+		return sum;
+	});
+
+	vector<glm::mat4> MVs(n);
+	for(int i = 0; i < n; i++) {
+		MVs[i] = V * glm::scale(glm::translate(glm::mat4(1.0f), translations[i]), scales[i]);
+	}
+	maxNormalError = 0.0;
+	for(int i = 0; i < n; i++) {
+		glm::mat3 a = glm::mat3(glm::transpose(glm::inverse(MVs[i])));
+		glm::mat3 b = affineNormalMatrix(MVs[i]);
+		for(int c = 0; c < 3; c++) {
+			for(int r = 0; r < 3; r++) {
+				maxNormalError = max(maxNormalError, (double)abs(a[c][r] - b[c][r]) / max(1.0f, abs(a[c][r])));
+			}
+		}
+	}
+	run("normal_matrix/transpose_inverse", n, [&](long long iterations) {
+		float sum = 0.0f;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				sum += glm::transpose(glm::inverse(MVs[i]))[1][1];
+			}
+		}
+		return sum;
+	});
+	run("normal_matrix/affine", n, [&](long long iterations) {
+		float sum = 0.0f;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				sum += affineNormalMatrix(MVs[i])[1][1];
+			}
+		}
+		return sum;
+	});
+}
+
+void benchMeshes(const string &resourceDir)
+{
+	const char *meshes[] = { "bunny", "teapot" };
+	for(const char *mesh : meshes) {
+		string file = resourceDir + mesh + ".obj";
+		Shape probe;
+		probe.loadMesh(file);
+		long long triangles = probe.getPosBuf().size() / 9;
+		if(triangles == 0) {
+			cerr << "Could not load " << file << endl;
+			continue;
+		}
+		run(string("mesh/load_") + mesh, triangles, [&](long long iterations) {
+			float sum = 0.0f;
+			for(long long it = 0; it < iterations; it++) {
+				Shape shape;
+				shape.loadMesh(file);
+				sum += shape.getBoundsMax().y;
+			}
+			return sum;
+		});
+		// fitToUnitBox() finds the bounds again, then rescales in place
+		run(string("mesh/fit_to_unit_box_") + mesh, triangles, [&](long long iterations) {
+			for(long long it = 0; it < iterations; it++) {
+				probe.fitToUnitBox();
+			}
+			return probe.getPosBuf()[0];
+		});
+	}
+}
+
+void benchFrustum()
+{
+	const int n = 4096;
+	mt19937 rng(2);
+	uniform_real_distribution<float> pos(-60.0f, 60.0f);
+	uniform_real_distribution<float> size(0.1f, 3.0f);
+	vector<glm::vec4> spheres(n);
+	vector<glm::vec3> boxMins(n);
+	vector<glm::vec3> boxMaxs(n);
+	for(int i = 0; i < n; i++) {
+		glm::vec3 c(pos(rng), pos(rng) * 0.1f, pos(rng));
+		glm::vec3 h(size(rng), size(rng), size(rng));
+		spheres[i] = glm::vec4(c, glm::length(h));
+		boxMins[i] = c - h;
+		boxMaxs[i] = c + h;
+	}
+	Frustum frustum;
+	frustum.extract(P * viewMatrix(0.3f));
+
+	run("frustum/sphere", n, [&](long long iterations) {
+		int visible = 0;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				visible += frustum.testSphere(glm::vec3(spheres[i]), spheres[i].w);
+			}
+		}
+		return (float)visible;
+	});
+	run("frustum/sphere_slack", n, [&](long long iterations) {
+		float sum = 0.0f;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				float slack;
+				frustum.testSphere(glm::vec3(spheres[i]), spheres[i].w, &slack);
+				sum += slack;
+			}
+		}
+		return sum;
+	});
+	run("frustum/box", n, [&](long long iterations) {
+		int visible = 0;
+		for(long long it = 0; it < iterations; it++) {
+			for(int i = 0; i < n; i++) {
+				visible += frustum.testBox(boxMins[i], boxMaxs[i]);
+			}
+		}
+		return (float)visible;
+	});
+}
+
+// A square grid of n objects one unit apart, like the scene in main.cpp
+vector<Object*> makeObjects(long long n, shared_ptr<Shape> shape)
+{
+	vector<Object*> objects;
+	long long side = (long long)ceil(sqrt((double)n));
+	for(long long k = 0; k < n; k++) {
+		Object *obj = new Object();
+		obj->setShape(shape);
+		obj->setTranslation(glm::vec3(k % side - 0.5f * side, 0.0f, k / side - 0.5f * side));
+		obj->setScale(glm::vec3(0.2f, 0.2f, 0.2f));
+		objects.push_back(obj);
+	}
+	return objects;
+}
+
+void benchCulling(const string &resourceDir, long long maxObjects)
+{
+	shared_ptr<Shape> shape = make_shared<Shape>();
+	shape->loadMesh(resourceDir + "bunny.obj");
+	// An Object is a few hundred bytes, so the scenes stop short of the
+	// transform batches' largest
+	for(long long n = 100; n <= min(maxObjects, 1000000LL); n *= 10) {
+		vector<Object*> objects = makeObjects(n, shape);
+		Culler culler;
+		culler.setObjects(objects, 1.0f, 1.1f);
+		const char *modes[] = { "full", "coherent" };
+		for(int mode = Culler::FULL; mode <= Culler::COHERENT; mode++) {
+			culler.setMode(mode);
+			// The camera keeps turning, a little each frame
+			float yaw = 0.0f;
+			run(string("culler/") + modes[mode - Culler::FULL] + "_" + to_string(n), n, [&](long long iterations) {
+				int visible = 0;
+				for(long long it = 0; it < iterations; it++) {
+					yaw += 0.002f;
+					culler.update(P, viewMatrix(yaw));
+					visible += culler.getNumVisible();
+				}
+				return (float)visible;
+			});
+		}
+		for(size_t i = 0; i < objects.size(); i++) {
+			delete objects[i];
+		}
+	}
+}
+
+void benchTransformBatches(long long maxObjects)
+{
+	glm::mat4 V = viewMatrix(0.3f);
+	float pulse = 1.05f;
+	for(long long n = 100; n <= maxObjects; n *= 10) {
+		vector<glm::vec3> translations(n);
+		vector<glm::vec3> scales(n, glm::vec3(0.2f, 0.2f, 0.2f));
+		for(long long k = 0; k < n; k++) {
+			translations[k] = glm::vec3((float)(k % 1000), 0.0f, (float)(k / 1000));
+		}
+		vector<glm::mat4> MVs(n);
+		vector<glm::mat3> normals(n);
+
+		// As drawn one by one: through the matrix stack, with the normal
+		// matrix from a general inverse
+		run("transform_batch/matrix_stack_" + to_string(n), n, [&](long long iterations) {
+			MatrixStack MV;
+			MV.multMatrix(V);
+			for(long long it = 0; it < iterations; it++) {
+				for(long long k = 0; k < n; k++) {
+					MV.pushMatrix();
+					MV.translate(translations[k]);
+					MV.scale(scales[k]);
+					MV.scale(pulse);
+					MVs[k] = MV.topMatrix();
+					normals[k] = glm::mat3(glm::transpose(glm::inverse(MVs[k])));
+					MV.popMatrix();
+				}
+			}
+			return MVs[n - 1][3][0] + normals[n - 1][1][1];
+		});
+		// The same, building T * S directly and with the affine inverse
+		run("transform_batch/direct_" + to_string(n), n, [&](long long iterations) {
+			for(long long it = 0; it < iterations; it++) {
+				for(long long k = 0; k < n; k++) {
+					glm::vec3 s = scales[k] * pulse;
+					glm::mat4 M(glm::vec4(s.x, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, s.y, 0.0f, 0.0f),
+						glm::vec4(0.0f, 0.0f, s.z, 0.0f), glm::vec4(translations[k], 1.0f));
+					MVs[k] = V * M;
+					normals[k] = affineNormalMatrix(MVs[k]);
+				}
+			}
+			return MVs[n - 1][3][0] + normals[n - 1][1][1];
+		});
+	}
+}
+
+bool writeReport(const string &filename, const string &label, double maxNormalError)
+{
+	ofstream out(filename);
+	if(!out) {
+		cerr << "Could not write " << filename << endl;
+		return false;
+	}
+	out << fixed << setprecision(3);
+	out << "{" << endl;
+	out << "  \"label\": \"" << label << "\"," << endl;
+#ifdef NDEBUG
+	out << "  \"optimized\": true," << endl;
+#else
+	out << "  \"optimized\": false," << endl;
+#endif
+	out << "  \"repetitions\": " << NUM_REPETITIONS << "," << endl;
+	out << "  \"affine_normal_max_error\": " << scientific << maxNormalError << fixed << "," << endl;
+	out << "  \"results\": [";
+	for(size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		out << (i == 0 ? "" : ",") << endl;
+		out << "    {\"name\": \"" << r.name << "\", \"items\": " << r.items << ", \"iterations\": " << r.iterations
+			<< ", \"median_ns\": " << r.medianNs << ", \"min_ns\": " << r.minNs
+			<< ", \"median_ns_per_item\": " << r.medianNs / r.items << "}";
+	}
+	out << endl << "  ]" << endl;
+	out << "}" << endl;
+	cout << "Wrote " << filename << endl;
+	return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 2) {
+		cout << "Usage: microbench RESOURCE_DIR [--out=FILE] [--label=TEXT] [--filter=TEXT]" << endl;
+		cout << "       [--max-objects=N] [--large] [--min-ms=N]" << endl;
+		return 0;
+	}
+	string resourceDir = argv[1] + string("/");
+	string outFile = "microbench.json";
+	string label;
+	long long maxObjects = 1000000;
+	for(int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if(arg.compare(0, 2, "--") != 0) {
+			cerr << "Unknown argument " << arg << endl;
+			return -1;
+		}
+		size_t eq = arg.find('=');
+		string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+		string value = eq == string::npos ? "" : arg.substr(eq + 1);
+		if(name == "out") {
+			outFile = value;
+		} else if(name == "label") {
+			label = value;
+		} else if(name == "filter") {
+			filter = value;
+		} else if(name == "max-objects") {
+			maxObjects = max(100LL, atoll(value.c_str()));
+		} else if(name == "large") {
+			maxObjects = 10000000;
+		} else if(name == "min-ms") {
+			minMs = max(1.0, atof(value.c_str()));
+		} else {
+			cerr << "Unknown option " << arg << endl;
+			return -1;
+		}
+	}
+
+	double maxNormalError = 0.0;
+	benchMatrices(maxNormalError);
+	benchMeshes(resourceDir);
+	benchFrustum();
+	benchCulling(resourceDir, maxObjects);
+	benchTransformBatches(maxObjects);
+	if(sink == 12345.0f) {
+		cout << endl;
+	}
+	return writeReport(outFile, label, maxNormalError) ? 0 : -1;
+}
@@ -0,0 +1,27 @@
+#version 120
+
+// Must match depth_vert.glsl for the depth pre-pass
+invariant gl_Position;
+
+uniform mat4 P;
+uniform mat4 MV;
+uniform mat4 MVit;
+
+attribute vec4 aPos; // in world space (pre-transformed)
+attribute vec3 aNor; // in world space (pre-transformed)
+attribute vec3 aKd;  // per-object diffuse color
+
+varying vec3 vPos; // camera space position
+varying vec3 vNor; // camera space normal
+varying vec3 vKd;
+
+void main()
+{
+	gl_Position = P * MV * aPos;
+	vec4 temp = MV * aPos;
+	vPos = temp.xyz;
+	temp = MVit * vec4(aNor, 0.0);
+	vNor = normalize(temp.xyz);
+
+	vKd = aKd;
+}
@@ -0,0 +1,82 @@
+#version 140
+
+// The sun, as in frag.glsl
+uniform vec3 lightColor1;
+uniform vec3 lightPos1;
+uniform vec3 ka;
+uniform vec3 ks;
+uniform float s;
+
+uniform sampler2DArray texture0;
+uniform float textureLayer;
+in vec2 vTex0;
+
+// Point lights binned per froxel by LightClusters
+uniform samplerBuffer lightData;       // (camera space position, range), (color, 0)
+uniform isamplerBuffer clusterOffsets; // lights of cluster c: [offsets[c], offsets[c+1])
+uniform isamplerBuffer clusterLights;  // indices into lightData
+uniform ivec3 clusterGrid;
+uniform vec2 viewport;
+uniform vec2 clusterDepth; // slice = log(depth) * x + y
+
+in vec3 vPos; // camera space position
+in vec3 vNor; // camera space normal
+in vec3 vKd;
+
+out vec4 fragColor;
+
+void main()
+{
+	vec3 n = normalize(vNor);
+	vec3 eyeVector = normalize(-1 * vPos);
+
+	//cd1: 
+	vec3 lightDir1 = lightPos1 - vPos;
+	lightDir1 = normalize(lightDir1);
+	float lambertian1 = max(0.0, dot(lightDir1, n));
+
+	//cs1:
+	vec3 halfDir1 = normalize(lightDir1 + eyeVector);
+	float specular1 = pow(max(0.0, dot(halfDir1, n)), s);
+
+	vec3 cd1 = vKd * lambertian1;
+	vec3 cs1 = ks * specular1;
+
+
+	vec3 color1 = lightColor1 * (ka + cd1 + cs1);
+
+	vec3 kd_tex = texture(texture0, vec3(vTex0, textureLayer)).rgb;
+	vec4 color2 = vec4(kd_tex, 1.0);
+
+	// Point lights: diffuse uses the texture as well, and the normal is turned
+	// toward the eye (the ground plane's points down), so they show on the ground
+	vec3 nf = faceforward(n, vPos, n);
+	ivec2 tile = ivec2(gl_FragCoord.xy / viewport * vec2(clusterGrid.xy));
+	tile = clamp(tile, ivec2(0), clusterGrid.xy - 1);
+	int slice = int(log(-vPos.z) * clusterDepth.x + clusterDepth.y);
+	slice = clamp(slice, 0, clusterGrid.z - 1);
+	int cluster = (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+	int first = texelFetch(clusterOffsets, cluster).r;
+	int last = texelFetch(clusterOffsets, cluster + 1).r;
+	vec3 albedo = vKd + kd_tex;
+	vec3 color3 = vec3(0.0);
+	for (int i = first; i < last; i++) {
+		int light = texelFetch(clusterLights, i).r;
+		vec4 posRange = texelFetch(lightData, 2 * light);
+		vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+		vec3 lightDir = posRange.xyz - vPos;
+		float dist = length(lightDir);
+		float fade = clamp(1.0 - dist / posRange.w, 0.0, 1.0);
+		if (fade > 0.0) {
+			lightDir /= dist;
+			vec3 halfDir = normalize(lightDir + eyeVector);
+			float lambertian = max(0.0, dot(lightDir, nf));
+			float specular = pow(max(0.0, dot(halfDir, nf)), s);
+			color3 += lightColor * (albedo * lambertian + ks * specular) * (fade * fade);
+		}
+	}
+	
+	fragColor = vec4(color1 + color3, 1.0) + color2;
+	
+	
+}
@@ -0,0 +1,49 @@
+#version 140
+
+// Must match depth_vert.glsl for the depth pre-pass
+invariant gl_Position;
+
+// Same inputs as vert.glsl, in the syntax that goes with clustered_frag.glsl
+uniform mat4 P;
+uniform mat4 MV;
+uniform mat4 MVit;
+uniform vec3 kd;
+
+uniform bool instanced;
+uniform float t;
+in vec3 aInstPos;   // translation
+in vec3 aInstScale; // scale
+in vec3 aInstKd;    // diffuse color
+in vec2 aInstPulse; // pulse amplitude and frequency
+
+in vec4 aPos; // in object space
+in vec3 aNor; // in object space
+
+in vec2 aTex;
+out vec2 vTex0;
+
+out vec3 vPos; // camera space position
+out vec3 vNor; // camera space normal
+out vec3 vKd;
+
+void main()
+{
+	vec4 pos = aPos;
+	vec3 nor = aNor;
+	vKd = kd;
+	if (instanced) {
+		float pulse = 1.0 + 0.5 * aInstPulse.x + 0.5 * aInstPulse.x * sin(2.0 * 3.14159265 * aInstPulse.y * t);
+		vec3 scale = aInstScale * pulse;
+		pos = vec4(aInstPos + scale * aPos.xyz, 1.0);
+		nor = aNor / scale; // inverse transpose of a scale
+		vKd = aInstKd;
+	}
+
+	gl_Position = P * MV * pos;
+	vec4 temp = MV * pos;
+	vPos = temp.xyz;
+	temp = MVit * vec4(nor, 0.0);
+	vNor = normalize(temp.xyz);
+
+	vTex0 = aTex;
+}
@@ -0,0 +1,91 @@
+#version 140
+
+// Lighting pass of the deferred path: the sun plus the point lights of each
+// pixel's froxel, with the same model as clustered_frag.glsl.
+uniform vec3 lightColor1;
+uniform vec3 lightPos1; // camera space
+uniform mat4 Pinv;
+
+// G-buffer (see GBuffer.h)
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gEmissive;
+uniform sampler2D gDepth;
+
+// Point lights binned per froxel by LightClusters
+uniform samplerBuffer lightData;
+uniform isamplerBuffer clusterOffsets;
+uniform isamplerBuffer clusterLights;
+uniform ivec3 clusterGrid;
+uniform vec2 viewport;
+uniform vec2 clusterDepth;
+
+out vec4 fragColor;
+
+vec3 decodeNormal(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepth, pixel, 0).r;
+	if (depth == 1.0) {
+		discard; // nothing was drawn here
+	}
+	gl_FragDepth = depth;
+
+	vec4 ndc = vec4(gl_FragCoord.xy / viewport * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec4 view = Pinv * ndc;
+	vec3 vPos = view.xyz / view.w;
+
+	vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+	vec3 ks = texelFetch(gSpecular, pixel, 0).rgb;
+	vec3 n = decodeNormal(texelFetch(gNormal, pixel, 0).xy);
+	vec3 emissive = texelFetch(gEmissive, pixel, 0).rgb;
+	float s = albedo.a * 255.0;
+	vec3 eyeVector = normalize(-1 * vPos);
+
+	//cd1: 
+	vec3 lightDir1 = normalize(lightPos1 - vPos);
+	float lambertian1 = max(0.0, dot(lightDir1, n));
+
+	//cs1:
+	vec3 halfDir1 = normalize(lightDir1 + eyeVector);
+	float specular1 = pow(max(0.0, dot(halfDir1, n)), s);
+
+	vec3 color = lightColor1 * (albedo.rgb * lambertian1 + ks * specular1) + emissive;
+
+	// Point lights, with the normal turned toward the eye
+	vec3 nf = faceforward(n, vPos, n);
+	ivec2 tile = ivec2(gl_FragCoord.xy / viewport * vec2(clusterGrid.xy));
+	tile = clamp(tile, ivec2(0), clusterGrid.xy - 1);
+	int slice = int(log(-vPos.z) * clusterDepth.x + clusterDepth.y);
+	slice = clamp(slice, 0, clusterGrid.z - 1);
+	int cluster = (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+	int first = texelFetch(clusterOffsets, cluster).r;
+	int last = texelFetch(clusterOffsets, cluster + 1).r;
+	for (int i = first; i < last; i++) {
+		int light = texelFetch(clusterLights, i).r;
+		vec4 posRange = texelFetch(lightData, 2 * light);
+		vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+		vec3 lightDir = posRange.xyz - vPos;
+		float dist = length(lightDir);
+		float fade = clamp(1.0 - dist / posRange.w, 0.0, 1.0);
+		if (fade > 0.0) {
+			lightDir /= dist;
+			vec3 halfDir = normalize(lightDir + eyeVector);
+			float lambertian = max(0.0, dot(lightDir, nf));
+			float specular = pow(max(0.0, dot(halfDir, nf)), s);
+			color += lightColor * (albedo.rgb * lambertian + ks * specular) * (fade * fade);
+		}
+	}
+
+	fragColor = vec4(color, 1.0);
+}
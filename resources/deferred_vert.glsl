@@ -0,0 +1,9 @@
+#version 140
+
+// Full screen pass over square.obj, which spans [-0.5, 0.5]^2
+in vec4 aPos;
+
+void main()
+{
+	gl_Position = vec4(2.0 * aPos.xy, 0.0, 1.0);
+}
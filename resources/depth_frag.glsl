@@ -0,0 +1,6 @@
+#version 120
+
+// Depth pre-pass: only the depth is written
+void main()
+{
+}
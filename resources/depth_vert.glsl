@@ -0,0 +1,28 @@
+#version 120
+
+// Depth pre-pass. The position must come out exactly as in vert.glsl,
+// batch_vert.glsl and clustered_vert.glsl, which the color pass then
+// tests against with GL_EQUAL.
+invariant gl_Position;
+
+uniform mat4 P;
+uniform mat4 MV;
+
+uniform bool instanced;
+uniform float t;
+attribute vec3 aInstPos;   // translation
+attribute vec3 aInstScale; // scale
+attribute vec2 aInstPulse; // pulse amplitude and frequency
+
+attribute vec4 aPos; // in object space
+
+void main()
+{
+	vec4 pos = aPos;
+	if (instanced) {
+		float pulse = 1.0 + 0.5 * aInstPulse.x + 0.5 * aInstPulse.x * sin(2.0 * 3.14159265 * aInstPulse.y * t);
+		vec3 scale = aInstScale * pulse;
+		pos = vec4(aInstPos + scale * aPos.xyz, 1.0);
+	}
+	gl_Position = P * MV * pos;
+}
@@ -1,41 +1,119 @@
 #version 120
+#extension GL_EXT_texture_array : enable
+
+// Feature switches. ShaderVariants injects every one of them after the
+// #version line; the defaults are the full shader.
+#ifndef HAS_TEXTURE
+#define HAS_TEXTURE 1  // add the color of texture0
+#endif
+#ifndef HAS_DIFFUSE
+#define HAS_DIFFUSE 1  // kd is not zero
+#endif
+#ifndef HAS_SPECULAR
+#define HAS_SPECULAR 1 // ks is not zero
+#endif
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS 1   // 1 or 2
+#endif
+#ifndef CEL_SHADING
+#define CEL_SHADING 0  // black silhouettes and four color bands
+#endif
+#ifndef VIRTUAL_TEXTURE
+#define VIRTUAL_TEXTURE 0 // the texture color comes from a VirtualTexture
+#endif
 
 uniform vec3 lightColor1;
 uniform vec3 lightPos1;
+#if NUM_LIGHTS > 1
+uniform vec3 lightColor2;
+uniform vec3 lightPos2;
+#endif
 uniform vec3 ka;
-uniform vec3 kd;
 uniform vec3 ks;
 uniform float s;
 
-uniform sampler2D texture0;
+#if HAS_TEXTURE && VIRTUAL_TEXTURE
+uniform sampler2D vtCache;
+uniform sampler2D vtIndirection;
+uniform vec4 vtLayout; // size, pages per side at level 0, levels, uv scale
+uniform vec4 vtPage;   // page size, border, page size with borders, cache size
+#elif HAS_TEXTURE
+uniform sampler2DArray texture0;
+uniform float textureLayer;
+#endif
 varying vec2 vTex0;
 
 varying vec3 vPos; // camera space position
 varying vec3 vNor; // camera space normal
+varying vec3 vKd;
 
-
-
-void main()
+vec3 shade(vec3 lightPos, vec3 lightColor)
 {
+	vec3 nor = normalize(vNor);
+	vec3 lightDir = normalize(lightPos - vPos);
+	vec3 eyeVector = normalize(-1 * vPos);
 
-	//cd1: 
-	vec3 lightDir1 = lightPos1 - vPos;
-	lightDir1 = normalize(lightDir1);
-	float lambertian1 = max(0.0, dot(lightDir1, normalize(vNor)));
+	//cd:
+#if HAS_DIFFUSE
+	float lambertian = max(0.0, dot(lightDir, nor));
+	vec3 cd = vKd * lambertian;
+#else
+	vec3 cd = vec3(0.0);
+#endif
 
-	//cs1:
-	vec3 eyeVector = normalize(-1 * vPos);
-	vec3 halfDir1 = normalize(lightDir1 + eyeVector);
-	float specular1 = pow(max(0.0, dot(halfDir1, normalize(vNor))), s);
+	//cs:
+#if HAS_SPECULAR
+	vec3 halfDir = normalize(lightDir + eyeVector);
+	float specular = pow(max(0.0, dot(halfDir, nor)), s);
+	vec3 cs = ks * specular;
+#else
+	vec3 cs = vec3(0.0);
+#endif
 
-	vec3 cd1 = kd * lambertian1;
-	vec3 cs1 = ks * specular1;
+	return lightColor * (ka + cd + cs);
+}
 
+#if HAS_TEXTURE && VIRTUAL_TEXTURE
+// Looks up the page for the level the screen footprint asks for. If it is
+// not cached, the indirection entry points at the closest coarser page.
+vec3 virtualTexture(vec2 uv)
+{
+	uv = clamp(uv, 0.0, 0.99999);
+	vec2 texels = uv * vtLayout.x;
+	float lod = log2(max(length(dFdx(texels)), length(dFdy(texels))));
+	float level = clamp(floor(lod), 0.0, vtLayout.z - 1.0);
+	float pages = vtLayout.y / exp2(level);
+	vec2 cell = vec2(floor(uv.x * pages), 2.0 * vtLayout.y - 2.0 * pages + floor(uv.y * pages));
+	vec3 entry = floor(texture2D(vtIndirection, (cell + 0.5) / vec2(vtLayout.y, 2.0 * vtLayout.y)).xyz * 255.0 + 0.5);
+	vec2 inPage = fract(uv * vtLayout.y / exp2(entry.z));
+	return texture2D(vtCache, (entry.xy * vtPage.z + vtPage.y + inPage * vtPage.x) / vtPage.w).rgb;
+}
+#endif
+
+void main()
+{
+	vec3 color1 = shade(lightPos1, lightColor1);
+#if NUM_LIGHTS > 1
+	color1 += shade(lightPos2, lightColor2);
+#endif
 
-	vec3 color1 = lightColor1 * (ka + cd1 + cs1);
+#if CEL_SHADING
+	if (dot(vNor, normalize(-1 * vPos)) < 0.3) {
+		color1 = vec3(0.0);
+	} else {
+		color1 = min(floor(color1 * 4.0) / 4.0, 1.0);
+	}
+#endif
 
-	vec3 kd_tex = texture2D(texture0, vTex0).rgb;
+#if HAS_TEXTURE && VIRTUAL_TEXTURE
+	vec3 kd_tex = virtualTexture(vTex0 * vtLayout.w);
+	vec4 color2 = vec4(kd_tex, 1.0);
+#elif HAS_TEXTURE
+	vec3 kd_tex = texture2DArray(texture0, vec3(vTex0, textureLayer)).rgb;
 	vec4 color2 = vec4(kd_tex, 1.0);
+#else
+	vec4 color2 = vec4(0.0, 0.0, 0.0, 1.0);
+#endif
 	
 	gl_FragColor = vec4(color1, 1.0) + color2;
 	
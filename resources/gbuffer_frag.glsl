@@ -0,0 +1,37 @@
+#version 120
+#extension GL_EXT_texture_array : enable
+
+// Geometry pass of the deferred path. Goes with vert.glsl and writes the
+// material instead of shading it (see GBuffer.h for the layout).
+uniform vec3 lightColor1;
+uniform vec3 ka;
+uniform vec3 ks;
+uniform float s;
+
+uniform sampler2DArray texture0;
+uniform float textureLayer;
+varying vec2 vTex0;
+
+varying vec3 vPos; // camera space position
+varying vec3 vNor; // camera space normal
+varying vec3 vKd;
+
+// Unit vector to [-1, 1]^2 on an octahedron folded into a square
+vec2 encodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0) {
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return e;
+}
+
+void main()
+{
+	vec3 kd_tex = texture2DArray(texture0, vec3(vTex0, textureLayer)).rgb;
+	gl_FragData[0] = vec4(vKd + kd_tex, s / 255.0);
+	gl_FragData[1] = vec4(ks, 1.0);
+	gl_FragData[2] = vec4(encodeNormal(normalize(vNor)), 0.0, 0.0);
+	gl_FragData[3] = vec4(lightColor1 * ka + kd_tex, 1.0);
+}
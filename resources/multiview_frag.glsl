@@ -0,0 +1,38 @@
+#version 150
+
+uniform vec3 lightColor1;
+uniform vec3 lightPos1; // world space
+uniform vec3 ka;
+uniform vec3 ks;
+uniform float s;
+
+in vec3 vPos; // world space position
+in vec3 vNor; // world space normal
+in vec3 vKd;
+in vec3 vEye; // world space eye position of the view
+
+out vec4 fragColor;
+
+void main()
+{
+
+	//cd1: 
+	vec3 lightDir1 = lightPos1 - vPos;
+	lightDir1 = normalize(lightDir1);
+	float lambertian1 = max(0.0, dot(lightDir1, normalize(vNor)));
+
+	//cs1:
+	vec3 eyeVector = normalize(vEye - vPos);
+	vec3 halfDir1 = normalize(lightDir1 + eyeVector);
+	float specular1 = pow(max(0.0, dot(halfDir1, normalize(vNor))), s);
+
+	vec3 cd1 = vKd * lambertian1;
+	vec3 cs1 = ks * specular1;
+
+
+	vec3 color1 = lightColor1 * (ka + cd1 + cs1);
+
+	fragColor = vec4(color1, 1.0);
+	
+	
+}
@@ -0,0 +1,51 @@
+#version 150
+#extension GL_ARB_viewport_array : require
+
+// Must match MultiView::MAX_VIEWS
+#define MAX_VIEWS 4
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 12) out;
+
+uniform int numViews;
+uniform mat4 PV[MAX_VIEWS];  // projection * view of each view
+uniform vec3 eye[MAX_VIEWS]; // world space eye position of each view
+
+in vec3 gPos[];
+in vec3 gNor[];
+in vec3 gKd[];
+
+out vec3 vPos; // world space position
+out vec3 vNor; // world space normal
+out vec3 vKd;
+out vec3 vEye;
+
+void main()
+{
+	for (int v = 0; v < numViews; v++) {
+		vec4 clip[3];
+		for (int i = 0; i < 3; i++) {
+			clip[i] = PV[v] * gl_in[i].gl_Position;
+		}
+		// Skip the view if the whole triangle is outside one of its planes
+		vec3 lo = vec3(1.0);
+		vec3 hi = vec3(1.0);
+		for (int i = 0; i < 3; i++) {
+			lo = min(lo, vec3(lessThan(clip[i].xyz, vec3(-clip[i].w))));
+			hi = min(hi, vec3(greaterThan(clip[i].xyz, vec3(clip[i].w))));
+		}
+		if (any(equal(lo, vec3(1.0))) || any(equal(hi, vec3(1.0)))) {
+			continue;
+		}
+		for (int i = 0; i < 3; i++) {
+			gl_ViewportIndex = v;
+			gl_Position = clip[i];
+			vPos = gPos[i];
+			vNor = gNor[i];
+			vKd = gKd[i];
+			vEye = eye[v];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
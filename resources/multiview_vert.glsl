@@ -0,0 +1,40 @@
+#version 150
+
+// World space only: the view and projection of each view are applied in
+// multiview_geom.glsl.
+uniform mat4 M;
+uniform mat4 Mit;
+uniform vec3 kd;
+
+// Instanced drawing: M is unused, and the placement and pulse animation of
+// each object come from the per-instance attributes (see vert.glsl).
+uniform bool instanced;
+uniform float t;
+in vec3 aInstPos;   // translation
+in vec3 aInstScale; // scale
+in vec3 aInstKd;    // diffuse color
+in vec2 aInstPulse; // pulse amplitude and frequency
+
+in vec4 aPos; // in object space
+in vec3 aNor; // in object space
+
+out vec3 gPos; // world space position
+out vec3 gNor; // world space normal
+out vec3 gKd;
+
+void main()
+{
+	vec4 pos = M * aPos;
+	vec3 nor = (Mit * vec4(aNor, 0.0)).xyz;
+	gKd = kd;
+	if (instanced) {
+		float pulse = 1.0 + 0.5 * aInstPulse.x + 0.5 * aInstPulse.x * sin(2.0 * 3.14159265 * aInstPulse.y * t);
+		vec3 scale = aInstScale * pulse;
+		pos = vec4(aInstPos + scale * aPos.xyz, 1.0);
+		nor = aNor / scale; // inverse transpose of a scale
+		gKd = aInstKd;
+	}
+	gPos = pos.xyz;
+	gNor = nor;
+	gl_Position = pos;
+}
@@ -1,8 +1,26 @@
 #version 120
 
+// Must match depth_vert.glsl for the depth pre-pass
+invariant gl_Position;
+
 uniform mat4 P;
 uniform mat4 MV;
 uniform mat4 MVit;
+uniform vec3 kd;
+
+// Instanced drawing: MV holds only the view matrix, and the placement and
+// pulse animation of each object come from the per-instance attributes.
+// A variant compiled with INSTANCED fixes the choice at compile time.
+#ifdef INSTANCED
+const bool instanced = (INSTANCED != 0);
+#else
+uniform bool instanced;
+#endif
+uniform float t;
+attribute vec3 aInstPos;   // translation
+attribute vec3 aInstScale; // scale
+attribute vec3 aInstKd;    // diffuse color
+attribute vec2 aInstPulse; // pulse amplitude and frequency
 
 attribute vec4 aPos; // in object space
 attribute vec3 aNor; // in object space
@@ -12,15 +30,27 @@ varying vec2 vTex0;
 
 varying vec3 vPos; // camera space position
 varying vec3 vNor; // camera space normal
+varying vec3 vKd;
 
 
 
 void main()
 {
-	gl_Position = P * MV * aPos;
-	vec4 temp = MV * aPos;
+	vec4 pos = aPos;
+	vec3 nor = aNor;
+	vKd = kd;
+	if (instanced) {
+		float pulse = 1.0 + 0.5 * aInstPulse.x + 0.5 * aInstPulse.x * sin(2.0 * 3.14159265 * aInstPulse.y * t);
+		vec3 scale = aInstScale * pulse;
+		pos = vec4(aInstPos + scale * aPos.xyz, 1.0);
+		nor = aNor / scale; // inverse transpose of a scale
+		vKd = aInstKd;
+	}
+
+	gl_Position = P * MV * pos;
+	vec4 temp = MV * pos;
 	vPos = temp.xyz;
-	temp = MVit * vec4(aNor, 0.0);
+	temp = MVit * vec4(nor, 0.0);
 	vNor = normalize(temp.xyz);
 
 	vTex0 = aTex;
@@ -0,0 +1,19 @@
+#version 120
+
+// The page of the VirtualTexture each fragment needs, as (column, row,
+// level, 1). Same level selection as virtualTexture() in frag.glsl, with
+// vtLodBias making up for the smaller target.
+uniform vec4 vtLayout; // size, pages per side at level 0, levels, uv scale
+uniform float vtLodBias;
+
+varying vec2 vTex0;
+
+void main()
+{
+	vec2 uv = clamp(vTex0 * vtLayout.w, 0.0, 0.99999);
+	vec2 texels = uv * vtLayout.x;
+	float lod = log2(max(length(dFdx(texels)), length(dFdy(texels)))) + vtLodBias;
+	float level = clamp(floor(lod), 0.0, vtLayout.z - 1.0);
+	vec2 page = floor(uv * vtLayout.y / exp2(level));
+	gl_FragColor = vec4(page, level, 255.0) / 255.0;
+}
@@ -0,0 +1,174 @@
+#include "Benchmark.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "FreeLookCamera.h"
+#include "GLSL.h"
+
+using namespace std;
+
+namespace {
+
+// The animation clock's step
+const double FRAME_SECONDS = 1.0 / 60.0;
+
+template <typename T>
+T catmullRom(const T &a, const T &b, const T &c, const T &d, float u)
+{
+	return 0.5f * (2.0f * b + (c - a) * u + (2.0f * a - 5.0f * b + 4.0f * c - d) * (u * u) + (3.0f * b - a - 3.0f * c + d) * (u * u * u));
+}
+
+// The same angle within pi of near, so that yaw turns the short way
+float unwrap(float angle, float near)
+{
+	float twoPi = 2.0f * (float)M_PI;
+	return angle - twoPi * round((angle - near) / twoPi);
+}
+
+template <typename T>
+T percentile(vector<T> values, int p)
+{
+	if(values.empty()) {
+		return T();
+	}
+	sort(values.begin(), values.end());
+	return values[min(values.size() - 1, values.size() * p / 100)];
+}
+
+template <typename T>
+double mean(const vector<T> &values)
+{
+	double sum = 0.0;
+	for(size_t i = 0; i < values.size(); i++) {
+		sum += values[i];
+	}
+	return values.empty() ? 0.0 : sum / values.size();
+}
+
+}
+
+Benchmark::Benchmark(int numFrames, int numWarmupFrames) :
+	numFrames(max(1, numFrames)),
+	numWarmupFrames(max(0, numWarmupFrames)),
+	frame(-1)
+{
+}
+
+Benchmark::~Benchmark()
+{
+}
+
+void Benchmark::setKeys(const vector<PoseBatch::Pose> &keys)
+{
+	this->keys = keys;
+}
+
+void Benchmark::setOrbit(const glm::vec3 &center, float radius)
+{
+	keys.clear();
+	for(int k = 0; k < 8; k++) {
+		float theta = 2.0f * (float)M_PI * k / 8.0f;
+		float height = k % 2 == 0 ? 2.0f : 4.0f;
+		PoseBatch::Pose p;
+		p.position = center + glm::vec3(radius * sin(theta), height, radius * cos(theta));
+		// FreeLookCamera's pitch is the slope of the view direction
+		p.yaw = theta + (float)M_PI;
+		p.pitch = -height / radius;
+		p.fovy = 45.0f * (float)M_PI / 180.0f;
+		p.index = k;
+		keys.push_back(p);
+	}
+}
+
+PoseBatch::Pose Benchmark::evaluate(float t) const
+{
+	int n = (int)keys.size();
+	float s = t * n;
+	int i = min((int)floor(s), n - 1);
+	float u = s - i;
+	const PoseBatch::Pose &p0 = keys[(i + n - 1) % n];
+	const PoseBatch::Pose &p1 = keys[i];
+	const PoseBatch::Pose &p2 = keys[(i + 1) % n];
+	const PoseBatch::Pose &p3 = keys[(i + 2) % n];
+	float yaw1 = p1.yaw;
+	float yaw0 = unwrap(p0.yaw, yaw1);
+	float yaw2 = unwrap(p2.yaw, yaw1);
+	float yaw3 = unwrap(p3.yaw, yaw2);
+	PoseBatch::Pose p;
+	p.position = catmullRom(p0.position, p1.position, p2.position, p3.position, u);
+	p.yaw = catmullRom(yaw0, yaw1, yaw2, yaw3, u);
+	p.pitch = catmullRom(p0.pitch, p1.pitch, p2.pitch, p3.pitch, u);
+	p.fovy = catmullRom(p0.fovy, p1.fovy, p2.fovy, p3.fovy, u);
+	p.index = i;
+	return p;
+}
+
+bool Benchmark::beginFrame(shared_ptr<FreeLookCamera> camera)
+{
+	// Otherwise the time is only that of submitting the previous frame
+	glFinish();
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	if(frame >= numWarmupFrames) {
+		frameMs.push_back(chrono::duration<double, milli>(now - frameStart).count());
+		drawCalls.push_back(GLSL::getNumDrawCalls());
+		triangles.push_back(GLSL::getNumTriangles());
+	}
+	frame++;
+	if(frame == numWarmupFrames + numFrames) {
+		return false;
+	}
+	GLSL::resetDrawStats();
+	frameStart = now;
+	if(!keys.empty()) {
+		// The warm-up stays at the start of the path
+		PoseBatch::Pose p = evaluate((float)max(0, frame - numWarmupFrames) / numFrames);
+		camera->setPose(p.position, p.yaw, p.pitch, p.fovy);
+	}
+	return true;
+}
+
+double Benchmark::getTime() const
+{
+	return max(0, frame - numWarmupFrames) * FRAME_SECONDS;
+}
+
+bool Benchmark::writeReport(const string &filename, int width, int height, int numObjects, const string &meshMix) const
+{
+	vector<double> sorted = frameMs;
+	sort(sorted.begin(), sorted.end());
+	double minMs = sorted.empty() ? 0.0 : sorted.front();
+	double maxMs = sorted.empty() ? 0.0 : sorted.back();
+	double median = percentile(frameMs, 50);
+	double p99 = percentile(frameMs, 99);
+	double meanMs = mean(frameMs);
+	cout << fixed << setprecision(3) << "Benchmark: " << frameMs.size() << " frames, min " << minMs << " ms, median " << median << " ms, p99 " << p99
+		<< " ms, " << mean(drawCalls) << " draw calls and " << mean(triangles) << " triangles per frame" << endl;
+	cout << defaultfloat;
+
+	ofstream out(filename);
+	if(!out) {
+		cerr << "Could not write " << filename << endl;
+		return false;
+	}
+	out << fixed << setprecision(3);
+	out << "{" << endl;
+	out << "  \"frames\": " << frameMs.size() << "," << endl;
+	out << "  \"warmup_frames\": " << numWarmupFrames << "," << endl;
+	out << "  \"width\": " << width << "," << endl;
+	out << "  \"height\": " << height << "," << endl;
+	out << "  \"objects\": " << numObjects << "," << endl;
+	out << "  \"mesh_mix\": \"" << meshMix << "\"," << endl;
+	out << "  \"frame_ms\": {\"min\": " << minMs << ", \"median\": " << median << ", \"p99\": " << p99
+		<< ", \"mean\": " << meanMs << ", \"max\": " << maxMs << "}," << endl;
+	out << "  \"fps\": " << (meanMs > 0.0 ? 1000.0 / meanMs : 0.0) << "," << endl;
+	out << "  \"draw_calls\": {\"mean\": " << mean(drawCalls) << ", \"max\": " << percentile(drawCalls, 100) << "}," << endl;
+	out << "  \"triangles\": {\"mean\": " << mean(triangles) << ", \"max\": " << percentile(triangles, 100) << "}" << endl;
+	out << "}" << endl;
+	cout << "Wrote " << filename << endl;
+	return true;
+}
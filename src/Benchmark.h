@@ -0,0 +1,63 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "PoseBatch.h"
+
+class FreeLookCamera;
+
+/**
+ * Times a fixed number of frames along a fixed camera path, so that runs
+ * can be compared. The camera follows a closed Catmull-Rom spline through
+ * key poses, going around once over the timed frames, and the animation
+ * clock advances 1/60 s per frame instead of following the wall clock. A
+ * few untimed frames come first.
+ *
+ * A frame's time is the wall time from its start to the next one's, so it
+ * includes the buffer swap. beginFrame() waits for the GPU before reading
+ * the clock, since a headless swap only flushes. Draw calls and triangles come from GLSL's
+ * counters. writeReport() saves the min, median and p99 frame times and
+ * the draw counts as JSON.
+ */
+class Benchmark
+{
+public:
+	Benchmark(int numFrames, int numWarmupFrames = 30);
+	virtual ~Benchmark();
+	// The path goes through these poses, then back to the first
+	void setKeys(const std::vector<PoseBatch::Pose> &keys);
+	// Eight keys around center at alternating heights, looking at it
+	void setOrbit(const glm::vec3 &center, float radius);
+	bool hasPath() const { return !keys.empty(); }
+	// Records the previous frame and moves the camera for this one. False
+	// once every frame has been timed.
+	bool beginFrame(std::shared_ptr<FreeLookCamera> camera);
+	// Seconds on the animation clock
+	double getTime() const;
+	bool writeReport(const std::string &filename, int width, int height, int numObjects, const std::string &meshMix) const;
+
+private:
+	Benchmark(const Benchmark &);
+	Benchmark &operator=(const Benchmark &);
+
+	PoseBatch::Pose evaluate(float t) const;
+
+	int numFrames;
+	int numWarmupFrames;
+	std::vector<PoseBatch::Pose> keys;
+	int frame; // the one being rendered, counting the warm-up
+	std::chrono::steady_clock::time_point frameStart;
+	std::vector<double> frameMs;
+	std::vector<int> drawCalls;
+	std::vector<long long> triangles;
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include "Compositor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
+
+#include "GLSL.h"
+
+using namespace std;
+
+namespace {
+
+// How long start() waits for each node to connect
+const int CONNECT_TIMEOUT_MS = 60000;
+
+double millisecondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+}
+
+Compositor::Compositor(int mode, int numNodes) :
+	mode(mode),
+	numNodes(numNodes),
+	listenFD(-1),
+	frame(0),
+	shares(numNodes, 1.0f / numNodes),
+	textureID(0),
+	fboID(0),
+	textureWidth(0),
+	textureHeight(0),
+	numFrames(0),
+	frameMs(0.0),
+	slowestMs(0.0),
+	compositeMs(0.0),
+	presentMs(0.0),
+	imbalance(0.0),
+	bytes(0.0),
+	nodeMs(numNodes, 0.0),
+	nodeRows(numNodes, 0.0)
+{
+}
+
+Compositor::~Compositor()
+{
+	if(fboID) {
+		glDeleteFramebuffers(1, &fboID);
+		glDeleteTextures(1, &textureID);
+	}
+#ifndef _WIN32
+	// The nodes quit once their connection closes
+	for(size_t i = 0; i < nodeFDs.size(); i++) {
+		close(nodeFDs[i]);
+	}
+	if(listenFD >= 0) {
+		close(listenFD);
+	}
+	for(size_t i = 0; i < children.size(); i++) {
+		waitpid(children[i], 0, 0);
+	}
+#endif
+}
+
+bool Compositor::isSupported()
+{
+	return RenderNode::isSupported();
+}
+
+bool Compositor::start(const string &program, const string &resourceDir, int port)
+{
+#ifdef _WIN32
+	cerr << "Distributed rendering is not supported on Windows" << endl;
+	return false;
+#else
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(port ? INADDR_ANY : INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	listenFD = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	socklen_t length = sizeof(address);
+	if(listenFD < 0 || bind(listenFD, (sockaddr *)&address, sizeof(address)) != 0 ||
+		listen(listenFD, numNodes) != 0 || getsockname(listenFD, (sockaddr *)&address, &length) != 0) {
+		cerr << "Could not listen on port " << port << endl;
+		return false;
+	}
+	// A node that quits shows up as a failed send instead
+	signal(SIGPIPE, SIG_IGN);
+	if(port == 0) {
+		string node = "--node=127.0.0.1:" + to_string(ntohs(address.sin_port));
+		for(int i = 0; i < numNodes; i++) {
+			string dir = resourceDir;
+			char *argv[] = { (char *)program.c_str(), &dir[0], &node[0], 0 };
+			pid_t child;
+			if(posix_spawnp(&child, argv[0], 0, 0, argv, environ) != 0) {
+				cerr << "Could not start render node " << i << endl;
+				return false;
+			}
+			children.push_back(child);
+		}
+	} else {
+		cout << "Waiting for " << numNodes << " render nodes on port " << port << endl;
+	}
+	// Nodes are numbered in the order they connect
+	while((int)nodeFDs.size() < numNodes) {
+		pollfd p = { listenFD, POLLIN, 0 };
+		if(poll(&p, 1, CONNECT_TIMEOUT_MS) <= 0) {
+			cerr << "Only " << nodeFDs.size() << " of " << numNodes << " render nodes connected" << endl;
+			return false;
+		}
+		int fd = accept(listenFD, 0, 0);
+		if(fd >= 0) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+			nodeFDs.push_back(fd);
+		}
+	}
+	cout << "Rendering with " << numNodes << " nodes, " << (mode == RenderNode::TILES ? "sort-first (tiles)" : "sort-last (objects)") << endl;
+	return true;
+#endif
+}
+
+vector<Compositor::Region> Compositor::split(int width, int height) const
+{
+	vector<Region> regions(numNodes);
+	if(mode == RenderNode::OBJECTS) {
+		for(int i = 0; i < numNodes; i++) {
+			Region r = { 0, 0, width, height };
+			regions[i] = r;
+		}
+		return regions;
+	}
+	// At least a row each
+	int y = 0;
+	float sum = 0.0f;
+	for(int i = 0; i < numNodes; i++) {
+		sum += shares[i];
+		int end = i == numNodes - 1 ? height : (int)round(sum * height);
+		end = min(max(end, y + 1), height - (numNodes - 1 - i));
+		Region r = { 0, y, width, end - y };
+		regions[i] = r;
+		y = end;
+	}
+	return regions;
+}
+
+void Compositor::rebalance(const vector<Region> &regions, const vector<float> &renderMs, int height)
+{
+	float total = 0.0f;
+	for(int i = 0; i < numNodes; i++) {
+		total += renderMs[i];
+	}
+	if(total <= 0.0f) {
+		return;
+	}
+	// Takes the cost as even within each strip and cuts the rows where the
+	// cost adds up to equal parts. Halfway there per frame, as the times are
+	// noisy.
+	int i = 0;
+	float below = 0.0f;
+	float previous = 0.0f;
+	for(int k = 1; k <= numNodes; k++) {
+		float cut = (float)height;
+		if(k < numNodes) {
+			float target = total * k / numNodes;
+			while(i < numNodes - 1 && below + renderMs[i] < target) {
+				below += renderMs[i];
+				i++;
+			}
+			float within = renderMs[i] > 0.0f ? (target - below) / renderMs[i] : 0.0f;
+			cut = regions[i].y + min(within, 1.0f) * regions[i].height;
+		}
+		shares[k - 1] = 0.5f * shares[k - 1] + 0.5f * (cut - previous) / height;
+		previous = cut;
+	}
+}
+
+void Compositor::composite(const Region &region, bool hasDepth, int width, bool first)
+{
+	size_t rowBytes = (size_t)region.width * 3;
+	if(!hasDepth || first) {
+		for(int y = 0; y < region.height; y++) {
+			memcpy(&color[((size_t)(region.y + y) * width + region.x) * 3], &pieceColor[y * rowBytes], rowBytes);
+		}
+		if(hasDepth) {
+			depth.swap(pieceDepth);
+		}
+		return;
+	}
+	// Whole frames, so the pixels line up
+	size_t n = depth.size();
+	for(size_t p = 0; p < n; p++) {
+		if(pieceDepth[p] < depth[p]) {
+			depth[p] = pieceDepth[p];
+			color[3 * p] = pieceColor[3 * p];
+			color[3 * p + 1] = pieceColor[3 * p + 1];
+			color[3 * p + 2] = pieceColor[3 * p + 2];
+		}
+	}
+}
+
+void Compositor::present(int width, int height)
+{
+	if(!fboID) {
+		glGenTextures(1, &textureID);
+		glGenFramebuffers(1, &fboID);
+	}
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	if(width != textureWidth || height != textureHeight) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureID, 0);
+		textureWidth = width;
+		textureHeight = height;
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &color[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fboID);
+	GLSL::bindDefaultFramebuffer(GL_DRAW_FRAMEBUFFER);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	GLSL::bindDefaultFramebuffer();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+bool Compositor::render(int width, int height, const glm::vec3 &position, float yaw, float pitch, float fovy, double time)
+{
+	if(width < numNodes || height < numNodes) {
+		return true;
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<Region> regions = split(width, height);
+	// The requests go out together so that the nodes render at once
+	for(int i = 0; i < numNodes; i++) {
+		RenderNode::Request r;
+		memset(static_cast<void *>(&r), 0, sizeof(r)); // padding included, it goes over the wire
+		r.frame = frame;
+		r.mode = mode;
+		r.node = i;
+		r.numNodes = numNodes;
+		r.width = width;
+		r.height = height;
+		r.x = regions[i].x;
+		r.y = regions[i].y;
+		r.regionWidth = regions[i].width;
+		r.regionHeight = regions[i].height;
+		r.position = position;
+		r.yaw = yaw;
+		r.pitch = pitch;
+		r.fovy = fovy;
+		r.time = time;
+		if(!RenderNode::sendAll(nodeFDs[i], &r, sizeof(r))) {
+			cerr << "Lost render node " << i << endl;
+			return false;
+		}
+	}
+	color.resize((size_t)width * height * 3);
+	vector<float> renderMs(numNodes);
+	double composited = 0.0;
+	for(int i = 0; i < numNodes; i++) {
+		RenderNode::Reply reply;
+		if(!RenderNode::receiveAll(nodeFDs[i], &reply, sizeof(reply)) || reply.frame != frame ||
+			reply.width != regions[i].width || reply.height != regions[i].height) {
+			cerr << "Lost render node " << i << endl;
+			return false;
+		}
+		size_t pixels = (size_t)reply.width * reply.height;
+		pieceColor.resize(pixels * 3);
+		pieceDepth.resize(reply.hasDepth ? pixels : 0);
+		if(!RenderNode::receiveAll(nodeFDs[i], &pieceColor[0], pieceColor.size()) ||
+			(reply.hasDepth && !RenderNode::receiveAll(nodeFDs[i], &pieceDepth[0], pixels * sizeof(float)))) {
+			cerr << "Lost render node " << i << endl;
+			return false;
+		}
+		chrono::steady_clock::time_point compositeStart = chrono::steady_clock::now();
+		composite(regions[i], reply.hasDepth != 0, width, i == 0);
+		composited += millisecondsSince(compositeStart);
+		renderMs[i] = reply.renderMs;
+		bytes += pixels * (reply.hasDepth ? 3 + sizeof(float) : 3);
+	}
+	chrono::steady_clock::time_point presentStart = chrono::steady_clock::now();
+	present(width, height);
+	presentMs += millisecondsSince(presentStart);
+	compositeMs += composited;
+	frameMs += millisecondsSince(start);
+
+	float slowest = *max_element(renderMs.begin(), renderMs.end());
+	float mean = 0.0f;
+	for(int i = 0; i < numNodes; i++) {
+		mean += renderMs[i] / numNodes;
+		nodeMs[i] += renderMs[i];
+		nodeRows[i] += regions[i].height;
+	}
+	slowestMs += slowest;
+	imbalance += mean > 0.0f ? slowest / mean : 1.0f;
+	numFrames++;
+	if(mode == RenderNode::TILES) {
+		rebalance(regions, renderMs, height);
+	}
+	frame++;
+	return true;
+}
+
+void Compositor::printStats()
+{
+	if(numFrames == 0) {
+		return;
+	}
+	double overhead = (frameMs - slowestMs) / numFrames;
+	cout << "Distributed frame: " << frameMs / numFrames << " ms, slowest node " << slowestMs / numFrames << " ms, imbalance "
+		<< imbalance / numFrames << ", overhead " << overhead << " ms (composite " << compositeMs / numFrames << " ms, upload "
+		<< presentMs / numFrames << " ms, " << bytes / numFrames / (1024.0 * 1024.0) << " MB received)" << endl;
+	for(int i = 0; i < numNodes; i++) {
+		cout << "  node " << i << ": " << nodeMs[i] / numFrames << " ms";
+		if(mode == RenderNode::TILES) {
+			cout << ", " << (int)round(nodeRows[i] / numFrames) << " rows";
+		}
+		cout << endl;
+		nodeMs[i] = 0.0;
+		nodeRows[i] = 0.0;
+	}
+	numFrames = 0;
+	frameMs = 0.0;
+	slowestMs = 0.0;
+	compositeMs = 0.0;
+	presentMs = 0.0;
+	imbalance = 0.0;
+	bytes = 0.0;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "RenderNode.h"
+
+/**
+ * Renders each frame on several RenderNode processes and puts it back
+ * together in the default framebuffer.
+ *   TILES (sort-first): every node draws a horizontal strip. The strips
+ *     are resized after every frame from the nodes' render times, so that
+ *     the rows that cost the most are spread over more nodes.
+ *   OBJECTS (sort-last): every node draws the whole frame with a share of
+ *     the objects, and the nearest fragment of each pixel wins.
+ * The nodes are this program started with --node=HOST:PORT. Without a
+ * port, start() runs them on this host and they connect over loopback.
+ * With one, it waits for nodes started by hand, on any host.
+ *
+ * Frames are synchronous: the requests go out together, and each piece is
+ * composited on the CPU as it arrives. printStats() reports every node's
+ * render time, the imbalance (the slowest node over the mean), and what
+ * the distribution adds to the slowest node: the transfers, compositing
+ * and the upload.
+ */
+class Compositor
+{
+public:
+	Compositor(int mode, int numNodes);
+	virtual ~Compositor();
+	// Listens on port, or on a free loopback port after starting the nodes
+	// as "program resourceDir --node=127.0.0.1:PORT", and waits until
+	// every node is connected
+	bool start(const std::string &program, const std::string &resourceDir, int port);
+	// Renders a width x height frame with the camera at the pose. False if
+	// a node went away.
+	bool render(int width, int height, const glm::vec3 &position, float yaw, float pitch, float fovy, double time);
+	// Averages since the last call
+	void printStats();
+	static bool isSupported();
+
+private:
+	Compositor(const Compositor &);
+	Compositor &operator=(const Compositor &);
+
+	struct Region
+	{
+		int x;
+		int y;
+		int width;
+		int height;
+	};
+
+	std::vector<Region> split(int width, int height) const;
+	void rebalance(const std::vector<Region> &regions, const std::vector<float> &renderMs, int height);
+	void composite(const Region &region, bool hasDepth, int width, bool first);
+	void present(int width, int height);
+
+	int mode;
+	int numNodes;
+	int listenFD;
+	std::vector<int> nodeFDs;
+	std::vector<int> children; // process IDs of the nodes started here
+	int frame;
+	std::vector<float> shares; // of the rows, per strip
+	// The frame so far, and the piece being received
+	std::vector<unsigned char> color;
+	std::vector<float> depth;
+	std::vector<unsigned char> pieceColor;
+	std::vector<float> pieceDepth;
+	GLuint textureID;
+	GLuint fboID;
+	int textureWidth;
+	int textureHeight;
+
+	// Sums since the last printStats()
+	int numFrames;
+	double frameMs;
+	double slowestMs;
+	double compositeMs;
+	double presentMs;
+	double imbalance;
+	double bytes;
+	std::vector<double> nodeMs;
+	std::vector<double> nodeRows;
+};
+
+#endif
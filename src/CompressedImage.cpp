@@ -0,0 +1,306 @@
+#include "CompressedImage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COMPRESSED_IMAGE_SSE2
+#endif
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+
+struct ImageHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t numLevels;
+	uint32_t pad;
+	uint64_t sourceHash;
+};
+
+const char IMAGE_MAGIC[4] = { 'B', 'C', '1', 'I' };
+const uint32_t IMAGE_VERSION = 1;
+
+inline unsigned char avg(unsigned a, unsigned b)
+{
+	// Same rounding as _mm_avg_epu8
+	return (unsigned char)((a + b + 1) >> 1);
+}
+
+inline int to565(const float *c)
+{
+	int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+	return (r << 11) | (g << 5) | b;
+}
+
+inline void from565(int c, int *rgb)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+}
+
+CompressedImage::CompressedImage() :
+	blocks(0)
+{
+}
+
+CompressedImage::~CompressedImage()
+{
+}
+
+size_t CompressedImage::getSize() const
+{
+	size_t size = 0;
+	for(size_t i = 0; i < levels.size(); i++) {
+		size += levels[i].size;
+	}
+	return size;
+}
+
+uint64_t CompressedImage::hash(const unsigned char *data, size_t size)
+{
+	uint64_t h = 14695981039346656037ull;
+	for(size_t i = 0; i < size; i++) {
+		h = (h ^ data[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+void CompressedImage::downsample(const unsigned char *src, int width, int height, unsigned char *dst)
+{
+	int w = max(width / 2, 1);
+	int h = max(height / 2, 1);
+	for(int y = 0; y < h; y++) {
+		const unsigned char *row0 = src + (size_t)min(2 * y, height - 1) * width * 4;
+		const unsigned char *row1 = src + (size_t)min(2 * y + 1, height - 1) * width * 4;
+		unsigned char *out = dst + (size_t)y * w * 4;
+		int x = 0;
+#ifdef COMPRESSED_IMAGE_SSE2
+		// 4 output pixels from 2 rows of 8: average the rows, then the even
+		// and odd pixels
+		if(width >= 2) {
+			for(; x + 4 <= w; x += 4) {
+				__m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + 8 * x)), _mm_loadu_si128((const __m128i *)(row1 + 8 * x)));
+				__m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(row0 + 8 * x + 16)), _mm_loadu_si128((const __m128i *)(row1 + 8 * x + 16)));
+				__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+				__m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+				_mm_storeu_si128((__m128i *)(out + 4 * x), _mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd)));
+			}
+		}
+#endif
+		for(; x < w; x++) {
+			int x0 = min(2 * x, width - 1);
+			int x1 = min(2 * x + 1, width - 1);
+			for(int c = 0; c < 4; c++) {
+				out[4 * x + c] = avg(avg(row0[4 * x0 + c], row1[4 * x0 + c]), avg(row0[4 * x1 + c], row1[4 * x1 + c]));
+			}
+		}
+	}
+}
+
+void CompressedImage::encodeBlock(const unsigned char *rgba, unsigned char *block)
+{
+	// Endpoints at the extremes of the principal axis of the colors
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for(int i = 0; i < 16; i++) {
+		for(int c = 0; c < 3; c++) {
+			mean[c] += rgba[4 * i + c] / 16.0f;
+		}
+	}
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for(int i = 0; i < 16; i++) {
+		float r = rgba[4 * i] - mean[0];
+		float g = rgba[4 * i + 1] - mean[1];
+		float b = rgba[4 * i + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for(int k = 0; k < 8; k++) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float len = max(max(fabs(x), fabs(y)), fabs(z));
+		if(len < 1e-6f) {
+			break; // flat block
+		}
+		axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+	}
+	float tmin = 1e30f, tmax = -1e30f;
+	for(int i = 0; i < 16; i++) {
+		float t = (rgba[4 * i] - mean[0]) * axis[0] + (rgba[4 * i + 1] - mean[1]) * axis[1] + (rgba[4 * i + 2] - mean[2]) * axis[2];
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float e0[3], e1[3];
+	for(int c = 0; c < 3; c++) {
+		e0[c] = min(max(mean[c] + axis[c] * tmax / len2, 0.0f), 255.0f);
+		e1[c] = min(max(mean[c] + axis[c] * tmin / len2, 0.0f), 255.0f);
+	}
+	int c0 = to565(e0);
+	int c1 = to565(e1);
+	// c0 > c1 selects the four color mode
+	if(c0 < c1) {
+		swap(c0, c1);
+	}
+	unsigned indices = 0;
+	if(c0 != c1) {
+		int p[4][3];
+		from565(c0, p[0]);
+		from565(c1, p[1]);
+		for(int c = 0; c < 3; c++) {
+			p[2][c] = (2 * p[0][c] + p[1][c]) / 3;
+			p[3][c] = (p[0][c] + 2 * p[1][c]) / 3;
+		}
+		for(int i = 0; i < 16; i++) {
+			int best = 0;
+			int bestDist = 1 << 30;
+			for(int j = 0; j < 4; j++) {
+				int dr = rgba[4 * i] - p[j][0];
+				int dg = rgba[4 * i + 1] - p[j][1];
+				int db = rgba[4 * i + 2] - p[j][2];
+				int d = dr * dr + dg * dg + db * db;
+				if(d < bestDist) {
+					bestDist = d;
+					best = j;
+				}
+			}
+			indices |= (unsigned)best << (2 * i);
+		}
+	}
+	block[0] = c0 & 0xff;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 0xff;
+	block[3] = c1 >> 8;
+	for(int i = 0; i < 4; i++) {
+		block[4 + i] = (indices >> (8 * i)) & 0xff;
+	}
+}
+
+void CompressedImage::encode(const unsigned char *rgba, int width, int height, int numThreads)
+{
+	file.close();
+	levels.clear();
+	encoded.clear();
+	ThreadPool pool(numThreads);
+	vector<unsigned char> image(rgba, rgba + (size_t)width * height * 4);
+	vector<unsigned char> smaller;
+	int w = width;
+	int h = height;
+	for(;;) {
+		Level level;
+		level.width = w;
+		level.height = h;
+		level.offset = (uint32_t)encoded.size();
+		int bw = (w + 3) / 4;
+		int bh = (h + 3) / 4;
+		level.size = bw * bh * 8;
+		levels.push_back(level);
+		encoded.resize(encoded.size() + level.size);
+		unsigned char *out = &encoded[level.offset];
+		const unsigned char *src = &image[0];
+		// One row of blocks per item. Partial blocks repeat the edge pixels.
+		pool.parallelFor(bh, [&](int by) {
+			unsigned char pixels[64];
+			for(int bx = 0; bx < bw; bx++) {
+				for(int y = 0; y < 4; y++) {
+					int sy = min(4 * by + y, h - 1);
+					for(int x = 0; x < 4; x++) {
+						int sx = min(4 * bx + x, w - 1);
+						memcpy(pixels + 16 * y + 4 * x, src + ((size_t)sy * w + sx) * 4, 4);
+					}
+				}
+				encodeBlock(pixels, out + ((size_t)by * bw + bx) * 8);
+			}
+		});
+		if(w == 1 && h == 1) {
+			break;
+		}
+		smaller.resize((size_t)max(w / 2, 1) * max(h / 2, 1) * 4);
+		downsample(&image[0], w, h, &smaller[0]);
+		image.swap(smaller);
+		w = max(w / 2, 1);
+		h = max(h / 2, 1);
+	}
+	blocks = &encoded[0];
+}
+
+bool CompressedImage::save(const string &filename, uint64_t sourceHash) const
+{
+	if(encoded.empty()) {
+		return false;
+	}
+	ImageHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, IMAGE_MAGIC, 4);
+	hdr.version = IMAGE_VERSION;
+	hdr.width = levels[0].width;
+	hdr.height = levels[0].height;
+	hdr.numLevels = (uint32_t)levels.size();
+	hdr.sourceHash = sourceHash;
+	// Other processes may be mapping the old file
+	string temp = MappedFile::tempName(filename);
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't write to " << temp << endl;
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(&levels[0], sizeof(Level), levels.size(), fp) == levels.size() &&
+		fwrite(&encoded[0], 1, encoded.size(), fp) == encoded.size();
+	ok = fclose(fp) == 0 && ok;
+	if(!ok) {
+		remove(temp.c_str());
+	} else if(!MappedFile::replace(temp, filename)) {
+		cerr << "Couldn't replace " << filename << endl;
+		ok = false;
+	}
+	return ok;
+}
+
+bool CompressedImage::load(const string &filename, uint64_t sourceHash)
+{
+	levels.clear();
+	encoded.clear();
+	blocks = 0;
+	if(!file.open(filename) || file.getSize() < sizeof(ImageHeader)) {
+		return false;
+	}
+	ImageHeader hdr;
+	memcpy(&hdr, file.getData(), sizeof(hdr));
+	size_t tableEnd = sizeof(hdr) + (size_t)hdr.numLevels * sizeof(Level);
+	if(memcmp(hdr.magic, IMAGE_MAGIC, 4) != 0 || hdr.version != IMAGE_VERSION ||
+	   hdr.sourceHash != sourceHash || hdr.numLevels == 0 || file.getSize() < tableEnd) {
+		file.close();
+		return false;
+	}
+	levels.resize(hdr.numLevels);
+	memcpy(&levels[0], file.getData() + sizeof(hdr), hdr.numLevels * sizeof(Level));
+	const Level &last = levels.back();
+	if(file.getSize() < tableEnd + last.offset + last.size) {
+		levels.clear();
+		file.close();
+		return false;
+	}
+	blocks = file.getData() + tableEnd;
+	return true;
+}
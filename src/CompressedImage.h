@@ -0,0 +1,56 @@
+#pragma once
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+/**
+ * An image and its full mip chain encoded as BC1 (DXT1) blocks, ready for
+ * glCompressedTexImage2D. encode() builds the mipmaps with a 2x2 box filter
+ * (SSE2 where available) and compresses the blocks on several threads.
+ * save() writes a small container (header, level table, blocks), and load()
+ * memory-maps one, so a cached texture is uploaded straight from the page
+ * cache. The header records a hash of the source file to detect stale
+ * copies.
+ */
+class CompressedImage
+{
+public:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t offset; // from the start of the block data
+		uint32_t size;
+	};
+
+	CompressedImage();
+	virtual ~CompressedImage();
+	// rgba is 4 bytes per pixel, rows first to last as uploaded to GL
+	void encode(const unsigned char *rgba, int width, int height, int numThreads);
+	bool save(const std::string &filename, uint64_t sourceHash) const;
+	bool load(const std::string &filename, uint64_t sourceHash);
+	int getNumLevels() const { return (int)levels.size(); }
+	const Level &getLevel(int i) const { return levels[i]; }
+	const unsigned char *getLevelData(int i) const { return blocks + levels[i].offset; }
+	// Sum of the level sizes
+	size_t getSize() const;
+	// FNV-1a, for the source hash
+	static uint64_t hash(const unsigned char *data, size_t size);
+	// Halves an RGBA image (each side rounds down, but not below 1)
+	static void downsample(const unsigned char *src, int width, int height, unsigned char *dst);
+	// 16 RGBA pixels in rows of 4 to one 8-byte BC1 block
+	static void encodeBlock(const unsigned char *rgba, unsigned char *block);
+
+private:
+	std::vector<Level> levels;
+	std::vector<unsigned char> encoded; // output of encode()
+	MappedFile file;                    // output of load()
+	const unsigned char *blocks;        // points into one of the above
+};
+
+#endif
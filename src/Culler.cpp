@@ -0,0 +1,133 @@
+#include "Culler.h"
+
+#include <algorithm>
+
+#include "Object.h"
+
+using namespace std;
+
+Culler::Culler() :
+	mode(NONE),
+	havePrev(false),
+	sceneRadius(0.0f),
+	drift(0.0),
+	numTested(0),
+	numVisible(0)
+{
+}
+
+Culler::~Culler()
+{
+}
+
+void Culler::setMode(int m)
+{
+	mode = m;
+	reset();
+}
+
+const char *Culler::getModeName() const
+{
+	switch(mode) {
+		case FULL:
+			return "full";
+		case COHERENT:
+			return "coherent";
+		default:
+			return "none";
+	}
+}
+
+void Culler::setObjects(const vector<Object*> &objects, float minScale, float maxScale)
+{
+	spheres.clear();
+	sceneRadius = 0.0f;
+	for(size_t i = 0; i < objects.size(); i++) {
+		Object *obj = objects[i];
+		const glm::vec3 &bmin = obj->getShape()->getBoundsMin();
+		const glm::vec3 &bmax = obj->getShape()->getBoundsMax();
+		// Drawn as T * S * s * p with s in [minScale, maxScale], so the box
+		// center slides along S*c as s changes.
+		glm::vec3 c = obj->getScale() * (0.5f * (bmin + bmax));
+		glm::vec3 h = obj->getScale() * (0.5f * (bmax - bmin));
+		float mid = 0.5f * (minScale + maxScale);
+		glm::vec3 center = obj->getTranslation() + mid * c;
+		float radius = maxScale * glm::length(h) + 0.5f * (maxScale - minScale) * glm::length(c);
+		spheres.push_back(glm::vec4(center, radius));
+		sceneRadius = max(sceneRadius, glm::length(center) + radius);
+	}
+	visible.assign(spheres.size(), 0);
+	reset();
+}
+
+void Culler::reset()
+{
+	havePrev = false;
+	drift = 0.0;
+	retest = priority_queue<Retest, vector<Retest>, greater<Retest> >();
+	numTested = 0;
+	numVisible = 0;
+}
+
+void Culler::testObject(int i)
+{
+	float slack;
+	bool in = frustum.testSphere(glm::vec3(spheres[i]), spheres[i].w, &slack);
+	numVisible += (int)in - (int)visible[i];
+	visible[i] = in;
+	numTested++;
+	if(mode == COHERENT) {
+		retest.push(Retest(drift + slack, i));
+	}
+}
+
+void Culler::update(const glm::mat4 &P, const glm::mat4 &V)
+{
+	numTested = 0;
+	if(mode == NONE) {
+		return;
+	}
+	frustum.extract(P * V);
+	if(mode == FULL || !havePrev) {
+		// Classify everything from scratch
+		retest = priority_queue<Retest, vector<Retest>, greater<Retest> >();
+		for(int i = 0; i < (int)spheres.size(); i++) {
+			testObject(i);
+		}
+	} else {
+		// Only objects whose slack has been used up can have changed
+		drift += frustum.maxPlaneDrift(prevFrustum, sceneRadius);
+		vector<int> expired;
+		while(!retest.empty() && retest.top().first <= drift) {
+			expired.push_back(retest.top().second);
+			retest.pop();
+		}
+		for(size_t k = 0; k < expired.size(); k++) {
+			testObject(expired[k]);
+		}
+	}
+	prevFrustum = frustum;
+	havePrev = true;
+}
+
+void Culler::update(const vector<glm::mat4> &PV)
+{
+	// The coherent bookkeeping follows a single frustum, so start it over
+	reset();
+	if(mode == NONE) {
+		return;
+	}
+	vector<Frustum> frusta(PV.size());
+	for(size_t v = 0; v < PV.size(); v++) {
+		frusta[v].extract(PV[v]);
+	}
+	for(int i = 0; i < (int)spheres.size(); i++) {
+		bool in = false;
+		for(size_t v = 0; v < frusta.size() && !in; v++) {
+			in = frusta[v].testSphere(glm::vec3(spheres[i]), spheres[i].w);
+		}
+		visible[i] = in;
+		numVisible += (int)in;
+		numTested++;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef CULLER_H
+#define CULLER_H
+
+#include <vector>
+#include <queue>
+#include <utility>
+#include <functional>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Frustum.h"
+
+class Object;
+
+/**
+ * View frustum culling of the scene objects against bounding spheres.
+ * - FULL tests every object every frame.
+ * - COHERENT starts from last frame's visible set. Every test also records
+ *   how far the frustum planes may move before that object's answer can
+ *   flip, and the object is only tested again once the accumulated camera
+ *   motion has used up that slack. Objects deep inside or far outside the
+ *   frustum are left alone, so the per-frame cost follows the amount of
+ *   change rather than the number of objects.
+ * With several views (see MultiView) an object is visible if it is inside
+ * any of their frusta. That union is always classified from scratch.
+ */
+class Culler
+{
+public:
+	enum {
+		NONE = 0,
+		FULL,
+		COHERENT,
+		NUM_MODES
+	};
+
+	Culler();
+	virtual ~Culler();
+	void setMode(int m);
+	int getMode() const { return mode; }
+	const char *getModeName() const;
+	// Computes the world space bounding spheres. minScale and maxScale bound
+	// any extra uniform scale applied at draw time (e.g. the pulse animation).
+	void setObjects(const std::vector<Object*> &objects, float minScale, float maxScale);
+	void update(const glm::mat4 &P, const glm::mat4 &V);
+	// Union of several frusta, each given as projection * view
+	void update(const std::vector<glm::mat4> &PV);
+	bool isVisible(int i) const { return mode == NONE || visible[i] != 0; }
+	int getNumVisible() const { return (mode == NONE) ? (int)spheres.size() : numVisible; }
+	int getNumTested() const { return numTested; }
+
+private:
+	typedef std::pair<double,int> Retest;
+
+	void reset();
+	void testObject(int i);
+
+	int mode;
+	std::vector<glm::vec4> spheres; // world space center (xyz) and radius (w)
+	std::vector<char> visible;
+	Frustum frustum;
+	Frustum prevFrustum;
+	bool havePrev;
+	float sceneRadius; // bounds |p| for every point of every sphere
+	double drift;      // accumulated plane movement since the last reset
+	std::priority_queue<Retest, std::vector<Retest>, std::greater<Retest> > retest;
+	int numTested;
+	int numVisible;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "FrameCapture.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GLSL.h"
+
+using namespace std;
+
+FrameCapture::FrameCapture(shared_ptr<FrameSink> sink, int numBuffers, int numThreads) :
+	sink(sink),
+	next(0),
+	numWaits(0),
+	numWritten(0),
+	numFailed(0),
+	quit(false)
+{
+	buffers.resize(max(numBuffers, 1));
+	for(size_t i = 0; i < buffers.size(); i++) {
+		Buffer &b = buffers[i];
+		glGenBuffers(1, &b.pbo);
+		b.capacity = 0;
+		b.fence = 0;
+		b.state = FREE;
+		b.width = 0;
+		b.height = 0;
+		b.stride = 0;
+	}
+	// One thread keeps a stream's frames in order
+	if(sink->isStream()) {
+		numThreads = 1;
+	}
+	for(int i = 0; i < max(numThreads, 1); i++) {
+		workers.push_back(thread(&FrameCapture::workerLoop, this));
+	}
+}
+
+FrameCapture::~FrameCapture()
+{
+	// The encoders hand what is queued to the sink before they stop
+	{
+		lock_guard<mutex> lock(taskMutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	for(size_t i = 0; i < buffers.size(); i++) {
+		if(buffers[i].fence) {
+			glDeleteSync(buffers[i].fence);
+		}
+		// Deleting a mapped buffer unmaps it
+		glDeleteBuffers(1, &buffers[i].pbo);
+	}
+}
+
+bool FrameCapture::isSupported()
+{
+	return (GLEW_VERSION_3_2 || GLEW_ARB_sync) &&
+		(GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range) &&
+		(GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object);
+}
+
+void FrameCapture::capture(int width, int height, int frame)
+{
+	Buffer &b = buffers[next];
+	if(b.state != FREE) {
+		// Every buffer is busy, so wait for the oldest one to be written
+		numWaits++;
+		if(b.state == READING) {
+			encode(next, true);
+		}
+		if(b.state == ENCODING) {
+			unique_lock<mutex> lock(taskMutex);
+			int index = next;
+			done.wait(lock, [this, index]() { return find(written.begin(), written.end(), index) != written.end(); });
+		}
+		recycle();
+	}
+
+	b.width = width;
+	b.height = height;
+	b.stride = 3 * width;
+	b.stride += (b.stride % 4) ? (4 - b.stride % 4) : 0;
+	b.frame = frame;
+	size_t size = (size_t)b.stride * height;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+	if(size > b.capacity) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+		b.capacity = size;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadBuffer(GLSL::getDefaultColorBuffer());
+	// With a pack buffer bound, the data pointer is an offset into it
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	b.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	b.state = READING;
+	next = (next + 1) % (int)buffers.size();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void FrameCapture::update()
+{
+	recycle();
+	// Oldest first, and no further than the first readback still running,
+	// so the frames reach the sink in order
+	for(size_t i = 0; i < buffers.size(); i++) {
+		int index = (next + (int)i) % (int)buffers.size();
+		if(buffers[index].state == READING && !encode(index, false)) {
+			break;
+		}
+	}
+}
+
+bool FrameCapture::encode(int index, bool wait)
+{
+	Buffer &b = buffers[index];
+	GLuint64 timeout = wait ? 1000000000ull : 0;
+	GLenum status = glClientWaitSync(b.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+	while(wait && status == GL_TIMEOUT_EXPIRED) {
+		status = glClientWaitSync(b.fence, 0, timeout);
+	}
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+		return false;
+	}
+	glDeleteSync(b.fence);
+	b.fence = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+	const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)b.stride * b.height, GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	if(!pixels) {
+		cerr << "Could not map a pixel pack buffer for frame " << b.frame << endl;
+		b.state = FREE;
+		lock_guard<mutex> lock(taskMutex);
+		numFailed++;
+		return true;
+	}
+	// The buffer stays mapped while its encoder reads it. GL doesn't touch
+	// it again until recycle() unmaps it.
+	b.state = ENCODING;
+	const unsigned char *rgb = (const unsigned char *)pixels;
+	int frame = b.frame;
+	int width = b.width;
+	int height = b.height;
+	int stride = b.stride;
+	{
+		lock_guard<mutex> lock(taskMutex);
+		tasks.push_back([this, index, rgb, frame, width, height, stride]() {
+			bool ok = sink->write(frame, rgb, width, height, stride);
+			lock_guard<mutex> lock(taskMutex);
+			numFailed += ok ? 0 : 1;
+			written.push_back(index);
+			done.notify_all();
+		});
+	}
+	wake.notify_one();
+	return true;
+}
+
+void FrameCapture::recycle()
+{
+	lock_guard<mutex> lock(taskMutex);
+	for(size_t i = 0; i < written.size(); i++) {
+		Buffer &b = buffers[written[i]];
+		if(b.state == ENCODING) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		b.state = FREE;
+		numWritten++;
+	}
+	written.clear();
+}
+
+void FrameCapture::workerLoop()
+{
+	for(;;) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(taskMutex);
+			wake.wait(lock, [this]() { return quit || !tasks.empty(); });
+			if(tasks.empty()) {
+				return;
+			}
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+bool FrameCapture::finish()
+{
+	// Oldest first, as in update(), since the ring may have wrapped
+	for(size_t i = 0; i < buffers.size(); i++) {
+		int index = (next + (int)i) % (int)buffers.size();
+		if(buffers[index].state == READING) {
+			encode(index, true);
+		}
+	}
+	{
+		unique_lock<mutex> lock(taskMutex);
+		done.wait(lock, [this]() {
+			size_t encoding = 0;
+			for(size_t i = 0; i < buffers.size(); i++) {
+				encoding += buffers[i].state == ENCODING ? 1 : 0;
+			}
+			return written.size() == encoding;
+		});
+	}
+	recycle();
+	lock_guard<mutex> lock(taskMutex);
+	bool ok = numFailed == 0;
+	numFailed = 0;
+	return ok;
+}
+
+int FrameCapture::getNumPending() const
+{
+	int pending = 0;
+	for(size_t i = 0; i < buffers.size(); i++) {
+		pending += buffers[i].state != FREE ? 1 : 0;
+	}
+	return pending;
+}
+
+void FrameCapture::printStats()
+{
+	cout << "Capture: " << numWritten << " frames written, " << numWaits << " waits for a free buffer, " << getNumPending() << " in flight" << endl;
+	numWritten = 0;
+	numWaits = 0;
+}
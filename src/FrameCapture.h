@@ -0,0 +1,85 @@
+#pragma once
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FrameSink.h"
+
+/**
+ * Saves frames without stalling the GL thread. capture() reads the back
+ * buffer into one of a ring of pixel pack buffers and puts a fence after
+ * it, so glReadPixels returns at once. update(), called once per frame,
+ * maps the buffers whose fences have signaled and hands them to encoder
+ * threads, which pass the mapped memory straight to the FrameSink. The
+ * buffer is unmapped and reused once the sink is done with it. The ring is
+ * all the memory the capture uses: when every buffer is still busy,
+ * capture() waits for the oldest one, so a slow sink slows the rendering
+ * down instead of queuing frames.
+ */
+class FrameCapture
+{
+public:
+	// numBuffers frames can be in flight, and numThreads encode at once.
+	// A stream sink gets a single thread.
+	FrameCapture(std::shared_ptr<FrameSink> sink, int numBuffers, int numThreads);
+	virtual ~FrameCapture();
+	// Reads the width x height back buffer as the sink's frame number frame
+	void capture(int width, int height, int frame);
+	// Hands finished readbacks to the encoders and recycles written buffers
+	void update();
+	// Blocks until every captured frame is written. Returns false if any
+	// frame since the last call couldn't be.
+	bool finish();
+	int getNumPending() const;
+	// Frames written, and times capture() had to wait, since the last call
+	void printStats();
+	static bool isSupported();
+
+private:
+	FrameCapture(const FrameCapture &);
+	FrameCapture &operator=(const FrameCapture &);
+
+	enum State { FREE, READING, ENCODING };
+	struct Buffer
+	{
+		GLuint pbo;
+		size_t capacity;
+		GLsync fence;
+		State state;
+		int width;
+		int height;
+		int stride;
+		int frame;
+	};
+
+	bool encode(int index, bool wait);
+	void recycle();
+	void workerLoop();
+
+	std::shared_ptr<FrameSink> sink;
+	std::vector<Buffer> buffers;
+	int next;     // the buffer the next capture() reads into
+	int numWaits; // captures that found every buffer busy
+	int numWritten;
+
+	std::vector<std::thread> workers;
+	std::mutex taskMutex; // guards everything below
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::deque< std::function<void()> > tasks;
+	std::vector<int> written; // buffers the encoders are done with
+	int numFailed;
+	bool quit;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "FrameSink.h"
+
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+#include "MappedFile.h"
+#include "stb_image_write.h"
+
+using namespace std;
+
+namespace {
+
+bool endsWith(const string &s, const string &suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// The number of %d or %i in pattern, or -1 if it isn't safe to give
+// snprintf with the frame number. Flags, width and precision are allowed,
+// lengths and other conversions aren't.
+int countConversions(const string &pattern)
+{
+	int numConversions = 0;
+	for(size_t i = 0; i < pattern.size(); i++) {
+		if(pattern[i] != '%') {
+			continue;
+		}
+		if(++i < pattern.size() && pattern[i] == '%') {
+			continue;
+		}
+		i = pattern.find_first_not_of("-+ #0", i);
+		i = pattern.find_first_not_of("0123456789", i);
+		if(i < pattern.size() && pattern[i] == '.') {
+			i = pattern.find_first_not_of("0123456789", i + 1);
+		}
+		if(i >= pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) {
+			return -1;
+		}
+		numConversions++;
+	}
+	return numConversions;
+}
+
+}
+
+shared_ptr<FrameSink> FrameSink::open(const string &target, const string &format, int fps)
+{
+	string type = format;
+	if(type.empty()) {
+		if(endsWith(target, ".png")) {
+			type = "png";
+		} else if(endsWith(target, ".y4m")) {
+			type = "y4m";
+		} else {
+			type = "rgb";
+		}
+	}
+	if(type == "png") {
+		int numConversions = countConversions(target);
+		if(numConversions < 0 || numConversions > 1) {
+			cerr << "Expected a PNG target with at most one %d, e.g. name%05d.png: " << target << endl;
+			return shared_ptr<FrameSink>();
+		}
+		return make_shared<PngSequenceSink>(target, numConversions == 1);
+	}
+	if(type != "y4m" && type != "rgb") {
+		cerr << "Unknown capture format " << type << endl;
+		return shared_ptr<FrameSink>();
+	}
+	shared_ptr<RawVideoSink> sink = make_shared<RawVideoSink>();
+	if(!sink->open(target, type == "y4m", fps)) {
+		return shared_ptr<FrameSink>();
+	}
+	return sink;
+}
+
+PngSequenceSink::PngSequenceSink(const string &pattern, bool numbered) :
+	pattern(pattern),
+	numbered(numbered),
+	newest(INT_MIN)
+{
+	// GL's rows go bottom to top. Set before any encoder reads the flag.
+	stbi_flip_vertically_on_write(true);
+}
+
+bool PngSequenceSink::write(int frame, const unsigned char *rgb, int width, int height, int stride)
+{
+	char filename[1024];
+	snprintf(filename, sizeof(filename), pattern.c_str(), frame);
+	if(numbered) {
+		if(!stbi_write_png(filename, width, height, 3, rgb, stride)) {
+			cerr << "Couldn't write to " << filename << endl;
+			return false;
+		}
+		return true;
+	}
+	// Every frame goes to the same file. The encoders each write a file of
+	// their own, and since they may finish out of order, only a newer frame
+	// replaces the target.
+	string temp = MappedFile::tempName(filename) + "." + to_string(frame);
+	if(!stbi_write_png(temp.c_str(), width, height, 3, rgb, stride)) {
+		cerr << "Couldn't write to " << temp << endl;
+		remove(temp.c_str());
+		return false;
+	}
+	lock_guard<mutex> lock(replaceMutex);
+	if(frame < newest) {
+		remove(temp.c_str());
+		return true;
+	}
+	newest = frame;
+	if(!MappedFile::replace(temp, filename)) {
+		cerr << "Couldn't write to " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+RawVideoSink::RawVideoSink() :
+	file(0),
+	pipe(false),
+	y4m(false),
+	fps(30),
+	width(0),
+	height(0),
+	broken(false)
+{
+}
+
+RawVideoSink::~RawVideoSink()
+{
+	if(!file) {
+		return;
+	}
+	if(pipe) {
+		pclose(file);
+	} else {
+		fclose(file);
+	}
+}
+
+bool RawVideoSink::open(const string &target, bool y4m, int fps)
+{
+	this->y4m = y4m;
+	this->fps = fps;
+	pipe = !target.empty() && target[0] == '|';
+	if(pipe) {
+#ifdef SIGPIPE
+		// An encoder that quits early shows up as a failed write instead
+		signal(SIGPIPE, SIG_IGN);
+#endif
+#ifdef _WIN32
+		file = popen(target.c_str() + 1, "wb");
+#else
+		file = popen(target.c_str() + 1, "w");
+#endif
+	} else {
+		file = fopen(target.c_str(), "wb");
+	}
+	if(!file) {
+		cerr << "Couldn't open " << target << " for the capture" << endl;
+		return false;
+	}
+	return true;
+}
+
+bool RawVideoSink::write(int frame, const unsigned char *rgb, int width, int height, int stride)
+{
+	if(this->width == 0) {
+		this->width = width;
+		this->height = height;
+		if(y4m) {
+			fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+		}
+	}
+	if(broken) {
+		return false;
+	}
+	if(width != this->width || height != this->height) {
+		cerr << "Frame " << frame << " is " << width << "x" << height << ", but the capture stream is " << this->width << "x" << this->height << endl;
+		return false;
+	}
+	if(!y4m) {
+		// Row by row from the mapped buffer, flipped to top to bottom
+		for(int y = height - 1; y >= 0; y--) {
+			if(fwrite(rgb + (size_t)y * stride, 3, width, file) != (size_t)width) {
+				cerr << "The capture stream was closed" << endl;
+				broken = true;
+				return false;
+			}
+		}
+		return true;
+	}
+	// Planes of Y, then Cb, then Cr, top to bottom, in BT.601 studio range
+	size_t pixels = (size_t)width * height;
+	scratch.resize(3 * pixels);
+	for(int y = 0; y < height; y++) {
+		const unsigned char *src = rgb + (size_t)(height - 1 - y) * stride;
+		unsigned char *Y = &scratch[(size_t)y * width];
+		unsigned char *Cb = Y + pixels;
+		unsigned char *Cr = Cb + pixels;
+		for(int x = 0; x < width; x++) {
+			int r = src[3 * x];
+			int g = src[3 * x + 1];
+			int b = src[3 * x + 2];
+			Y[x] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			Cb[x] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			Cr[x] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+	fputs("FRAME\n", file);
+	if(fwrite(&scratch[0], 1, scratch.size(), file) != scratch.size()) {
+		cerr << "The capture stream was closed" << endl;
+		broken = true;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Where FrameCapture's frames go. write() gets the pixels straight from
+ * the mapped pixel pack buffer, as packed RGB rows from bottom to top with
+ * stride bytes between them, and is called from the encoder threads.
+ * Streams get their frames one at a time and in order. Other sinks get
+ * them from several threads at once.
+ */
+class FrameSink
+{
+public:
+	virtual ~FrameSink() {}
+	virtual bool write(int frame, const unsigned char *rgb, int width, int height, int stride) = 0;
+	// Whether write() must see the frames one at a time and in order
+	virtual bool isStream() const = 0;
+	// A sink for target:
+	//   name%05d.png  one PNG per frame, numbered with printf (one %d or
+	//                 %i conversion at most; other than that, only %%)
+	//   name.png      one PNG, overwritten by each frame
+	//   name.y4m      a YUV4MPEG2 stream (4:4:4)
+	//   anything else a stream of raw RGB24 frames
+	// A target starting with '|' is a command whose stdin gets the stream,
+	// e.g. "|ffmpeg -f yuv4mpegpipe -i - out.mp4" with format=y4m.
+	// format overrides the extension for commands and named pipes.
+	static std::shared_ptr<FrameSink> open(const std::string &target, const std::string &format, int fps);
+};
+
+// Numbered PNG files, encoded in parallel. Without a number in the
+// pattern, each frame replaces the file if it is newer than the last.
+class PngSequenceSink : public FrameSink
+{
+public:
+	PngSequenceSink(const std::string &pattern, bool numbered);
+	bool write(int frame, const unsigned char *rgb, int width, int height, int stride);
+	bool isStream() const { return false; }
+
+private:
+	std::string pattern;
+	bool numbered;
+	std::mutex replaceMutex;
+	int newest; // frame in the file, if not numbered
+};
+
+// Uncompressed frames on a file or a pipe, for an external encoder. Every
+// frame must have the size of the first.
+class RawVideoSink : public FrameSink
+{
+public:
+	RawVideoSink();
+	virtual ~RawVideoSink();
+	bool open(const std::string &target, bool y4m, int fps);
+	bool write(int frame, const unsigned char *rgb, int width, int height, int stride);
+	bool isStream() const { return true; }
+
+private:
+	RawVideoSink(const RawVideoSink &);
+	RawVideoSink &operator=(const RawVideoSink &);
+
+	FILE *file;
+	bool pipe;
+	bool y4m;
+	int fps;
+	int width;  // of the first frame
+	int height;
+	bool broken; // a write failed, so the rest are dropped
+	std::vector<unsigned char> scratch; // one Y4M frame
+};
+
+#endif
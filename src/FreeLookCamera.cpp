@@ -117,3 +117,14 @@ void FreeLookCamera::applyViewMatrix(std::shared_ptr<MatrixStack> MV) const
 
 void FreeLookCamera::incPositionX(float inc) { position[0] += inc; }
 void FreeLookCamera::incPositionZ(float inc) { position[2] += inc; }
+
+void FreeLookCamera::setPose(const glm::vec3 &position, float yaw, float pitch, float fovy)
+{
+	this->position = position;
+	this->yaw = yaw;
+	this->pitch = pitch;
+	this->fovy = fovy;
+	// So that the mouse carries on from here
+	rotations.x = -yaw;
+	rotations.y = -pitch;
+}
@@ -21,6 +21,7 @@ public:
 	FreeLookCamera();
 	virtual ~FreeLookCamera();
 	void setInitDistance(float z) { translations.z = z; }
+	float getInitDistance() const { return translations.z; }
 	void setAspect(float a) { aspect = a; };
 	void setRotationFactor(float f) { rfactor = f; };
 	void setTranslationFactor(float f) { tfactor = f; };
@@ -33,11 +34,18 @@ public:
 	void applyViewMatrix(std::shared_ptr<MatrixStack> MV) const;
 	void incPositionX(float inc);
 	void incPositionZ(float inc);
+	// Angles in radians
+	void setPose(const glm::vec3 &position, float yaw, float pitch, float fovy);
 
 	glm::vec3 getPosition() { return position; }
+	// Where the view is from: the view matrix moves the world by
+	// translations after placing the camera at position
+	glm::vec3 getEye() const { return position - translations; }
 	float getYaw() { return yaw; }
 	float getPitch() { return pitch; }
 	float getFOV() { return fovy; }
+	float getNear() { return znear; }
+	float getFar() { return zfar; }
 
 private:
 	float aspect;
@@ -0,0 +1,81 @@
+#include "Frustum.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+Frustum::Frustum()
+{
+	for(int i = 0; i < NUM_PLANES; i++) {
+		planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+}
+
+Frustum::~Frustum()
+{
+}
+
+void Frustum::extract(const glm::mat4 &PV)
+{
+	// Gribb/Hartmann: each plane is the last row of P*V plus or minus one of
+	// the other rows. GLM is column major, so row i is PV[*][i].
+	glm::vec4 row[4];
+	for(int i = 0; i < 4; i++) {
+		row[i] = glm::vec4(PV[0][i], PV[1][i], PV[2][i], PV[3][i]);
+	}
+	planes[LEFT]   = row[3] + row[0];
+	planes[RIGHT]  = row[3] - row[0];
+	planes[BOTTOM] = row[3] + row[1];
+	planes[TOP]    = row[3] - row[1];
+	planes[ZNEAR]  = row[3] + row[2];
+	planes[ZFAR]   = row[3] - row[2];
+	for(int i = 0; i < NUM_PLANES; i++) {
+		float len = glm::length(glm::vec3(planes[i]));
+		planes[i] = planes[i] / len;
+	}
+}
+
+bool Frustum::testSphere(const glm::vec3 &center, float radius, float *slack) const
+{
+	float inside = FLT_MAX; // distance to the nearest plane that could cull it
+	float outside = 0.0f;   // distance by which the worst plane culls it
+	for(int i = 0; i < NUM_PLANES; i++) {
+		float dist = glm::dot(glm::vec3(planes[i]), center) + planes[i].w + radius;
+		if(dist < 0.0f) {
+			outside = max(outside, -dist);
+		} else {
+			inside = min(inside, dist);
+		}
+	}
+	if(slack) {
+		*slack = (outside > 0.0f) ? outside : inside;
+	}
+	return outside == 0.0f;
+}
+
+bool Frustum::testBox(const glm::vec3 &bmin, const glm::vec3 &bmax) const
+{
+	for(int i = 0; i < NUM_PLANES; i++) {
+		// The corner furthest along the plane's normal
+		glm::vec3 p(planes[i].x >= 0.0f ? bmax.x : bmin.x,
+		            planes[i].y >= 0.0f ? bmax.y : bmin.y,
+		            planes[i].z >= 0.0f ? bmax.z : bmin.z);
+		if(glm::dot(glm::vec3(planes[i]), p) + planes[i].w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+float Frustum::maxPlaneDrift(const Frustum &prev, float R) const
+{
+	// |(n1.p + d1) - (n0.p + d0)| <= |n1 - n0| |p| + |d1 - d0|
+	float drift = 0.0f;
+	for(int i = 0; i < NUM_PLANES; i++) {
+		glm::vec4 delta = planes[i] - prev.planes[i];
+		drift = max(drift, glm::length(glm::vec3(delta)) * R + abs(delta.w));
+	}
+	return drift;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/**
+ * The six clipping planes of a view frustum, extracted from a P*V matrix.
+ * Each plane is stored as (n, d) with |n| = 1 and n pointing inside, so that
+ * dot(n, p) + d is the signed distance of the world point p from the plane.
+ */
+class Frustum
+{
+public:
+	enum {
+		LEFT = 0,
+		RIGHT,
+		BOTTOM,
+		TOP,
+		ZNEAR,
+		ZFAR,
+		NUM_PLANES
+	};
+
+	Frustum();
+	virtual ~Frustum();
+	void extract(const glm::mat4 &PV);
+	// Returns true if the sphere touches the frustum. If slack is given, it
+	// receives how far any plane has to move before the answer can change.
+	bool testSphere(const glm::vec3 &center, float radius, float *slack = 0) const;
+	// Returns true if the axis-aligned box touches the frustum. Like the
+	// sphere test, it may keep boxes that are just outside a corner.
+	bool testBox(const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+	// Largest change of dot(n, p) + d over all planes, for any |p| <= R.
+	float maxPlaneDrift(const Frustum &prev, float R) const;
+	const glm::vec4 &getPlane(int i) const { return planes[i]; }
+
+private:
+	glm::vec4 planes[NUM_PLANES];
+};
+
+#endif
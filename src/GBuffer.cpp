@@ -0,0 +1,112 @@
+#include "GBuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "GLSL.h"
+
+using namespace std;
+
+GBuffer::GBuffer() :
+	width(0),
+	height(0),
+	fboID(0)
+{
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		texIDs[i] = 0;
+	}
+}
+
+GBuffer::~GBuffer()
+{
+	destroy();
+}
+
+bool GBuffer::isSupported()
+{
+	return GLEW_VERSION_3_0 || (GLEW_ARB_framebuffer_object && GLEW_ARB_texture_float && GLEW_ARB_texture_rg);
+}
+
+void GBuffer::setResolution(int w, int h)
+{
+	w = max(w, 1);
+	h = max(h, 1);
+	if(w == width && h == height) {
+		return;
+	}
+	width = w;
+	height = h;
+	destroy();
+	create();
+}
+
+void GBuffer::create()
+{
+	const GLint internalFormats[NUM_TARGETS] = { GL_RGBA8, GL_RGBA8, GL_RG16F, GL_RGBA8, GL_DEPTH_COMPONENT24 };
+	const GLenum formats[NUM_TARGETS] = { GL_RGBA, GL_RGBA, GL_RG, GL_RGBA, GL_DEPTH_COMPONENT };
+	const GLenum types[NUM_TARGETS] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_FLOAT, GL_UNSIGNED_BYTE, GL_UNSIGNED_INT };
+	glGenTextures(NUM_TARGETS, texIDs);
+	glGenFramebuffers(1, &fboID);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		glBindTexture(GL_TEXTURE_2D, texIDs[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], 0);
+		// Read back with texelFetch, one texel per pixel
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		GLenum attachment = (i == DEPTH) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texIDs[i], 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "G-buffer is incomplete (0x" << hex << status << dec << ")" << endl;
+	}
+	GLSL::bindDefaultFramebuffer();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void GBuffer::destroy()
+{
+	if(fboID) {
+		glDeleteFramebuffers(1, &fboID);
+		glDeleteTextures(NUM_TARGETS, texIDs);
+	}
+	fboID = 0;
+}
+
+void GBuffer::bind()
+{
+	const GLenum buffers[4] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	glDrawBuffers(4, buffers);
+	// Zero albedo and normal mean "nothing here"; the depth decides that anyway
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+void GBuffer::unbind()
+{
+	GLSL::bindDefaultFramebuffer();
+}
+
+void GBuffer::bindTextures(int firstUnit) const
+{
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, texIDs[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void GBuffer::unbindTextures(int firstUnit) const
+{
+	for(int i = 0; i < NUM_TARGETS; i++) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef G_BUFFER_H
+#define G_BUFFER_H
+
+/**
+ * Render targets for deferred shading. The geometry pass (gbuffer_frag.glsl)
+ * writes, per pixel:
+ * - 0: RGBA8, albedo (kd plus texture) and the shininess s / 255
+ * - 1: RGBA8, specular color ks
+ * - 2: RG16F, camera space normal in octahedral encoding
+ * - 3: RGBA8, the unlit part of the forward model (ka * sun color + texture)
+ * and the depth, from which deferred_frag.glsl rebuilds the position.
+ */
+class GBuffer
+{
+public:
+	enum {
+		ALBEDO = 0,
+		SPECULAR,
+		NORMAL,
+		EMISSIVE,
+		DEPTH,
+		NUM_TARGETS
+	};
+
+	GBuffer();
+	virtual ~GBuffer();
+	// Reallocates the targets only if the size changed
+	void setResolution(int width, int height);
+	// Binds and clears the targets for the geometry pass
+	void bind();
+	// Goes back to the default framebuffer
+	void unbind();
+	// Binds the targets, in the order above, to texture units starting at firstUnit
+	void bindTextures(int firstUnit) const;
+	void unbindTextures(int firstUnit) const;
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	static bool isSupported();
+
+private:
+	void create();
+	void destroy();
+
+	int width;
+	int height;
+	unsigned fboID;
+	unsigned texIDs[NUM_TARGETS];
+};
+
+#endif
@@ -14,6 +14,10 @@ using namespace std;
 
 namespace GLSL {
 
+static GLuint defaultFramebuffer = 0;
+static int numDrawCalls = 0;
+static long long numTriangles = 0;
+
 const char * errorString(GLenum err)
 {
 	switch(err) {
@@ -149,4 +153,41 @@ int textFileWrite(const char *fn, const char *s)
 	return(status);
 }
 
+void setDefaultFramebuffer(GLuint fbo)
+{
+	defaultFramebuffer = fbo;
+}
+
+void bindDefaultFramebuffer(GLenum target)
+{
+	glBindFramebuffer(target, defaultFramebuffer);
+}
+
+GLenum getDefaultColorBuffer()
+{
+	return defaultFramebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK;
+}
+
+void countDraw(GLsizei vertices, GLsizei instances)
+{
+	numDrawCalls++;
+	numTriangles += (long long)(vertices / 3) * instances;
+}
+
+void resetDrawStats()
+{
+	numDrawCalls = 0;
+	numTriangles = 0;
+}
+
+int getNumDrawCalls()
+{
+	return numDrawCalls;
+}
+
+long long getNumTriangles()
+{
+	return numTriangles;
+}
+
 }
@@ -35,6 +35,18 @@ namespace GLSL {
 	void printShaderInfoLog(GLuint shader);
 	int textFileWrite(const char *filename, const char *s);
 	char *textFileRead(const char *filename);
+	// The framebuffer that stands in for the window's. 0 unless rendering
+	// headless, where it is an FBO.
+	void setDefaultFramebuffer(GLuint fbo);
+	void bindDefaultFramebuffer(GLenum target = GL_FRAMEBUFFER);
+	// GL_BACK, or the headless FBO's color attachment
+	GLenum getDefaultColorBuffer();
+	// Counts a draw of triangles. Shape and StaticBatcher count theirs, for
+	// the totals since resetDrawStats().
+	void countDraw(GLsizei vertices, GLsizei instances = 1);
+	void resetDrawStats();
+	int getNumDrawCalls();
+	long long getNumTriangles();
 }
 
 #endif
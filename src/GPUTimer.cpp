@@ -0,0 +1,65 @@
+#include "GPUTimer.h"
+
+#include "GLSL.h"
+
+GPUTimer::GPUTimer() :
+	head(0),
+	pending(0),
+	total(0.0),
+	count(0)
+{
+	glGenQueries(NUM_QUERIES, queryIDs);
+}
+
+GPUTimer::~GPUTimer()
+{
+	glDeleteQueries(NUM_QUERIES, queryIDs);
+}
+
+bool GPUTimer::isSupported()
+{
+	return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void GPUTimer::poll(bool wait)
+{
+	while(pending > 0) {
+		unsigned id = queryIDs[(head - pending + NUM_QUERIES) % NUM_QUERIES];
+		GLint available = 0;
+		glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available && !wait) {
+			return;
+		}
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(id, GL_QUERY_RESULT, &ns);
+		total += ns * 1e-6;
+		count++;
+		pending--;
+		wait = false;
+	}
+}
+
+void GPUTimer::begin()
+{
+	poll(pending == NUM_QUERIES);
+	glBeginQuery(GL_TIME_ELAPSED, queryIDs[head]);
+}
+
+void GPUTimer::end()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	head = (head + 1) % NUM_QUERIES;
+	pending++;
+}
+
+double GPUTimer::getAverageMilliseconds()
+{
+	poll(false);
+	return count > 0 ? total / count : 0.0;
+}
+
+void GPUTimer::reset()
+{
+	total = 0.0;
+	count = 0;
+}
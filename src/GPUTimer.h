@@ -0,0 +1,37 @@
+#pragma once
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+/**
+ * Measures the GPU time spent between begin() and end() with
+ * GL_TIME_ELAPSED queries. Results arrive a few frames late, so a small ring
+ * of queries is kept in flight and finished ones are collected without
+ * waiting. Only one timer can be running at a time (the queries can't nest).
+ */
+class GPUTimer
+{
+public:
+	GPUTimer();
+	virtual ~GPUTimer();
+	void begin();
+	void end();
+	// Average of the measurements that finished since the last reset()
+	double getAverageMilliseconds();
+	int getNumSamples() const { return count; }
+	void reset();
+	static bool isSupported();
+
+private:
+	enum { NUM_QUERIES = 4 };
+
+	// Collects finished queries. If wait is true, waits for the oldest one.
+	void poll(bool wait);
+
+	unsigned queryIDs[NUM_QUERIES];
+	int head;    // next query to issue
+	int pending; // issued but not collected, ending at head
+	double total;
+	int count;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "Headless.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef FLC_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "GLSL.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+using namespace std;
+
+namespace {
+
+#ifdef FLC_EGL
+bool hasExtension(const char *extensions, const char *name)
+{
+	if(!extensions) {
+		return false;
+	}
+	size_t n = strlen(name);
+	for(const char *s = strstr(extensions, name); s; s = strstr(s + n, name)) {
+		if((s == extensions || s[-1] == ' ') && (s[n] == ' ' || s[n] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+}
+
+Headless::Headless() :
+	display(0),
+	context(0),
+	fboID(0),
+	colorID(0),
+	depthID(0),
+	width(0),
+	height(0),
+	closing(false),
+	start(chrono::steady_clock::now())
+{
+}
+
+Headless::~Headless()
+{
+	if(fboID) {
+		GLSL::setDefaultFramebuffer(0);
+		glDeleteFramebuffers(1, &fboID);
+		glDeleteRenderbuffers(1, &colorID);
+		glDeleteRenderbuffers(1, &depthID);
+	}
+#ifdef FLC_EGL
+	if(display) {
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if(context) {
+			eglDestroyContext(display, context);
+		}
+		eglTerminate(display);
+	}
+#endif
+}
+
+bool Headless::isAvailable()
+{
+#ifdef FLC_EGL
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Headless::init()
+{
+#ifdef FLC_EGL
+	// Mesa's surfaceless platform needs no display server at all. Other
+	// drivers may still give a default display that works without one.
+	const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLDisplay d = EGL_NO_DISPLAY;
+	if(getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+		d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+	}
+	if(d == EGL_NO_DISPLAY) {
+		d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(d == EGL_NO_DISPLAY || !eglInitialize(d, &major, &minor)) {
+		cerr << "Could not initialize an EGL display" << endl;
+		return false;
+	}
+	display = d;
+	if(!hasExtension(eglQueryString(d, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+		cerr << "The EGL display can't make a context current without a surface" << endl;
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		cerr << "The EGL display has no desktop OpenGL" << endl;
+		return false;
+	}
+	// Surfaces are never created, so any surface type will do
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if(!eglChooseConfig(d, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+		cerr << "No EGL config renders with desktop OpenGL" << endl;
+		return false;
+	}
+	// No version asked for, so a compatibility context like GLFW's
+	EGLContext c = eglCreateContext(d, config, EGL_NO_CONTEXT, 0);
+	if(c == EGL_NO_CONTEXT) {
+		cerr << "Could not create an EGL context" << endl;
+		return false;
+	}
+	context = c;
+	if(!eglMakeCurrent(d, EGL_NO_SURFACE, EGL_NO_SURFACE, c)) {
+		cerr << "Could not make the EGL context current" << endl;
+		return false;
+	}
+	start = chrono::steady_clock::now();
+	return true;
+#else
+	cerr << "Headless rendering needs a build with EGL" << endl;
+	return false;
+#endif
+}
+
+bool Headless::createFramebuffer(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	glGenRenderbuffers(1, &colorID);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &depthID);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	glGenFramebuffers(1, &fboID);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthID);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Headless framebuffer is incomplete (0x" << hex << status << dec << ")" << endl;
+		return false;
+	}
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glViewport(0, 0, width, height);
+	GLSL::setDefaultFramebuffer(fboID);
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void Headless::resize(int width, int height)
+{
+	if(width == this->width && height == this->height) {
+		return;
+	}
+	this->width = width;
+	this->height = height;
+	glBindRenderbuffer(GL_RENDERBUFFER, colorID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+double Headless::getTime() const
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void Headless::setTime(double t)
+{
+	start = chrono::steady_clock::now() - chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(t));
+}
+
+void Headless::swapBuffers()
+{
+	glFlush();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <chrono>
+
+/**
+ * Stands in for the GLFW window on machines without a display server. It
+ * creates a desktop GL context on an EGL display with no surface, which
+ * Mesa's surfaceless platform and render nodes provide, and renders into
+ * an FBO that GLSL::bindDefaultFramebuffer() then binds in place of the
+ * window's framebuffer.
+ *
+ * Usage:
+ *   init(); glewContextInit(); createFramebuffer(width, height);
+ *   while(!shouldClose()) { render(); swapBuffers(); }
+ */
+class Headless
+{
+public:
+	Headless();
+	virtual ~Headless();
+	// Creates the context and makes it current
+	bool init();
+	// Creates the FBO and binds it. GL must be initialized by then.
+	bool createFramebuffer(int width, int height);
+	// Reallocates the FBO's buffers at another size
+	void resize(int width, int height);
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	// Seconds since setTime(), like glfwGetTime()
+	double getTime() const;
+	void setTime(double t);
+	bool shouldClose() const { return closing; }
+	void setShouldClose(bool close) { closing = close; }
+	// Submits the frame. There is nothing to present.
+	void swapBuffers();
+	// Whether this build has EGL
+	static bool isAvailable();
+
+private:
+	Headless(const Headless &);
+	Headless &operator=(const Headless &);
+
+	void *display; // EGLDisplay
+	void *context; // EGLContext
+	GLuint fboID;
+	GLuint colorID;
+	GLuint depthID;
+	int width;
+	int height;
+	bool closing;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -10,12 +10,14 @@ private:
 
 	glm::vec3 position;
 	glm::vec3 color;
+	float range; // distance at which the light fades out (0 = unlimited)
 
 public:
 
 	Light() {
 		position = glm::vec3();
 		color = glm::vec3();
+		range = 0.0f;
 	}
 
 	void setPosition(glm::vec3 p) {
@@ -24,9 +26,13 @@ public:
 	void setColor(glm::vec3 c) {
 		color = c;
 	}
+	void setRange(float r) {
+		range = r;
+	}
 
-	glm::vec3 getPosition() { return position; }
-	glm::vec3 getColor() { return color; }
+	glm::vec3 getPosition() const { return position; }
+	glm::vec3 getColor() const { return color; }
+	float getRange() const { return range; }
 
 	void translatePosition_X(float t) {
 		position[0] += t;
@@ -0,0 +1,240 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+#include "GLSL.h"
+#include "Program.h"
+#include "Light.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+LightClusters::LightClusters() :
+	nx(16),
+	ny(8),
+	nz(24),
+	zNear(0.1f),
+	zFar(100.0f),
+	maxPerCluster(0),
+	transformTime(0.0),
+	binTime(0.0),
+	uploadTime(0.0),
+	frames(0)
+{
+	bufIDs[0] = bufIDs[1] = bufIDs[2] = 0;
+	texIDs[0] = texIDs[1] = texIDs[2] = 0;
+	pool = make_shared<ThreadPool>(1);
+}
+
+LightClusters::~LightClusters()
+{
+	if(bufIDs[0]) {
+		glDeleteTextures(3, texIDs);
+		glDeleteBuffers(3, bufIDs);
+	}
+}
+
+bool LightClusters::isSupported()
+{
+	return GLEW_VERSION_3_1 || GLEW_ARB_texture_buffer_object;
+}
+
+void LightClusters::setGrid(int x, int y, int z)
+{
+	nx = max(x, 1);
+	ny = max(y, 1);
+	nz = max(z, 1);
+}
+
+void LightClusters::setDepthRange(float n, float f)
+{
+	zNear = n;
+	zFar = max(f, n * 1.001f);
+}
+
+void LightClusters::setNumThreads(int n)
+{
+	pool = make_shared<ThreadPool>(max(n, 1));
+}
+
+void LightClusters::createBuffers()
+{
+	// Offsets and indices are integers, the light data is float
+	const GLenum formats[3] = { GL_RGBA32F, GL_R32I, GL_R32I };
+	glGenBuffers(3, bufIDs);
+	glGenTextures(3, texIDs);
+	for(int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, bufIDs[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, 0, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, texIDs[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], bufIDs[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void LightClusters::binSlice(int k, const glm::mat4 &P)
+{
+	Slice &s = slices[k];
+	s.rects.clear();
+	s.lights.clear();
+	float ratio = zFar / zNear;
+	float z0 = zNear * pow(ratio, (float)k / nz);
+	float z1 = (k == nz - 1) ? FLT_MAX : zNear * pow(ratio, (float)(k + 1) / nz);
+	for(int i = 0; i < (int)viewLights.size(); i++) {
+		const glm::vec4 &L = viewLights[i];
+		float d = -L.z;
+		float r = L.w;
+		if(d + r < z0 || d - r > z1) {
+			continue;
+		}
+		// The part of the light's bounding box inside this slice spans the
+		// depths [a, b], all positive, so x/depth is extreme at its corners
+		float a = max(d - r, z0);
+		float b = min(d + r, z1);
+		float xlo = P[0][0] * min((L.x - r) / a, (L.x - r) / b);
+		float xhi = P[0][0] * max((L.x + r) / a, (L.x + r) / b);
+		float ylo = P[1][1] * min((L.y - r) / a, (L.y - r) / b);
+		float yhi = P[1][1] * max((L.y + r) / a, (L.y + r) / b);
+		if(xhi < -1.0f || xlo > 1.0f || yhi < -1.0f || ylo > 1.0f) {
+			continue;
+		}
+		glm::ivec4 rect;
+		rect.x = max(0, (int)floor((0.5f * xlo + 0.5f) * nx));
+		rect.y = min(nx - 1, (int)floor((0.5f * xhi + 0.5f) * nx));
+		rect.z = max(0, (int)floor((0.5f * ylo + 0.5f) * ny));
+		rect.w = min(ny - 1, (int)floor((0.5f * yhi + 0.5f) * ny));
+		s.rects.push_back(rect);
+		s.lights.push_back(i);
+	}
+
+	// Count, prefix sum, then fill
+	s.offsets.assign(nx * ny + 1, 0);
+	for(size_t j = 0; j < s.rects.size(); j++) {
+		const glm::ivec4 &rect = s.rects[j];
+		for(int y = rect.z; y <= rect.w; y++) {
+			for(int x = rect.x; x <= rect.y; x++) {
+				s.offsets[y * nx + x + 1]++;
+			}
+		}
+	}
+	for(int c = 0; c < nx * ny; c++) {
+		s.offsets[c + 1] += s.offsets[c];
+	}
+	s.indices.resize(s.offsets[nx * ny]);
+	vector<int> cursor(s.offsets.begin(), s.offsets.end() - 1);
+	for(size_t j = 0; j < s.rects.size(); j++) {
+		const glm::ivec4 &rect = s.rects[j];
+		for(int y = rect.z; y <= rect.w; y++) {
+			for(int x = rect.x; x <= rect.y; x++) {
+				s.indices[cursor[y * nx + x]++] = s.lights[j];
+			}
+		}
+	}
+}
+
+void LightClusters::update(const vector<Light> &lights, const glm::mat4 &P, const glm::mat4 &V)
+{
+	if(!bufIDs[0]) {
+		createBuffers();
+	}
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+
+	viewLights.clear();
+	lightData.clear();
+	for(size_t i = 0; i < lights.size(); i++) {
+		if(lights[i].getRange() <= 0.0f) {
+			continue;
+		}
+		glm::vec4 p = V * glm::vec4(lights[i].getPosition(), 1.0f);
+		glm::vec3 c = lights[i].getColor();
+		viewLights.push_back(glm::vec4(glm::vec3(p), lights[i].getRange()));
+		float texels[8] = { p.x, p.y, p.z, lights[i].getRange(), c.r, c.g, c.b, 0.0f };
+		lightData.insert(lightData.end(), texels, texels + 8);
+	}
+	chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+	slices.resize(nz);
+	pool->parallelFor(nz, [&](int k) { binSlice(k, P); });
+	int tiles = nx * ny;
+	offsets.resize(tiles * nz + 1);
+	indices.clear();
+	maxPerCluster = 0;
+	for(int k = 0; k < nz; k++) {
+		const Slice &s = slices[k];
+		int base = (int)indices.size();
+		for(int c = 0; c < tiles; c++) {
+			offsets[k * tiles + c] = base + s.offsets[c];
+			maxPerCluster = max(maxPerCluster, s.offsets[c + 1] - s.offsets[c]);
+		}
+		indices.insert(indices.end(), s.indices.begin(), s.indices.end());
+	}
+	offsets[tiles * nz] = (int)indices.size();
+	chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+	// Orphan and refill. Empty lists still get a texel so the buffers stay valid.
+	const void *data[3] = { lightData.empty() ? 0 : &lightData[0], &offsets[0], indices.empty() ? 0 : &indices[0] };
+	size_t sizes[3] = { lightData.size() * sizeof(float), offsets.size() * sizeof(int), indices.size() * sizeof(int) };
+	for(int i = 0; i < 3; i++) {
+		glBindBuffer(GL_TEXTURE_BUFFER, bufIDs[i]);
+		glBufferData(GL_TEXTURE_BUFFER, max(sizes[i], (size_t)16), 0, GL_STREAM_DRAW);
+		if(sizes[i] > 0) {
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+	transformTime += chrono::duration<double>(t1 - t0).count();
+	binTime += chrono::duration<double>(t2 - t1).count();
+	uploadTime += chrono::duration<double>(t3 - t2).count();
+	frames++;
+}
+
+void LightClusters::bind(const shared_ptr<Program> prog, int firstUnit, const glm::vec2 &viewport) const
+{
+	for(int i = 0; i < 3; i++) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, texIDs[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(prog->getUniform("lightData"), firstUnit);
+	glUniform1i(prog->getUniform("clusterOffsets"), firstUnit + 1);
+	glUniform1i(prog->getUniform("clusterLights"), firstUnit + 2);
+	glUniform3i(prog->getUniform("clusterGrid"), nx, ny, nz);
+	glUniform2f(prog->getUniform("viewport"), viewport.x, viewport.y);
+	// slice = log(depth) * scale + bias
+	float scale = nz / log(zFar / zNear);
+	glUniform2f(prog->getUniform("clusterDepth"), scale, -log(zNear) * scale);
+}
+
+void LightClusters::unbind(int firstUnit) const
+{
+	for(int i = 0; i < 3; i++) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::printStats()
+{
+	if(frames == 0) {
+		return;
+	}
+	double ms = 1000.0 / frames;
+	cout << "Clustered lighting: " << getNumLights() << " lights, "
+		<< nx << "x" << ny << "x" << nz << " clusters, "
+		<< (double)indices.size() / getNumClusters() << " avg / " << maxPerCluster << " max lights per cluster, "
+		<< "transform " << transformTime * ms << " ms, "
+		<< "bin " << binTime * ms << " ms (" << pool->getNumThreads() << " threads), "
+		<< "upload " << uploadTime * ms << " ms" << endl;
+	transformTime = binTime = uploadTime = 0.0;
+	frames = 0;
+}
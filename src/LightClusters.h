@@ -0,0 +1,88 @@
+#pragma once
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <vector>
+#include <memory>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Light;
+class Program;
+class ThreadPool;
+
+/**
+ * Clustered forward shading. The view frustum is cut into a grid of
+ * froxels: nx by ny screen tiles times nz depth slices spaced exponentially
+ * between the near and far distances. Every frame, the lights with a finite
+ * range are binned into the froxels their spheres touch, one depth slice per
+ * task on a ThreadPool. The result is uploaded as three texture buffers:
+ * - lightData: two RGBA32F texels per light, (view space position, range)
+ *   and (color, 0)
+ * - clusterOffsets: R32I, where the lights of cluster c are the entries
+ *   [offsets[c], offsets[c+1]) of clusterLights
+ * - clusterLights: R32I indices into lightData
+ * clustered_frag.glsl finds its froxel from gl_FragCoord and the view depth
+ * and only loops over the lights listed there.
+ */
+class LightClusters
+{
+public:
+	LightClusters();
+	virtual ~LightClusters();
+	void setGrid(int nx, int ny, int nz);
+	// Distances covered by the depth slices. Fragments and lights beyond far
+	// go into the last slice.
+	void setDepthRange(float zNear, float zFar);
+	void setNumThreads(int n);
+	// Bins every light with a positive range for the view (P, V) and uploads
+	// the lists. Lights with an unlimited range are skipped.
+	void update(const std::vector<Light> &lights, const glm::mat4 &P, const glm::mat4 &V);
+	// Binds the buffers to texture units firstUnit..firstUnit+2 and sets the
+	// uniforms of prog, which must be bound. viewport is the size in pixels.
+	void bind(const std::shared_ptr<Program> prog, int firstUnit, const glm::vec2 &viewport) const;
+	void unbind(int firstUnit) const;
+	int getNumLights() const { return (int)lightData.size() / 8; }
+	int getNumClusters() const { return nx * ny * nz; }
+	int getNumIndices() const { return (int)indices.size(); }
+	int getMaxLightsPerCluster() const { return maxPerCluster; }
+	// Prints the per-stage times averaged since the last call
+	void printStats();
+	static bool isSupported();
+
+private:
+	// Lights that touch one depth slice, as a list per tile of that slice
+	struct Slice
+	{
+		std::vector<glm::ivec4> rects; // tile range [x0, x1] x [y0, y1]
+		std::vector<int> lights;       // light of each rect
+		std::vector<int> offsets;      // per tile, like clusterOffsets
+		std::vector<int> indices;
+	};
+
+	void binSlice(int k, const glm::mat4 &P);
+	void createBuffers();
+
+	int nx;
+	int ny;
+	int nz;
+	float zNear;
+	float zFar;
+	std::shared_ptr<ThreadPool> pool;
+	std::vector<glm::vec4> viewLights; // view space position and range
+	std::vector<float> lightData;
+	std::vector<Slice> slices;
+	std::vector<int> offsets;
+	std::vector<int> indices;
+	int maxPerCluster;
+	unsigned bufIDs[3];
+	unsigned texIDs[3];
+	// Accumulated stage times in seconds
+	double transformTime;
+	double binTime;
+	double uploadTime;
+	int frames;
+};
+
+#endif
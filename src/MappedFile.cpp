@@ -0,0 +1,142 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+
+using namespace std;
+
+MappedFile::MappedFile() :
+	data(0),
+	size(0),
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE),
+	mapping(0)
+#else
+	fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+string MappedFile::tempName(const string &filename)
+{
+#ifdef _WIN32
+	return filename + ".tmp." + to_string(_getpid());
+#else
+	return filename + ".tmp." + to_string(getpid());
+#endif
+}
+
+bool MappedFile::replace(const string &temp, const string &filename)
+{
+	// Readers that still map the old file keep its contents; new readers
+	// never see a partly written one.
+#ifdef _WIN32
+	bool ok = MoveFileExA(temp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool ok = rename(temp.c_str(), filename.c_str()) == 0;
+#endif
+	if(!ok) {
+		remove(temp.c_str());
+	}
+	return ok;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const string &filename)
+{
+	close();
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER len;
+	if(!GetFileSizeEx(file, &len) || len.QuadPart == 0) {
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping) {
+		close();
+		return false;
+	}
+	data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!data) {
+		close();
+		return false;
+	}
+	size = (size_t)len.QuadPart;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(data) {
+		UnmapViewOfFile(data);
+	}
+	if(mapping) {
+		CloseHandle(mapping);
+	}
+	if(file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+	data = 0;
+	size = 0;
+	mapping = 0;
+	file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::open(const string &filename)
+{
+	close();
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		close();
+		return false;
+	}
+	void *p = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) {
+		close();
+		return false;
+	}
+	data = (const unsigned char *)p;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(data) {
+		munmap((void *)data, size);
+	}
+	if(fd >= 0) {
+		::close(fd);
+	}
+	data = 0;
+	size = 0;
+	fd = -1;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+/**
+ * A read-only memory mapping of a whole file. The mapping is released when
+ * the object is destroyed or another file is opened.
+ *
+ * Other processes may have a file mapped while it is rewritten, so writers
+ * go through tempName() and replace() instead of truncating it in place.
+ */
+class MappedFile
+{
+public:
+	MappedFile();
+	virtual ~MappedFile();
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const { return data != 0; }
+	const unsigned char *getData() const { return data; }
+	size_t getSize() const { return size; }
+
+	// A per-process temporary name next to filename
+	static std::string tempName(const std::string &filename);
+	// Renames the finished temporary file over filename, or removes it
+	static bool replace(const std::string &temp, const std::string &filename);
+
+private:
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	const unsigned char *data;
+	size_t size;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#else
+	int fd;
+#endif
+};
+
+#endif
@@ -12,6 +12,7 @@ private:
 	glm::vec3 diffuse;
 	glm::vec3 specular;
 	float shiny;
+	int texture; // TextureRegistry handle, -1 for none
 
 
 public:
@@ -21,6 +22,7 @@ public:
 		diffuse = glm::vec3();
 		specular = glm::vec3();
 		shiny = 0.0;
+		texture = -1;
 	}
 
 	void setAmbient(glm::vec3 amb) {
@@ -35,11 +37,15 @@ public:
 	void setShiny(float s) {
 		shiny = s;
 	}
+	void setTexture(int t) {
+		texture = t;
+	}
 
 	glm::vec3 getAmbient() { return ambient; }
 	glm::vec3 getDiffuse() { return diffuse; }
 	glm::vec3 getSpecular() { return specular; }
 	float getShiny() { return shiny; }
+	int getTexture() { return texture; }
 };
 
 
@@ -0,0 +1,142 @@
+#include "Minimap.h"
+
+#include <iostream>
+
+#include "GLSL.h"
+
+using namespace std;
+
+Minimap::Minimap() :
+	width(0),
+	height(0),
+	interval(0.0),
+	lastUpdate(0.0),
+	staticValid(false),
+	dynamicValid(false)
+{
+	staticLayer.fboID = finalLayer.fboID = 0;
+	staticLayer.colorTexID = finalLayer.colorTexID = 0;
+	staticLayer.depthRBID = finalLayer.depthRBID = 0;
+}
+
+Minimap::~Minimap()
+{
+	destroy(staticLayer);
+	destroy(finalLayer);
+}
+
+bool Minimap::isSupported()
+{
+	return GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+}
+
+void Minimap::setResolution(int w, int h)
+{
+	w = max(w, 1);
+	h = max(h, 1);
+	if(w == width && h == height) {
+		return;
+	}
+	width = w;
+	height = h;
+	destroy(staticLayer);
+	destroy(finalLayer);
+	create(staticLayer);
+	create(finalLayer);
+	invalidate();
+}
+
+void Minimap::invalidate()
+{
+	staticValid = false;
+	dynamicValid = false;
+}
+
+bool Minimap::needsUpdate(double t) const
+{
+	return !dynamicValid || !staticValid || t - lastUpdate >= interval || t < lastUpdate;
+}
+
+void Minimap::create(Target &target)
+{
+	glGenTextures(1, &target.colorTexID);
+	glBindTexture(GL_TEXTURE_2D, target.colorTexID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &target.depthRBID);
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depthRBID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &target.fboID);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fboID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colorTexID, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depthRBID);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Minimap framebuffer is incomplete (0x" << hex << status << dec << ")" << endl;
+	}
+	GLSL::bindDefaultFramebuffer();
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void Minimap::destroy(Target &target)
+{
+	if(target.fboID) {
+		glDeleteFramebuffers(1, &target.fboID);
+		glDeleteTextures(1, &target.colorTexID);
+		glDeleteRenderbuffers(1, &target.depthRBID);
+	}
+	target.fboID = target.colorTexID = target.depthRBID = 0;
+}
+
+void Minimap::bind(const Target &target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fboID);
+	glViewport(0, 0, width, height);
+}
+
+bool Minimap::beginStatic()
+{
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if(staticValid) {
+		return false;
+	}
+	bind(staticLayer);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	staticValid = true;
+	return true;
+}
+
+void Minimap::beginDynamic(double t)
+{
+	lastUpdate = t;
+	// Depth is copied too so that the objects are occluded by the ground
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, staticLayer.fboID);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, finalLayer.fboID);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	bind(finalLayer);
+}
+
+void Minimap::end()
+{
+	GLSL::bindDefaultFramebuffer();
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	GLSL::checkError(GET_FILE_LINE);
+	dynamicValid = true;
+}
+
+void Minimap::composite(int x, int y, int w, int h) const
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, finalLayer.fboID);
+	GLSL::bindDefaultFramebuffer(GL_DRAW_FRAMEBUFFER);
+	GLenum filter = (w == width && h == height) ? GL_NEAREST : GL_LINEAR;
+	glBlitFramebuffer(0, 0, width, height, x, y, x + w, y + h, GL_COLOR_BUFFER_BIT, filter);
+	GLSL::bindDefaultFramebuffer();
+	GLSL::checkError(GET_FILE_LINE);
+}
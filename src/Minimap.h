@@ -0,0 +1,70 @@
+#pragma once
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+/**
+ * Offscreen cache for the top-down view. The scene is kept in two layers:
+ * a static layer (sun, ground, static batches) that is only redrawn when it
+ * is invalidated, and a final layer that starts from a copy of the static
+ * layer and adds the moving objects at most once per update interval. Each
+ * frame the final layer is blitted into the viewport, so the top-down view
+ * costs a copy instead of a second pass over the scene.
+ *
+ * Usage per frame:
+ *   if(needsUpdate(t)) {
+ *       if(beginStatic()) { draw static content }
+ *       beginDynamic(t); draw moving content; end();
+ *   }
+ *   composite(x, y, w, h);
+ */
+class Minimap
+{
+public:
+	Minimap();
+	virtual ~Minimap();
+	// Reallocates the targets only if the size changed
+	void setResolution(int width, int height);
+	// Seconds between refreshes of the moving objects (0 = every frame)
+	void setUpdateInterval(double seconds) { interval = seconds; }
+	double getUpdateInterval() const { return interval; }
+	// Forces both layers to be redrawn on the next update
+	void invalidate();
+	bool needsUpdate(double t) const;
+	// Binds the static layer and returns true if it has to be redrawn.
+	// When it returns false the caller should skip its static draws.
+	bool beginStatic();
+	// Copies the static layer into the final layer and binds the latter.
+	// t is recorded as the time of this update.
+	void beginDynamic(double t);
+	// Restores the default framebuffer and viewport
+	void end();
+	// Copies the final layer into the given rectangle of the default framebuffer
+	void composite(int x, int y, int width, int height) const;
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	static bool isSupported();
+
+private:
+	struct Target
+	{
+		unsigned fboID;
+		unsigned colorTexID;
+		unsigned depthRBID;
+	};
+
+	void create(Target &target);
+	void destroy(Target &target);
+	void bind(const Target &target);
+
+	int width;
+	int height;
+	double interval;
+	double lastUpdate;
+	bool staticValid;
+	bool dynamicValid;
+	int viewport[4];
+	Target staticLayer;
+	Target finalLayer;
+};
+
+#endif
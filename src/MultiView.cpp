@@ -0,0 +1,76 @@
+#include "MultiView.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "GLSL.h"
+#include "Program.h"
+
+using namespace std;
+
+MultiView::MultiView()
+{
+}
+
+MultiView::~MultiView()
+{
+}
+
+bool MultiView::isSupported()
+{
+	// Geometry shaders are core in 3.2
+	return GLEW_VERSION_4_1 || (GLEW_VERSION_3_2 && GLEW_ARB_viewport_array);
+}
+
+int MultiView::addView(const glm::mat4 &P, const glm::mat4 &V, int x, int y, int width, int height, float zNear, float zFar)
+{
+	if((int)views.size() >= MAX_VIEWS) {
+		return -1;
+	}
+	View v;
+	v.P = P;
+	v.V = V;
+	v.viewport[0] = x;
+	v.viewport[1] = y;
+	v.viewport[2] = width;
+	v.viewport[3] = height;
+	v.depthRange[0] = zNear;
+	v.depthRange[1] = zFar;
+	views.push_back(v);
+	return (int)views.size() - 1;
+}
+
+vector<glm::mat4> MultiView::getViewProjections() const
+{
+	vector<glm::mat4> PV;
+	for(size_t i = 0; i < views.size(); i++) {
+		PV.push_back(views[i].P * views[i].V);
+	}
+	return PV;
+}
+
+void MultiView::apply(const shared_ptr<Program> prog) const
+{
+	glm::mat4 PV[MAX_VIEWS];
+	glm::vec3 eye[MAX_VIEWS];
+	for(size_t i = 0; i < views.size(); i++) {
+		const View &v = views[i];
+		glViewportIndexedf((GLuint)i, (float)v.viewport[0], (float)v.viewport[1], (float)v.viewport[2], (float)v.viewport[3]);
+		glDepthRangeIndexed((GLuint)i, v.depthRange[0], v.depthRange[1]);
+		PV[i] = v.P * v.V;
+		eye[i] = glm::vec3(glm::inverse(v.V)[3]);
+	}
+	GLsizei n = (GLsizei)views.size();
+	glUniform1i(prog->getUniform("numViews"), n);
+	if(n > 0) {
+		glUniformMatrix4fv(prog->getUniform("PV"), n, GL_FALSE, glm::value_ptr(PV[0]));
+		glUniform3fv(prog->getUniform("eye"), n, glm::value_ptr(eye[0]));
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void MultiView::restore(int width, int height)
+{
+	// These reset every viewport index at once
+	glViewport(0, 0, width, height);
+	glDepthRange(0.0, 1.0);
+}
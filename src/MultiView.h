@@ -0,0 +1,58 @@
+#pragma once
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include <vector>
+#include <memory>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Program;
+
+/**
+ * A set of cameras that are rendered in a single submission. Each view has
+ * its own projection and view matrices, viewport rectangle and depth range.
+ * multiview_geom.glsl replicates every triangle once per view and routes it
+ * with gl_ViewportIndex, so the objects are traversed and drawn once no
+ * matter how many views there are (the main and top-down cameras, or N
+ * split-screen cameras).
+ *
+ * Views whose rectangles overlap share the depth buffer, so they should be
+ * given disjoint depth ranges, with the view on top getting the nearer one.
+ */
+class MultiView
+{
+public:
+	// Must match multiview_geom.glsl
+	enum { MAX_VIEWS = 4 };
+
+	struct View
+	{
+		glm::mat4 P;
+		glm::mat4 V;
+		int viewport[4];
+		float depthRange[2];
+	};
+
+	MultiView();
+	virtual ~MultiView();
+	void clear() { views.clear(); }
+	// Returns the index of the view (its gl_ViewportIndex), or -1 if full
+	int addView(const glm::mat4 &P, const glm::mat4 &V, int x, int y, int width, int height, float zNear = 0.0f, float zFar = 1.0f);
+	int getNumViews() const { return (int)views.size(); }
+	const View &getView(int i) const { return views[i]; }
+	// Projection * view of every view, e.g. for Culler::update()
+	std::vector<glm::mat4> getViewProjections() const;
+	// Sets the viewports, depth ranges and the per-view uniforms of prog.
+	// prog must be bound.
+	void apply(const std::shared_ptr<Program> prog) const;
+	// Goes back to a single viewport covering the window and the full depth range
+	static void restore(int width, int height);
+	static bool isSupported();
+
+private:
+	std::vector<View> views;
+};
+
+#endif
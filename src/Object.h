@@ -19,6 +19,7 @@ private:
 	glm::vec3 scale;
 	glm::vec3 rotation;
 	glm::vec3 color;
+	bool isStatic;
 
 public:
 
@@ -28,6 +29,7 @@ public:
 		scale = glm::vec3(1, 1, 1);
 		rotation = glm::vec3(0, 0, 0);
 		color = glm::vec3((float)(rand()) / (float)(RAND_MAX), (float)(rand()) / (float)(RAND_MAX), (float)(rand()) / (float)(RAND_MAX));
+		isStatic = false;
 	}
 
 	void setShape(std::shared_ptr<Shape> s) {shape = s;}
@@ -44,6 +46,10 @@ public:
 
 	glm::vec3 getColor() { return color; }
 
+	// Static objects never move or animate, so they can be batched
+	void setStatic(bool s) { isStatic = s; }
+	bool getStatic() { return isStatic; }
+
 
 };
 
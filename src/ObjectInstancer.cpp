@@ -0,0 +1,119 @@
+#include "ObjectInstancer.h"
+
+#include <map>
+
+#include "GLSL.h"
+#include "Program.h"
+#include "Shape.h"
+#include "Object.h"
+
+using namespace std;
+
+namespace {
+
+// Interleaved per-instance layout: translation, scale, kd, pulse
+const int INSTANCE_FLOATS = 11;
+
+}
+
+ObjectInstancer::ObjectInstancer() :
+	amplitude(0.0f),
+	frequency(0.0f),
+	dirty(true)
+{
+}
+
+ObjectInstancer::~ObjectInstancer()
+{
+	clear();
+}
+
+bool ObjectInstancer::isSupported()
+{
+	return GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+}
+
+void ObjectInstancer::setPulse(float a, float f)
+{
+	amplitude = a;
+	frequency = f;
+	dirty = true;
+}
+
+void ObjectInstancer::clear()
+{
+	for(size_t i = 0; i < groups.size(); i++) {
+		glDeleteBuffers(1, &groups[i].bufID);
+	}
+	groups.clear();
+}
+
+bool ObjectInstancer::update(const vector<Object*> &objects)
+{
+	vector<int> dynamic;
+	for(int i = 0; i < (int)objects.size(); i++) {
+		if(!objects[i]->getStatic()) {
+			dynamic.push_back(i);
+		}
+	}
+	if(!dirty && dynamic == members) {
+		return false;
+	}
+	members = dynamic;
+	dirty = false;
+	clear();
+
+	map< shared_ptr<Shape>, vector<float> > data;
+	for(size_t k = 0; k < members.size(); k++) {
+		Object *obj = objects[members[k]];
+		vector<float> &buf = data[obj->getShape()];
+		glm::vec3 T = obj->getTranslation();
+		glm::vec3 S = obj->getScale();
+		glm::vec3 kd = obj->getColor();
+		float inst[INSTANCE_FLOATS] = { T.x, T.y, T.z, S.x, S.y, S.z, kd.r, kd.g, kd.b, amplitude, frequency };
+		buf.insert(buf.end(), inst, inst + INSTANCE_FLOATS);
+	}
+	for(map< shared_ptr<Shape>, vector<float> >::iterator it = data.begin(); it != data.end(); ++it) {
+		Group g;
+		g.shape = it->first;
+		g.count = (int)it->second.size() / INSTANCE_FLOATS;
+		glGenBuffers(1, &g.bufID);
+		glBindBuffer(GL_ARRAY_BUFFER, g.bufID);
+		glBufferData(GL_ARRAY_BUFFER, it->second.size()*sizeof(float), &it->second[0], GL_STATIC_DRAW);
+		groups.push_back(g);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void ObjectInstancer::draw(const shared_ptr<Program> prog) const
+{
+	const char *names[4] = { "aInstPos", "aInstScale", "aInstKd", "aInstPulse" };
+	const int sizes[4] = { 3, 3, 3, 2 };
+	GLsizei stride = INSTANCE_FLOATS * sizeof(float);
+	for(size_t i = 0; i < groups.size(); i++) {
+		glBindBuffer(GL_ARRAY_BUFFER, groups[i].bufID);
+		int offset = 0;
+		for(int a = 0; a < 4; a++) {
+			int h = prog->getAttribute(names[a]);
+			if(h != -1) {
+				glEnableVertexAttribArray(h);
+				glVertexAttribPointer(h, sizes[a], GL_FLOAT, GL_FALSE, stride, (const void *)(offset * sizeof(float)));
+				glVertexAttribDivisor(h, 1);
+			}
+			offset += sizes[a];
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		groups[i].shape->draw(prog, groups[i].count);
+	}
+	// Leave the attribute slots the way the other draws expect them
+	for(int a = 0; a < 4; a++) {
+		int h = prog->getAttribute(names[a]);
+		if(h != -1) {
+			glVertexAttribDivisor(h, 0);
+			glDisableVertexAttribArray(h);
+		}
+	}
+	GLSL::checkError(GET_FILE_LINE);
+}
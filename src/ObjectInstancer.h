@@ -0,0 +1,50 @@
+#pragma once
+#ifndef OBJECT_INSTANCER_H
+#define OBJECT_INSTANCER_H
+
+#include <vector>
+#include <memory>
+
+class Object;
+class Program;
+class Shape;
+
+/**
+ * Keeps the placement of the dynamic (non-static) Objects resident on the
+ * GPU as per-instance vertex attributes, one buffer per Shape, so that all
+ * objects sharing a mesh are drawn with a single instanced call. The pulse
+ * animation is evaluated in vert.glsl from the time uniform t and the
+ * per-instance pulse parameters, so nothing is uploaded per object in the
+ * steady state. The buffers are only rebuilt when the set of objects changes.
+ */
+class ObjectInstancer
+{
+public:
+	ObjectInstancer();
+	virtual ~ObjectInstancer();
+	// Same meaning as the CPU path: scale = 1 + a/2 + a/2 sin(2 pi f t)
+	void setPulse(float amplitude, float frequency);
+	// Returns true if the instance buffers were rebuilt
+	bool update(const std::vector<Object*> &objects);
+	// The program must have instanced = true and MV = the view matrix
+	void draw(const std::shared_ptr<Program> prog) const;
+	static bool isSupported();
+
+private:
+	struct Group
+	{
+		std::shared_ptr<Shape> shape;
+		unsigned bufID;
+		int count;
+	};
+
+	void clear();
+
+	float amplitude;
+	float frequency;
+	bool dirty;
+	std::vector<int> members;
+	std::vector<Group> groups;
+};
+
+#endif
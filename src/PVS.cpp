@@ -0,0 +1,567 @@
+#include "PVS.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include "Object.h"
+
+using namespace std;
+
+namespace {
+
+struct PVSHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t cellsX;
+	uint32_t cellsZ;
+	uint32_t numObjects;
+	uint32_t bytesPerCell;
+	float minX;
+	float minZ;
+	float cellSize;
+	float eyeLo;
+	float eyeHi;
+	uint32_t pad;
+	uint64_t layoutHash;
+};
+
+const char PVS_MAGIC[4] = { 'P', 'V', 'S', '1' };
+const uint32_t PVS_VERSION = 1;
+
+// Ray/box slab test over the segment t in [0, tmax]
+bool segmentHitsBox(const glm::vec3 &o, const glm::vec3 &invDir, float tmax, const glm::vec3 &bmin, const glm::vec3 &bmax)
+{
+	float t0 = 0.0f;
+	float t1 = tmax;
+	for(int a = 0; a < 3; a++) {
+		float tn = (bmin[a] - o[a]) * invDir[a];
+		float tf = (bmax[a] - o[a]) * invDir[a];
+		if(tn > tf) {
+			swap(tn, tf);
+		}
+		t0 = max(t0, tn);
+		t1 = min(t1, tf);
+		if(t0 > t1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * A bounding volume hierarchy over the triangles of one Shape, used to
+ * answer "is anything hit before t" queries in object space.
+ */
+class MeshBVH
+{
+public:
+	void build(const vector<float> &posBuf)
+	{
+		int ntris = (int)posBuf.size() / 9;
+		tris.resize(ntris);
+		for(int i = 0; i < ntris; i++) {
+			for(int v = 0; v < 3; v++) {
+				tris[i].v[v] = glm::vec3(posBuf[9*i + 3*v + 0], posBuf[9*i + 3*v + 1], posBuf[9*i + 3*v + 2]);
+			}
+		}
+		nodes.clear();
+		if(ntris > 0) {
+			nodes.resize(1);
+			buildNode(0, 0, ntris);
+		}
+	}
+
+	bool anyHit(const glm::vec3 &o, const glm::vec3 &d, float tmax) const
+	{
+		if(nodes.empty()) {
+			return false;
+		}
+		glm::vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0) {
+			const Node &n = nodes[stack[--top]];
+			if(!segmentHitsBox(o, invDir, tmax, n.bmin, n.bmax)) {
+				continue;
+			}
+			if(n.count > 0) {
+				for(int i = n.first; i < n.first + n.count; i++) {
+					if(hitTriangle(tris[i], o, d, tmax)) {
+						return true;
+					}
+				}
+			} else {
+				// Nearer child first
+				bool flip = invDir[n.axis] < 0.0f;
+				stack[top++] = n.first + (flip ? 0 : 1);
+				stack[top++] = n.first + (flip ? 1 : 0);
+			}
+		}
+		return false;
+	}
+
+private:
+	struct Tri
+	{
+		glm::vec3 v[3];
+	};
+	struct Node
+	{
+		glm::vec3 bmin;
+		glm::vec3 bmax;
+		int first; // first triangle for leaves, left child otherwise
+		int count; // 0 for inner nodes
+		int axis;  // of the split; the left child is on its low side
+	};
+
+	void buildNode(int index, int first, int count)
+	{
+		glm::vec3 bmin(FLT_MAX, FLT_MAX, FLT_MAX);
+		glm::vec3 bmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i = first; i < first + count; i++) {
+			for(int v = 0; v < 3; v++) {
+				bmin = glm::min(bmin, tris[i].v[v]);
+				bmax = glm::max(bmax, tris[i].v[v]);
+			}
+		}
+		nodes[index].bmin = bmin;
+		nodes[index].bmax = bmax;
+		if(count <= 8) {
+			nodes[index].first = first;
+			nodes[index].count = count;
+			return;
+		}
+		// Median split along the longest axis
+		glm::vec3 ext = bmax - bmin;
+		int axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : (ext.y > ext.z ? 1 : 2);
+		int mid = first + count / 2;
+		nth_element(tris.begin() + first, tris.begin() + mid, tris.begin() + first + count,
+			[axis](const Tri &a, const Tri &b) {
+				return a.v[0][axis] + a.v[1][axis] + a.v[2][axis] < b.v[0][axis] + b.v[1][axis] + b.v[2][axis];
+			});
+		// Children are allocated next to each other
+		int left = (int)nodes.size();
+		nodes.resize(left + 2);
+		nodes[index].first = left;
+		nodes[index].count = 0;
+		nodes[index].axis = axis;
+		buildNode(left, first, mid - first);
+		buildNode(left + 1, mid, first + count - mid);
+	}
+
+	static bool hitTriangle(const Tri &tri, const glm::vec3 &o, const glm::vec3 &d, float tmax)
+	{
+		// Moller-Trumbore
+		const float eps = 1e-7f;
+		glm::vec3 e1 = tri.v[1] - tri.v[0];
+		glm::vec3 e2 = tri.v[2] - tri.v[0];
+		glm::vec3 p = glm::cross(d, e2);
+		float det = glm::dot(e1, p);
+		if(fabs(det) < eps) {
+			return false;
+		}
+		float inv = 1.0f / det;
+		glm::vec3 s = o - tri.v[0];
+		float u = glm::dot(s, p) * inv;
+		if(u < 0.0f || u > 1.0f) {
+			return false;
+		}
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(d, q) * inv;
+		if(v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+		float t = glm::dot(e2, q) * inv;
+		return t > 1e-4f && t < tmax;
+	}
+
+	vector<Tri> tris;
+	vector<Node> nodes;
+};
+
+/**
+ * A bounding volume hierarchy over the objects' world space boxes, so that
+ * a ray only visits the objects along it instead of every object in the
+ * scene.
+ */
+class SceneBVH
+{
+public:
+	void build(const vector<glm::vec3> &bmins, const vector<glm::vec3> &bmaxs)
+	{
+		boxMins = bmins;
+		boxMaxs = bmaxs;
+		ids.resize(bmins.size());
+		for(size_t i = 0; i < ids.size(); i++) {
+			ids[i] = (int)i;
+		}
+		nodes.clear();
+		if(!ids.empty()) {
+			nodes.resize(1);
+			buildNode(0, 0, (int)ids.size());
+		}
+	}
+
+	// Calls hit(id) for the objects whose boxes the segment crosses, until
+	// one of the calls returns true
+	template <typename F>
+	bool anyHit(const glm::vec3 &o, const glm::vec3 &invDir, float tmax, F hit) const
+	{
+		if(nodes.empty()) {
+			return false;
+		}
+		int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0) {
+			const Node &n = nodes[stack[--top]];
+			if(!segmentHitsBox(o, invDir, tmax, n.bmin, n.bmax)) {
+				continue;
+			}
+			if(n.count > 0) {
+				for(int i = n.first; i < n.first + n.count; i++) {
+					if(segmentHitsBox(o, invDir, tmax, boxMins[ids[i]], boxMaxs[ids[i]]) && hit(ids[i])) {
+						return true;
+					}
+				}
+			} else {
+				// Nearer child first, since a blocked ray usually stops at
+				// one of the first objects along it
+				bool flip = invDir[n.axis] < 0.0f;
+				stack[top++] = n.first + (flip ? 0 : 1);
+				stack[top++] = n.first + (flip ? 1 : 0);
+			}
+		}
+		return false;
+	}
+
+private:
+	struct Node
+	{
+		glm::vec3 bmin;
+		glm::vec3 bmax;
+		int first; // first id for leaves, left child otherwise
+		int count; // 0 for inner nodes
+		int axis;  // of the split; the left child is on its low side
+	};
+
+	void buildNode(int index, int first, int count)
+	{
+		glm::vec3 bmin(FLT_MAX, FLT_MAX, FLT_MAX);
+		glm::vec3 bmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i = first; i < first + count; i++) {
+			bmin = glm::min(bmin, boxMins[ids[i]]);
+			bmax = glm::max(bmax, boxMaxs[ids[i]]);
+		}
+		nodes[index].bmin = bmin;
+		nodes[index].bmax = bmax;
+		if(count <= 2) {
+			nodes[index].first = first;
+			nodes[index].count = count;
+			return;
+		}
+		// Median split of the box centers along the longest axis
+		glm::vec3 ext = bmax - bmin;
+		int axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : (ext.y > ext.z ? 1 : 2);
+		int mid = first + count / 2;
+		nth_element(ids.begin() + first, ids.begin() + mid, ids.begin() + first + count,
+			[this, axis](int a, int b) {
+				return boxMins[a][axis] + boxMaxs[a][axis] < boxMins[b][axis] + boxMaxs[b][axis];
+			});
+		int left = (int)nodes.size();
+		nodes.resize(left + 2);
+		nodes[index].first = left;
+		nodes[index].count = 0;
+		nodes[index].axis = axis;
+		buildNode(left, first, mid - first);
+		buildNode(left + 1, mid, first + count - mid);
+	}
+
+	vector<glm::vec3> boxMins;
+	vector<glm::vec3> boxMaxs;
+	vector<int> ids;
+	vector<Node> nodes;
+};
+
+}
+
+PVS::PVS() :
+	gridMin(0.0f, 0.0f),
+	cellSize(1.0f),
+	cellsX(0),
+	cellsZ(0),
+	eyeLo(0.1f),
+	eyeHi(0.1f),
+	numObjects(0),
+	bytesPerCell(0),
+	layoutHash(0),
+	bits(0)
+{
+}
+
+PVS::~PVS()
+{
+}
+
+void PVS::setGrid(const glm::vec2 &min, const glm::vec2 &max, float size)
+{
+	gridMin = min;
+	cellSize = size;
+	cellsX = (int)ceil((max.x - min.x) / size);
+	cellsZ = (int)ceil((max.y - min.y) / size);
+}
+
+uint64_t PVS::computeLayoutHash(const vector<Object*> &objects) const
+{
+	// FNV-1a over everything that affects the baked result
+	uint64_t h = 14695981039346656037ull;
+	auto mix = [&h](const void *p, size_t n) {
+		const unsigned char *b = (const unsigned char *)p;
+		for(size_t i = 0; i < n; i++) {
+			h = (h ^ b[i]) * 1099511628211ull;
+		}
+	};
+	mix(&gridMin, sizeof(gridMin));
+	mix(&cellSize, sizeof(cellSize));
+	mix(&eyeLo, sizeof(eyeLo));
+	mix(&eyeHi, sizeof(eyeHi));
+	for(size_t i = 0; i < objects.size(); i++) {
+		glm::vec3 t = objects[i]->getTranslation();
+		glm::vec3 s = objects[i]->getScale();
+		size_t nverts = objects[i]->getShape()->getPosBuf().size();
+		mix(&t, sizeof(t));
+		mix(&s, sizeof(s));
+		mix(&objects[i]->getShape()->getBoundsMin(), sizeof(glm::vec3));
+		mix(&objects[i]->getShape()->getBoundsMax(), sizeof(glm::vec3));
+		mix(&nverts, sizeof(nverts));
+	}
+	return h;
+}
+
+void PVS::bake(const vector<Object*> &objects, int numThreads)
+{
+	auto t0 = chrono::steady_clock::now();
+	numObjects = (int)objects.size();
+	bytesPerCell = (numObjects + 7) / 8;
+	layoutHash = computeLayoutHash(objects);
+	baked.assign((size_t)getNumCells() * bytesPerCell, 0);
+	file.close();
+	bits = 0;
+
+	// One BVH per distinct mesh
+	map<const Shape*, MeshBVH> bvhs;
+	for(int i = 0; i < numObjects; i++) {
+		const Shape *s = objects[i]->getShape().get();
+		if(bvhs.find(s) == bvhs.end()) {
+			bvhs[s].build(s->getPosBuf());
+		}
+	}
+
+	// World space placement. Occluders use the smallest size of the pulse
+	// animation and targets the largest, so that neither over-occludes.
+	struct Placement
+	{
+		const MeshBVH *bvh;
+		glm::vec3 T;
+		glm::vec3 S;
+		glm::vec3 bmin;       // occluder box
+		glm::vec3 bmax;
+		glm::vec3 samples[9]; // target box center and corners
+	};
+	const float maxPulse = 1.1f;
+	vector<Placement> placements(numObjects);
+	for(int i = 0; i < numObjects; i++) {
+		Placement &pl = placements[i];
+		const Shape *s = objects[i]->getShape().get();
+		pl.bvh = &bvhs[s];
+		pl.T = objects[i]->getTranslation();
+		pl.S = objects[i]->getScale();
+		glm::vec3 a = pl.T + pl.S * s->getBoundsMin();
+		glm::vec3 b = pl.T + pl.S * s->getBoundsMax();
+		pl.bmin = glm::min(a, b);
+		pl.bmax = glm::max(a, b);
+		glm::vec3 A = pl.T + maxPulse * pl.S * s->getBoundsMin();
+		glm::vec3 B = pl.T + maxPulse * pl.S * s->getBoundsMax();
+		glm::vec3 tmin = glm::min(pl.bmin, glm::min(A, B));
+		glm::vec3 tmax = glm::max(pl.bmax, glm::max(A, B));
+		pl.samples[0] = 0.5f * (tmin + tmax);
+		for(int c = 0; c < 8; c++) {
+			pl.samples[c + 1] = glm::vec3((c & 1) ? tmax.x : tmin.x, (c & 2) ? tmax.y : tmin.y, (c & 4) ? tmax.z : tmin.z);
+		}
+	}
+
+	// Rays only test the occluders whose boxes they cross
+	vector<glm::vec3> occluderMins(numObjects);
+	vector<glm::vec3> occluderMaxs(numObjects);
+	for(int i = 0; i < numObjects; i++) {
+		occluderMins[i] = placements[i].bmin;
+		occluderMaxs[i] = placements[i].bmax;
+	}
+	SceneBVH scene;
+	scene.build(occluderMins, occluderMaxs);
+
+	auto occluded = [&](const glm::vec3 &e, const glm::vec3 &q, int skip) {
+		glm::vec3 d = q - e;
+		glm::vec3 invDir(1.0f / d.x, 1.0f / d.y, 1.0f / d.z);
+		return scene.anyHit(e, invDir, 1.0f, [&](int k) {
+			const Placement &pl = placements[k];
+			// Objects are only translated and scaled, so t carries over
+			return k != skip && pl.bvh->anyHit((e - pl.T) / pl.S, d / pl.S, 1.0f);
+		});
+	};
+
+	// Eye samples on a 3x3 lattice per cell (edges included) at each height
+	const int N = 3;
+	int nheights = (eyeHi > eyeLo) ? 2 : 1;
+	atomic<int> nextCell(0);
+	auto worker = [&]() {
+		vector<glm::vec3> eyes;
+		for(;;) {
+			int cell = nextCell++;
+			if(cell >= getNumCells()) {
+				break;
+			}
+			int cx = cell % cellsX;
+			int cz = cell / cellsX;
+			eyes.clear();
+			for(int h = 0; h < nheights; h++) {
+				float y = (h == 0) ? eyeLo : eyeHi;
+				for(int iz = 0; iz < N; iz++) {
+					for(int ix = 0; ix < N; ix++) {
+						float x = gridMin.x + cellSize * (cx + ix / (float)(N - 1));
+						float z = gridMin.y + cellSize * (cz + iz / (float)(N - 1));
+						eyes.push_back(glm::vec3(x, y, z));
+					}
+				}
+			}
+			unsigned char *out = &baked[(size_t)cell * bytesPerCell];
+			for(int j = 0; j < numObjects; j++) {
+				bool seen = false;
+				for(size_t e = 0; e < eyes.size() && !seen; e++) {
+					for(int q = 0; q < 9 && !seen; q++) {
+						seen = !occluded(eyes[e], placements[j].samples[q], j);
+					}
+				}
+				if(seen) {
+					out[j >> 3] |= (unsigned char)(1 << (j & 7));
+				}
+			}
+		}
+	};
+	numThreads = max(1, numThreads);
+	vector<thread> threads;
+	for(int i = 0; i < numThreads; i++) {
+		threads.push_back(thread(worker));
+	}
+	for(size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+	bits = &baked[0];
+
+	double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	size_t total = 0;
+	for(int c = 0; c < getNumCells(); c++) {
+		total += countVisible(c);
+	}
+	cout << "Baked PVS: " << cellsX << "x" << cellsZ << " cells, " << numThreads << " threads, "
+		<< secs << " s, " << (double)total / getNumCells() << " of " << numObjects << " objects visible per cell" << endl;
+}
+
+bool PVS::save(const string &filename) const
+{
+	if(baked.empty()) {
+		return false;
+	}
+	PVSHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PVS_MAGIC, 4);
+	hdr.version = PVS_VERSION;
+	hdr.cellsX = cellsX;
+	hdr.cellsZ = cellsZ;
+	hdr.numObjects = numObjects;
+	hdr.bytesPerCell = bytesPerCell;
+	hdr.minX = gridMin.x;
+	hdr.minZ = gridMin.y;
+	hdr.cellSize = cellSize;
+	hdr.eyeLo = eyeLo;
+	hdr.eyeHi = eyeHi;
+	hdr.layoutHash = layoutHash;
+	string temp = MappedFile::tempName(filename);
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't write to " << temp << endl;
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(&baked[0], 1, baked.size(), fp) == baked.size();
+	ok = fclose(fp) == 0 && ok;
+	if(!ok) {
+		remove(temp.c_str());
+	} else if(!MappedFile::replace(temp, filename)) {
+		cerr << "Couldn't replace " << filename << endl;
+		ok = false;
+	}
+	return ok;
+}
+
+bool PVS::load(const string &filename, const vector<Object*> &objects)
+{
+	bits = 0;
+	if(!file.open(filename) || file.getSize() < sizeof(PVSHeader)) {
+		return false;
+	}
+	PVSHeader hdr;
+	memcpy(&hdr, file.getData(), sizeof(hdr));
+	int n = (int)objects.size();
+	if(memcmp(hdr.magic, PVS_MAGIC, 4) != 0 || hdr.version != PVS_VERSION ||
+	   (int)hdr.cellsX != cellsX || (int)hdr.cellsZ != cellsZ || (int)hdr.numObjects != n ||
+	   hdr.layoutHash != computeLayoutHash(objects) ||
+	   file.getSize() < sizeof(hdr) + (size_t)hdr.cellsX * hdr.cellsZ * hdr.bytesPerCell) {
+		cout << filename << " is stale" << endl;
+		file.close();
+		return false;
+	}
+	numObjects = n;
+	bytesPerCell = hdr.bytesPerCell;
+	layoutHash = hdr.layoutHash;
+	baked.clear();
+	bits = file.getData() + sizeof(hdr);
+	return true;
+}
+
+int PVS::findCell(const glm::vec3 &p) const
+{
+	int cx = (int)floor((p.x - gridMin.x) / cellSize);
+	int cz = (int)floor((p.z - gridMin.y) / cellSize);
+	if(cx < 0 || cz < 0 || cx >= cellsX || cz >= cellsZ) {
+		return -1;
+	}
+	return cz * cellsX + cx;
+}
+
+bool PVS::isVisible(int cell, int obj) const
+{
+	if(!bits || cell < 0 || obj >= numObjects) {
+		return true;
+	}
+	return (bits[(size_t)cell * bytesPerCell + (obj >> 3)] >> (obj & 7)) & 1;
+}
+
+int PVS::countVisible(int cell) const
+{
+	int count = 0;
+	for(int j = 0; j < numObjects; j++) {
+		count += isVisible(cell, j);
+	}
+	return count;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef PVS_H
+#define PVS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "MappedFile.h"
+
+class Object;
+
+/**
+ * Precomputed potentially visible sets for a grid of cells on the ground
+ * plane. bake() ray casts the (static) object layout against the actual
+ * triangles from sample eye points in every cell, spread over several
+ * threads, and keeps one bit per object per cell. The bits are saved to a
+ * small file that load() memory-maps, so startup only pays for a page fault
+ * on the cells that are actually visited.
+ */
+class PVS
+{
+public:
+	PVS();
+	virtual ~PVS();
+	// Region of the ground plane in (x, z) covered by the cells
+	void setGrid(const glm::vec2 &min, const glm::vec2 &max, float cellSize);
+	// Range of camera heights sampled inside every cell
+	void setEyeHeights(float lo, float hi) { eyeLo = lo; eyeHi = hi; }
+	void bake(const std::vector<Object*> &objects, int numThreads);
+	bool save(const std::string &filename) const;
+	// Fails if the file is missing or was baked for a different layout
+	bool load(const std::string &filename, const std::vector<Object*> &objects);
+	bool isReady() const { return bits != 0; }
+	// Returns -1 outside of the grid
+	int findCell(const glm::vec3 &p) const;
+	bool isVisible(int cell, int obj) const;
+	int getNumCells() const { return cellsX * cellsZ; }
+	int countVisible(int cell) const;
+
+private:
+	uint64_t computeLayoutHash(const std::vector<Object*> &objects) const;
+
+	glm::vec2 gridMin;
+	float cellSize;
+	int cellsX;
+	int cellsZ;
+	float eyeLo;
+	float eyeHi;
+	int numObjects;
+	int bytesPerCell;
+	uint64_t layoutHash;
+	std::vector<unsigned char> baked; // output of bake()
+	MappedFile file;                  // output of load()
+	const unsigned char *bits;        // points into one of the two above
+};
+
+#endif
@@ -0,0 +1,151 @@
+#include "PoseBatch.h"
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
+
+#include "FreeLookCamera.h"
+
+using namespace std;
+
+namespace {
+
+float radians(float degrees)
+{
+	return degrees * (float)M_PI / 180.0f;
+}
+
+}
+
+PoseBatch::PoseBatch() :
+	next(0),
+	shardIndex(0),
+	shardCount(1)
+{
+}
+
+PoseBatch::~PoseBatch()
+{
+}
+
+bool PoseBatch::load(const string &filename)
+{
+	ifstream in(filename);
+	if(!in) {
+		cerr << filename << " not found" << endl;
+		return false;
+	}
+	poses.clear();
+	string line;
+	int lineNumber = 0;
+	while(getline(in, line)) {
+		lineNumber++;
+		size_t first = line.find_first_not_of(" \t\r");
+		if(first == string::npos || line[first] == '#') {
+			continue;
+		}
+		istringstream fields(line);
+		Pose p;
+		float yaw, pitch, fov;
+		if(!(fields >> p.position.x >> p.position.y >> p.position.z >> yaw >> pitch >> fov)) {
+			cerr << filename << ":" << lineNumber << ": expected x y z yaw pitch fov" << endl;
+			return false;
+		}
+		p.yaw = radians(yaw);
+		p.pitch = radians(pitch);
+		p.fovy = radians(fov);
+		p.index = (int)poses.size();
+		poses.push_back(p);
+	}
+	next = 0;
+	return true;
+}
+
+void PoseBatch::setShard(int index, int count)
+{
+	shardIndex = index;
+	shardCount = count;
+	vector<Pose> shard;
+	for(size_t i = index; i < poses.size(); i += count) {
+		shard.push_back(poses[i]);
+	}
+	poses.swap(shard);
+	next = 0;
+}
+
+int PoseBatch::apply(shared_ptr<FreeLookCamera> camera)
+{
+	if(isDone()) {
+		return -1;
+	}
+	if(next == 0) {
+		start = chrono::steady_clock::now();
+	}
+	const Pose &p = poses[next++];
+	camera->setPose(p.position, p.yaw, p.pitch, p.fovy);
+	return p.index;
+}
+
+void PoseBatch::printStats() const
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Shard " << shardIndex << "/" << shardCount << ": " << next << " poses in " << seconds << " s, " << next / seconds << " images/s" << endl;
+}
+
+int PoseBatch::runShards(const vector<string> &args, int numShards, int numPoses)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int failed = 0;
+#ifdef _WIN32
+	vector<intptr_t> children;
+#else
+	vector<pid_t> children;
+#endif
+	for(int i = 0; i < numShards; i++) {
+		vector<string> shardArgs = args;
+		shardArgs.push_back("--shard=" + to_string(i) + "/" + to_string(numShards));
+		vector<char *> argv;
+		for(size_t j = 0; j < shardArgs.size(); j++) {
+			argv.push_back(&shardArgs[j][0]);
+		}
+		argv.push_back(0);
+#ifdef _WIN32
+		intptr_t child = _spawnv(_P_NOWAIT, argv[0], &argv[0]);
+		if(child == -1) {
+#else
+		pid_t child;
+		if(posix_spawnp(&child, argv[0], 0, 0, &argv[0], environ) != 0) {
+#endif
+			cerr << "Could not start shard " << i << endl;
+			failed++;
+			continue;
+		}
+		children.push_back(child);
+	}
+	for(size_t i = 0; i < children.size(); i++) {
+		int status = 0;
+#ifdef _WIN32
+		_cwait(&status, children[i], 0);
+		failed += status != 0 ? 1 : 0;
+#else
+		waitpid(children[i], &status, 0);
+		failed += (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ? 1 : 0;
+#endif
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	// Includes every shard's start-up
+	cout << numShards << " shards: " << numPoses << " poses in " << seconds << " s, " << numPoses / seconds << " images/s" << endl;
+	if(failed) {
+		cerr << failed << " shards failed" << endl;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef POSE_BATCH_H
+#define POSE_BATCH_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class FreeLookCamera;
+
+/**
+ * A list of FreeLookCamera poses rendered one per frame, for generating
+ * datasets with the assets loaded only once. Each line of the file is
+ *   x y z yaw pitch fov
+ * with the angles in degrees. Blank lines and lines starting with '#' are
+ * skipped. Images are numbered by the pose's place in the list.
+ *
+ * The list can be split into shards, one per process. Shard i of n takes
+ * every nth pose starting at i, so that runs of similar poses, which cost
+ * about the same, are spread over all of them. runShards() starts those
+ * processes and waits for them.
+ */
+class PoseBatch
+{
+public:
+	struct Pose
+	{
+		glm::vec3 position;
+		float yaw; // radians, like FreeLookCamera
+		float pitch;
+		float fovy;
+		int index; // in the file
+	};
+
+	PoseBatch();
+	virtual ~PoseBatch();
+	bool load(const std::string &filename);
+	// Keeps only shard index of count
+	void setShard(int index, int count);
+	int getNumPoses() const { return (int)poses.size(); }
+	const std::vector<Pose> &getPoses() const { return poses; }
+	bool isDone() const { return next >= poses.size(); }
+	// Moves the camera to the next pose and returns that pose's index in
+	// the file, or returns -1 once every pose has been applied
+	int apply(std::shared_ptr<FreeLookCamera> camera);
+	// Poses rendered and images per second since the first apply()
+	void printStats() const;
+	// Runs this program once per shard, with args plus --shard=i/n, and
+	// returns 0 if every shard succeeded. Reports the images per second of
+	// all shards together.
+	static int runShards(const std::vector<std::string> &args, int numShards, int numPoses);
+
+private:
+	std::vector<Pose> poses;
+	size_t next;
+	int shardIndex;
+	int shardCount;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
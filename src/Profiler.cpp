@@ -0,0 +1,225 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "GLSL.h"
+#include "GPUTimer.h"
+
+using namespace std;
+
+namespace {
+
+double percentile(const vector<double> &sorted, int p)
+{
+	return sorted.empty() ? 0.0 : sorted[min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+}
+
+Profiler::Profiler(int historySize) :
+	timed(GPUTimer::isSupported()),
+	start(chrono::steady_clock::now()),
+	head(0),
+	pending(0),
+	inFrame(false),
+	history(max(1, historySize)),
+	numCollected(0)
+{
+}
+
+Profiler::~Profiler()
+{
+	for(int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+		if(!frames[i].queryIDs.empty()) {
+			glDeleteQueries((GLsizei)frames[i].queryIDs.size(), &frames[i].queryIDs[0]);
+		}
+	}
+}
+
+bool Profiler::isSupported()
+{
+#ifdef FLC_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+double Profiler::now() const
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+void Profiler::collect(bool wait)
+{
+	while(pending > 0) {
+		PendingFrame &f = frames[(head - pending + NUM_FRAMES_IN_FLIGHT) % NUM_FRAMES_IN_FLIGHT];
+		if(timed) {
+			// The frame's own end is the last query it issued
+			GLint available = 0;
+			glGetQueryObjectiv(f.queryIDs[1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available && !wait) {
+				return;
+			}
+			for(size_t i = 0; i < f.events.size(); i++) {
+				GLuint64 ns[2] = { 0, 0 };
+				glGetQueryObjectui64v(f.queryIDs[2 * i], GL_QUERY_RESULT, &ns[0]);
+				glGetQueryObjectui64v(f.queryIDs[2 * i + 1], GL_QUERY_RESULT, &ns[1]);
+				f.events[i].gpuBegin = ns[0] * 1e-3 + f.offset;
+				f.events[i].gpuEnd = ns[1] * 1e-3 + f.offset;
+			}
+		}
+		history[numCollected % history.size()].swap(f.events);
+		numCollected++;
+		pending--;
+		wait = false;
+	}
+}
+
+void Profiler::beginFrame()
+{
+	collect(pending == NUM_FRAMES_IN_FLIGHT);
+	PendingFrame &f = frames[head];
+	f.events.clear();
+	f.offset = 0.0;
+	if(timed) {
+		// Lines the GPU's clock up with the CPU's
+		GLint64 gpuNow = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		f.offset = now() - gpuNow * 1e-3;
+	}
+	inFrame = true;
+	open.clear();
+	begin("frame");
+}
+
+void Profiler::endFrame()
+{
+	if(!inFrame) {
+		return;
+	}
+	while(!open.empty()) {
+		end();
+	}
+	inFrame = false;
+	head = (head + 1) % NUM_FRAMES_IN_FLIGHT;
+	pending++;
+}
+
+void Profiler::begin(const char *name)
+{
+	if(!inFrame) {
+		return;
+	}
+	PendingFrame &f = frames[head];
+	Event e = { name, (int)open.size(), now(), 0.0, -1.0, -1.0 };
+	open.push_back((int)f.events.size());
+	f.events.push_back(e);
+	if(timed) {
+		size_t needed = 2 * f.events.size();
+		if(f.queryIDs.size() < needed) {
+			size_t n = f.queryIDs.size();
+			f.queryIDs.resize(max(needed, 2 * n));
+			glGenQueries((GLsizei)(f.queryIDs.size() - n), &f.queryIDs[n]);
+		}
+		glQueryCounter(f.queryIDs[needed - 2], GL_TIMESTAMP);
+	}
+}
+
+void Profiler::end()
+{
+	if(!inFrame || open.empty()) {
+		return;
+	}
+	PendingFrame &f = frames[head];
+	int i = open.back();
+	open.pop_back();
+	f.events[i].cpuEnd = now();
+	if(timed) {
+		glQueryCounter(f.queryIDs[2 * i + 1], GL_TIMESTAMP);
+	}
+}
+
+void Profiler::finish()
+{
+	endFrame();
+	while(pending > 0) {
+		collect(true);
+	}
+}
+
+int Profiler::getNumFrames() const
+{
+	return (int)min(numCollected, history.size());
+}
+
+void Profiler::printSummary() const
+{
+	int n = getNumFrames();
+	if(n == 0) {
+		return;
+	}
+	// Phases in the order of the last frame, where they nest
+	const vector<Event> &last = history[(numCollected - 1) % history.size()];
+	cout << "Profile of the last " << n << " frames, in ms" << endl;
+	cout << left << setw(24) << "" << right << setw(24) << "CPU p50 / p95 / p99" << setw(28) << "GPU p50 / p95 / p99" << endl;
+	cout << fixed << setprecision(3);
+	for(size_t k = 0; k < last.size(); k++) {
+		vector<double> cpu;
+		vector<double> gpu;
+		for(int j = 0; j < n; j++) {
+			const vector<Event> &events = history[(numCollected - 1 - j) % history.size()];
+			for(size_t i = 0; i < events.size(); i++) {
+				if(events[i].depth == last[k].depth && strcmp(events[i].name, last[k].name) == 0) {
+					cpu.push_back((events[i].cpuEnd - events[i].cpuBegin) * 1e-3);
+					if(events[i].gpuBegin >= 0.0) {
+						gpu.push_back((events[i].gpuEnd - events[i].gpuBegin) * 1e-3);
+					}
+				}
+			}
+		}
+		sort(cpu.begin(), cpu.end());
+		sort(gpu.begin(), gpu.end());
+		cout << left << setw(24) << (string(2 * last[k].depth, ' ') + last[k].name) << right;
+		cout << setw(10) << percentile(cpu, 50) << setw(8) << percentile(cpu, 95) << setw(8) << percentile(cpu, 99);
+		if(!gpu.empty()) {
+			cout << setw(12) << percentile(gpu, 50) << setw(8) << percentile(gpu, 95) << setw(8) << percentile(gpu, 99);
+		}
+		cout << endl;
+	}
+	cout << defaultfloat;
+}
+
+bool Profiler::writeTrace(const string &filename) const
+{
+	ofstream out(filename);
+	if(!out) {
+		cerr << "Could not write " << filename << endl;
+		return false;
+	}
+	out << fixed << setprecision(3);
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+	out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}}," << endl;
+	out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+	// Oldest first
+	int n = getNumFrames();
+	for(int j = n - 1; j >= 0; j--) {
+		const vector<Event> &events = history[(numCollected - 1 - j) % history.size()];
+		for(size_t i = 0; i < events.size(); i++) {
+			const Event &e = events[i];
+			out << "," << endl << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": "
+				<< e.cpuBegin << ", \"dur\": " << e.cpuEnd - e.cpuBegin << "}";
+			if(e.gpuBegin >= 0.0) {
+				out << "," << endl << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": "
+					<< e.gpuBegin << ", \"dur\": " << e.gpuEnd - e.gpuBegin << "}";
+			}
+		}
+	}
+	out << endl << "]}" << endl;
+	cout << "Wrote " << n << " frames to " << filename << endl;
+	return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * Times the phases of a frame on the CPU and the GPU. Each phase is a named
+ * scope; scopes nest, and the frame itself is the outermost one:
+ *   PROFILE_FRAME(profiler);
+ *   { PROFILE_SCOPE(profiler, "ground"); ... }
+ *   PROFILE_BEGIN(profiler, "objects"); ... PROFILE_END(profiler);
+ * The macros take a shared_ptr<Profiler> and do nothing while it is null.
+ * Without FLC_PROFILE they expand to nothing at all.
+ *
+ * GPU times come from GL_TIMESTAMP queries at both ends of each scope,
+ * since GL_TIME_ELAPSED queries can't nest. They are read a few frames
+ * later, without waiting unless every frame in flight is still pending.
+ * Finished frames go to a ring of the last few hundred, which
+ * printSummary() reduces to percentiles per phase and writeTrace() saves
+ * in the Chrome trace format (chrome://tracing or ui.perfetto.dev), with
+ * the CPU and the GPU as two threads on one timeline.
+ */
+class Profiler
+{
+public:
+	struct Event
+	{
+		const char *name; // a string literal
+		int depth;
+		double cpuBegin; // microseconds since the profiler was created
+		double cpuEnd;
+		double gpuBegin; // on the same clock, or -1 without timer queries
+		double gpuEnd;
+	};
+
+	class Scope
+	{
+	public:
+		Scope(Profiler *profiler, const char *name) : profiler(profiler) { if(profiler) profiler->begin(name); }
+		~Scope() { if(profiler) profiler->end(); }
+	private:
+		Profiler *profiler;
+	};
+
+	class Frame
+	{
+	public:
+		Frame(Profiler *profiler) : profiler(profiler) { if(profiler) profiler->beginFrame(); }
+		~Frame() { if(profiler) profiler->endFrame(); }
+	private:
+		Profiler *profiler;
+	};
+
+	// Keeps the last historySize frames
+	Profiler(int historySize = 600);
+	virtual ~Profiler();
+	void beginFrame();
+	void endFrame();
+	// Scopes outside of a frame are ignored
+	void begin(const char *name);
+	void end();
+	// Waits for the frames still on the GPU
+	void finish();
+	int getNumFrames() const;
+	// p50, p95 and p99 of every phase's CPU and GPU times
+	void printSummary() const;
+	bool writeTrace(const std::string &filename) const;
+	// Whether the scopes were compiled in
+	static bool isSupported();
+
+private:
+	Profiler(const Profiler &);
+	Profiler &operator=(const Profiler &);
+
+	enum { NUM_FRAMES_IN_FLIGHT = 4 };
+
+	struct PendingFrame
+	{
+		std::vector<Event> events;
+		std::vector<unsigned> queryIDs; // two per event, reused
+		double offset; // from the GPU's clock to the CPU's, in microseconds
+	};
+
+	double now() const;
+	// Moves the frames whose queries are done to the history. If wait is
+	// true, waits for the oldest one.
+	void collect(bool wait);
+
+	bool timed; // with timer queries
+	std::chrono::steady_clock::time_point start;
+	PendingFrame frames[NUM_FRAMES_IN_FLIGHT];
+	int head;    // the frame being recorded
+	int pending; // ended but not collected, ending at head
+	bool inFrame;
+	std::vector<int> open; // the current frame's unfinished events
+	std::vector< std::vector<Event> > history;
+	size_t numCollected;
+};
+
+#ifdef FLC_PROFILE
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_FRAME(profiler) Profiler::Frame PROFILE_CONCAT(profileFrame, __LINE__)((profiler).get())
+#define PROFILE_SCOPE(profiler, name) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)((profiler).get(), name)
+#define PROFILE_BEGIN(profiler, name) do { if(profiler) (profiler)->begin(name); } while(0)
+#define PROFILE_END(profiler) do { if(profiler) (profiler)->end(); } while(0)
+#else
+#define PROFILE_FRAME(profiler)
+#define PROFILE_SCOPE(profiler, name)
+#define PROFILE_BEGIN(profiler, name) do {} while(0)
+#define PROFILE_END(profiler) do {} while(0)
+#endif
+
+#endif
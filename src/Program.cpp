@@ -1,19 +1,99 @@
 #include "Program.h"
 
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include "GLSL.h"
+#include "MappedFile.h"
 
 using namespace std;
 
+namespace {
+
+struct BinaryHeader
+{
+	char magic[4];
+	uint32_t format; // from glGetProgramBinary
+	uint32_t size;   // of the binary that follows the header
+	uint32_t pad;
+	uint64_t key;    // sources, defines and driver
+};
+
+const char BINARY_MAGIC[4] = { 'P', 'R', 'G', '1' };
+
+// FNV-1a over the strings, including their terminators so that the
+// boundaries matter. Null strings hash like empty ones.
+uint64_t hashStrings(const char *const *strings, int count)
+{
+	uint64_t h = 14695981039346656037ull;
+	for(int i = 0; i < count; i++) {
+		const char *c = strings[i] ? strings[i] : "";
+		do {
+			h = (h ^ (unsigned char)*c) * 1099511628211ull;
+		} while(*c++);
+	}
+	return h;
+}
+
+// Hands src to the shader with the defines placed after the #version line
+// (which has to come first). #line keeps the error messages pointing at the
+// lines of the file.
+void setShaderSource(GLuint shader, const char *src, const string &defines)
+{
+	if(!src || defines.empty()) {
+		glShaderSource(shader, 1, &src, NULL);
+		return;
+	}
+	const char *body = src;
+	int line = 1;
+	const char *version = strstr(src, "#version");
+	if(version) {
+		const char *eol = strchr(version, '\n');
+		body = eol ? eol + 1 : version + strlen(version);
+		for(const char *c = src; c < body; c++) {
+			line += (*c == '\n');
+		}
+	}
+	string head(src, body - src);
+	if(!head.empty() && head[head.size() - 1] != '\n') {
+		head += "\n";
+	}
+	ostringstream inject;
+	inject << defines << "#line " << line << "\n";
+	string middle = inject.str();
+	const char *strings[3] = { head.c_str(), middle.c_str(), body };
+	glShaderSource(shader, 3, strings, NULL);
+}
+
+}
+
+string Program::cacheDir;
+int Program::numLoaded = 0;
+int Program::numCompiled = 0;
+double Program::initSeconds = 0.0;
+
 Program::Program() :
 	vShaderName(""),
 	fShaderName(""),
+	gShaderName(""),
+	cacheKey(0),
+	compiling(false),
 	pid(0),
 	verbose(true)
 {
-	
+	shaders[0] = shaders[1] = shaders[2] = 0;
 }
 
 Program::~Program()
@@ -21,66 +101,244 @@ Program::~Program()
 	
 }
 
-void Program::setShaderNames(const string &v, const string &f)
+void Program::setShaderNames(const string &v, const string &f, const string &g)
 {
 	vShaderName = v;
 	fShaderName = f;
+	gShaderName = g;
+}
+
+void Program::addDefine(const string &name, int value)
+{
+	ostringstream line;
+	line << "#define " << name << " " << value << "\n";
+	defines += line.str();
+}
+
+void Program::setCacheDirectory(const string &dir)
+{
+	cacheDir = dir;
+	if(!cacheDir.empty() && cacheDir[cacheDir.size() - 1] != '/') {
+		cacheDir += "/";
+	}
+	if(!cacheDir.empty()) {
+#ifdef _WIN32
+		_mkdir(cacheDir.c_str());
+#else
+		mkdir(cacheDir.c_str(), 0755);
+#endif
+	}
+}
+
+bool Program::isCacheSupported()
+{
+	if(!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+		return false;
+	}
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+bool Program::isParallelCompileSupported()
+{
+	return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
 }
 
 bool Program::init()
 {
-	GLint rc;
-	
-	// Create shader handles
-	GLuint VS = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FS = glCreateShader(GL_FRAGMENT_SHADER);
+	begin();
+	return finish();
+}
+
+void Program::begin()
+{
+	auto t0 = chrono::steady_clock::now();
 	
 	// Read shader sources
-	const char *vshader = GLSL::textFileRead(vShaderName.c_str());
-	const char *fshader = GLSL::textFileRead(fShaderName.c_str());
-	glShaderSource(VS, 1, &vshader, NULL);
-	glShaderSource(FS, 1, &fshader, NULL);
+	char *vshader = GLSL::textFileRead(vShaderName.c_str());
+	char *fshader = GLSL::textFileRead(fShaderName.c_str());
+	char *gshader = gShaderName.empty() ? 0 : GLSL::textFileRead(gShaderName.c_str());
 	
-	// Compile vertex shader
-	glCompileShader(VS);
-	glGetShaderiv(VS, GL_COMPILE_STATUS, &rc);
-	if(!rc) {
-		if(isVerbose()) {
-			GLSL::printShaderInfoLog(VS);
-			cout << "Error compiling vertex shader " << vShaderName << endl;
+	// The cache file is named after the shader files and defines, and holds
+	// a hash of everything else that invalidates the binary
+	cacheFile.clear();
+	cacheKey = 0;
+	if(!cacheDir.empty() && isCacheSupported()) {
+		const char *parts[] = { vShaderName.c_str(), fShaderName.c_str(), gShaderName.c_str(), defines.c_str() };
+		ostringstream name;
+		name << cacheDir << hex << hashStrings(parts, 4) << ".bin";
+		cacheFile = name.str();
+		const char *inputs[] = {
+			vshader, fshader, gshader, defines.c_str(),
+			(const char *)glGetString(GL_VENDOR),
+			(const char *)glGetString(GL_RENDERER),
+			(const char *)glGetString(GL_VERSION)
+		};
+		cacheKey = hashStrings(inputs, 7);
+	}
+	
+	if(!cacheFile.empty() && loadBinary(cacheFile, cacheKey)) {
+		numLoaded++;
+	} else {
+		submit(vshader, fshader, gshader);
+		numCompiled++;
+	}
+	free(vshader);
+	free(fshader);
+	free(gshader);
+	initSeconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+bool Program::isReady() const
+{
+	if(!compiling || !isParallelCompileSupported()) {
+		return true;
+	}
+	GLint done = 0;
+	glGetProgramiv(pid, GL_COMPLETION_STATUS_KHR, &done);
+	return done != 0;
+}
+
+void Program::submit(const char *vshader, const char *fshader, const char *gshader)
+{
+	// Nothing is queried here, so a driver with parallel compilation can
+	// work on this program while the caller goes on
+	shaders[0] = glCreateShader(GL_VERTEX_SHADER);
+	shaders[1] = glCreateShader(GL_FRAGMENT_SHADER);
+	shaders[2] = gShaderName.empty() ? 0 : glCreateShader(GL_GEOMETRY_SHADER);
+	const char *sources[3] = { vshader, fshader, gshader };
+	pid = glCreateProgram();
+	for(int i = 0; i < 3; i++) {
+		if(shaders[i]) {
+			setShaderSource(shaders[i], sources[i], defines);
+			glCompileShader(shaders[i]);
+			glAttachShader(pid, shaders[i]);
 		}
-		return false;
 	}
+	if(!cacheFile.empty()) {
+		glProgramParameteri(pid, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(pid);
+	compiling = true;
+}
+
+bool Program::finish()
+{
+	if(!compiling) {
+		return pid != 0;
+	}
+	compiling = false;
+	auto t0 = chrono::steady_clock::now();
 	
-	// Compile fragment shader
-	glCompileShader(FS);
-	glGetShaderiv(FS, GL_COMPILE_STATUS, &rc);
-	if(!rc) {
-		if(isVerbose()) {
-			GLSL::printShaderInfoLog(FS);
-			cout << "Error compiling fragment shader " << fShaderName << endl;
+	// The first status query waits for the driver
+	const char *stages[3] = { "vertex", "fragment", "geometry" };
+	const string *names[3] = { &vShaderName, &fShaderName, &gShaderName };
+	bool ok = true;
+	GLint rc;
+	for(int i = 0; i < 3 && ok; i++) {
+		if(!shaders[i]) {
+			continue;
+		}
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &rc);
+		if(!rc) {
+			if(isVerbose()) {
+				GLSL::printShaderInfoLog(shaders[i]);
+				cout << "Error compiling " << stages[i] << " shader " << *names[i] << endl;
+			}
+			ok = false;
+		}
+	}
+	if(ok) {
+		glGetProgramiv(pid, GL_LINK_STATUS, &rc);
+		if(!rc) {
+			if(isVerbose()) {
+				GLSL::printProgramInfoLog(pid);
+				cout << "Error linking shaders " << vShaderName << " and " << fShaderName << endl;
+			}
+			ok = false;
 		}
-		return false;
 	}
 	
-	// Create the program and link
+	// The shader objects are only needed until the program is linked
+	for(int i = 0; i < 3; i++) {
+		if(shaders[i]) {
+			glDetachShader(pid, shaders[i]);
+			glDeleteShader(shaders[i]);
+			shaders[i] = 0;
+		}
+	}
+	if(!ok) {
+		glDeleteProgram(pid);
+		pid = 0;
+	}
+	if(ok && !cacheFile.empty()) {
+		saveBinary(cacheFile, cacheKey);
+	}
+	GLSL::checkError(GET_FILE_LINE);
+	initSeconds += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	return ok;
+}
+
+bool Program::loadBinary(const string &filename, uint64_t key)
+{
+	MappedFile file;
+	if(!file.open(filename) || file.getSize() < sizeof(BinaryHeader)) {
+		return false;
+	}
+	BinaryHeader hdr;
+	memcpy(&hdr, file.getData(), sizeof(hdr));
+	if(memcmp(hdr.magic, BINARY_MAGIC, 4) != 0 || hdr.key != key ||
+	   file.getSize() < sizeof(hdr) + hdr.size) {
+		return false;
+	}
 	pid = glCreateProgram();
-	glAttachShader(pid, VS);
-	glAttachShader(pid, FS);
-	glLinkProgram(pid);
+	glProgramBinary(pid, hdr.format, file.getData() + sizeof(hdr), (GLsizei)hdr.size);
+	GLint rc = 0;
 	glGetProgramiv(pid, GL_LINK_STATUS, &rc);
 	if(!rc) {
-		if(isVerbose()) {
-			GLSL::printProgramInfoLog(pid);
-			cout << "Error linking shaders " << vShaderName << " and " << fShaderName << endl;
-		}
+		// The driver can still reject a binary it wrote (e.g. after an update)
+		glDeleteProgram(pid);
+		pid = 0;
+		glGetError();
 		return false;
 	}
-	
-	GLSL::checkError(GET_FILE_LINE);
 	return true;
 }
 
+void Program::saveBinary(const string &filename, uint64_t key) const
+{
+	GLint size = 0;
+	glGetProgramiv(pid, GL_PROGRAM_BINARY_LENGTH, &size);
+	if(size <= 0) {
+		return;
+	}
+	vector<unsigned char> data(size);
+	BinaryHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, BINARY_MAGIC, 4);
+	GLenum format = 0;
+	glGetProgramBinary(pid, size, &size, &format, &data[0]);
+	hdr.format = format;
+	hdr.size = size;
+	hdr.key = key;
+	// Other processes may be mapping the cached binary right now
+	string temp = MappedFile::tempName(filename);
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't write to " << temp << endl;
+		return;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(&data[0], 1, size, fp) == (size_t)size;
+	ok = fclose(fp) == 0 && ok;
+	if(!ok) {
+		remove(temp.c_str());
+	} else if(!MappedFile::replace(temp, filename)) {
+		cerr << "Couldn't replace " << filename << endl;
+	}
+}
+
 void Program::bind()
 {
 	glUseProgram(pid);
@@ -4,12 +4,18 @@
 
 #include <map>
 #include <string>
+#include <stdint.h>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
 
 /**
- * An OpenGL Program (vertex and fragment shaders)
+ * An OpenGL Program (vertex and fragment shaders, and an optional geometry shader).
+ * Defines added before init() are inserted into every stage right after the
+ * #version line, so that one source can be compiled into several variants.
+ * If a cache directory is set, linked programs are saved with
+ * glGetProgramBinary and later launches load them instead of compiling. A
+ * binary is only used if the sources, defines and driver are unchanged.
  */
 class Program
 {
@@ -20,8 +26,16 @@ public:
 	void setVerbose(bool v) { verbose = v; }
 	bool isVerbose() const { return verbose; }
 	
-	void setShaderNames(const std::string &v, const std::string &f);
+	void setShaderNames(const std::string &v, const std::string &f, const std::string &g = "");
+	void addDefine(const std::string &name, int value);
+	const std::string &getDefines() const { return defines; }
 	virtual bool init();
+	// init() in two halves, so that several programs can compile at once.
+	// begin() loads the cached binary or submits the sources without
+	// waiting, and finish() waits for the result and reports any errors.
+	void begin();
+	bool isReady() const;
+	bool finish();
 	virtual void bind();
 	virtual void unbind();
 
@@ -30,11 +44,37 @@ public:
 	GLint getAttribute(const std::string &name) const;
 	GLint getUniform(const std::string &name) const;
 	
+	// Empty disables the cache. The directory is created if needed.
+	static void setCacheDirectory(const std::string &dir);
+	static bool isCacheSupported();
+	// Whether isReady() can tell without waiting
+	static bool isParallelCompileSupported();
+	// Totals over all programs. The time is what was spent in begin() and
+	// finish(), including any wait for the driver.
+	static int getNumLoaded() { return numLoaded; }
+	static int getNumCompiled() { return numCompiled; }
+	static double getInitSeconds() { return initSeconds; }
+	
 protected:
 	std::string vShaderName;
 	std::string fShaderName;
+	std::string gShaderName;
+	std::string defines;
 	
 private:
+	void submit(const char *vshader, const char *fshader, const char *gshader);
+	bool loadBinary(const std::string &filename, uint64_t key);
+	void saveBinary(const std::string &filename, uint64_t key) const;
+	
+	static std::string cacheDir;
+	static int numLoaded;
+	static int numCompiled;
+	static double initSeconds;
+	
+	std::string cacheFile;
+	uint64_t cacheKey;
+	bool compiling;
+	GLuint shaders[3]; // vertex, fragment, geometry until finish()
 	GLuint pid;
 	std::map<std::string,GLint> attributes;
 	std::map<std::string,GLint> uniforms;
@@ -0,0 +1,75 @@
+#include "ProgramBatch.h"
+
+#include "GLSL.h"
+#include "Program.h"
+
+using namespace std;
+
+ProgramBatch::ProgramBatch()
+{
+}
+
+ProgramBatch::~ProgramBatch()
+{
+}
+
+void ProgramBatch::add(shared_ptr<Program> prog, const Callback &onReady, const Callback &onError)
+{
+	Entry e;
+	e.prog = prog;
+	e.onReady = onReady;
+	e.onError = onError;
+	added.push_back(e);
+}
+
+void ProgramBatch::submit()
+{
+	static bool threadsSet = false;
+	if(!threadsSet && Program::isParallelCompileSupported()) {
+		// Let the driver pick the number of threads
+		if(GLEW_KHR_parallel_shader_compile) {
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		} else {
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		}
+		threadsSet = true;
+	}
+	for(size_t i = 0; i < added.size(); i++) {
+		added[i].prog->begin();
+		submitted.push_back(added[i]);
+	}
+	added.clear();
+}
+
+int ProgramBatch::poll()
+{
+	vector<Entry> waiting;
+	for(size_t i = 0; i < submitted.size(); i++) {
+		if(submitted[i].prog->isReady()) {
+			complete(submitted[i]);
+		} else {
+			waiting.push_back(submitted[i]);
+		}
+	}
+	submitted.swap(waiting);
+	return (int)submitted.size();
+}
+
+void ProgramBatch::finish()
+{
+	for(size_t i = 0; i < submitted.size(); i++) {
+		complete(submitted[i]);
+	}
+	submitted.clear();
+}
+
+void ProgramBatch::complete(const Entry &entry)
+{
+	if(entry.prog->finish()) {
+		if(entry.onReady) {
+			entry.onReady(entry.prog);
+		}
+	} else if(entry.onError) {
+		entry.onError(entry.prog);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef PROGRAM_BATCH_H
+#define PROGRAM_BATCH_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+class Program;
+
+/**
+ * Compiles a group of Programs together. submit() starts every program
+ * without waiting for any of them, so with GL_KHR_parallel_shader_compile
+ * the driver compiles them on its own threads while the caller loads the
+ * rest of the scene. poll() completes the programs that are done, and
+ * finish() waits for the others. Without the extension the programs are
+ * still submitted up front, and the driver finishes each one when it is
+ * first queried.
+ *
+ * onReady is where the attributes and uniforms are registered. onError
+ * runs after a failed compile or link, which is reported as verbosely as
+ * Program::init() does.
+ */
+class ProgramBatch
+{
+public:
+	typedef std::function<void(std::shared_ptr<Program>)> Callback;
+
+	ProgramBatch();
+	virtual ~ProgramBatch();
+	void add(std::shared_ptr<Program> prog, const Callback &onReady, const Callback &onError = Callback());
+	// Starts compiling the programs added since the last submit()
+	void submit();
+	// Completes the programs that are ready and returns how many are left
+	int poll();
+	// Waits for the remaining programs
+	void finish();
+
+private:
+	struct Entry
+	{
+		std::shared_ptr<Program> prog;
+		Callback onReady;
+		Callback onError;
+	};
+
+	void complete(const Entry &entry);
+
+	std::vector<Entry> added;
+	std::vector<Entry> submitted;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "RenderNode.h"
+
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLSL.h"
+
+using namespace std;
+
+RenderNode::RenderNode() :
+	fd(-1)
+{
+	memset(static_cast<void *>(&request), 0, sizeof(request));
+}
+
+RenderNode::~RenderNode()
+{
+#ifndef _WIN32
+	if(fd >= 0) {
+		close(fd);
+	}
+#endif
+}
+
+bool RenderNode::isSupported()
+{
+#ifdef _WIN32
+	return false;
+#else
+	return true;
+#endif
+}
+
+bool RenderNode::connect(const string &address)
+{
+#ifdef _WIN32
+	cerr << "Render nodes are not supported on Windows" << endl;
+	return false;
+#else
+	size_t colon = address.rfind(':');
+	if(colon == string::npos) {
+		cerr << "Expected HOST:PORT, got " << address << endl;
+		return false;
+	}
+	string host = address.substr(0, colon);
+	string port = address.substr(colon + 1);
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *addresses = 0;
+	if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+		cerr << "Could not resolve " << address << endl;
+		return false;
+	}
+	for(addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if(fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if(fd < 0) {
+		cerr << "Could not connect to " << address << endl;
+		return false;
+	}
+	// The replies are large, the requests small and latency bound
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	// A coordinator that quits shows up as a failed send instead
+	signal(SIGPIPE, SIG_IGN);
+	return true;
+#endif
+}
+
+bool RenderNode::receive()
+{
+	if(!receiveAll(fd, &request, sizeof(request))) {
+		return false;
+	}
+	received = chrono::steady_clock::now();
+	return true;
+}
+
+bool RenderNode::send()
+{
+	int w = request.regionWidth;
+	int h = request.regionHeight;
+	color.resize((size_t)w * h * 3);
+	GLSL::bindDefaultFramebuffer(GL_READ_FRAMEBUFFER);
+	glReadBuffer(GLSL::getDefaultColorBuffer());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, &color[0]);
+	Reply reply;
+	reply.frame = request.frame;
+	reply.width = w;
+	reply.height = h;
+	reply.hasDepth = request.mode == OBJECTS;
+	if(reply.hasDepth) {
+		depth.resize((size_t)w * h);
+		glReadPixels(0, 0, w, h, GL_DEPTH_COMPONENT, GL_FLOAT, &depth[0]);
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	GLSL::checkError(GET_FILE_LINE);
+	reply.renderMs = chrono::duration<float, milli>(chrono::steady_clock::now() - received).count();
+	return sendAll(fd, &reply, sizeof(reply)) &&
+		sendAll(fd, &color[0], color.size()) &&
+		(!reply.hasDepth || sendAll(fd, &depth[0], depth.size() * sizeof(float)));
+}
+
+float RenderNode::getAspect() const
+{
+	return (float)request.width / (float)request.height;
+}
+
+glm::mat4 RenderNode::getRegionMatrix() const
+{
+	// Scales the region up to [-1, 1] and moves its center to the origin
+	glm::mat4 M(1.0f);
+	M[0][0] = (float)request.width / request.regionWidth;
+	M[1][1] = (float)request.height / request.regionHeight;
+	M[3][0] = (float)(request.width - 2 * request.x - request.regionWidth) / request.regionWidth;
+	M[3][1] = (float)(request.height - 2 * request.y - request.regionHeight) / request.regionHeight;
+	return M;
+}
+
+bool RenderNode::drawsScenery() const
+{
+	return request.mode == TILES || request.node == 0;
+}
+
+bool RenderNode::drawsObject(int index) const
+{
+	return request.mode == TILES || index % request.numNodes == request.node;
+}
+
+bool RenderNode::sendAll(int fd, const void *data, size_t size)
+{
+#ifdef _WIN32
+	return false;
+#else
+	const char *p = (const char *)data;
+	while(size > 0) {
+		ssize_t n = ::send(fd, p, size, 0);
+		if(n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+#endif
+}
+
+bool RenderNode::receiveAll(int fd, void *data, size_t size)
+{
+#ifdef _WIN32
+	return false;
+#else
+	char *p = (char *)data;
+	while(size > 0) {
+		ssize_t n = recv(fd, p, size, 0);
+		if(n <= 0) {
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef RENDER_NODE_H
+#define RENDER_NODE_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/**
+ * One process of a distributed frame (see Compositor). It connects to the
+ * coordinator over TCP and, for each request, renders its share of the
+ * frame off screen and sends the pixels back:
+ *   TILES (sort-first): the node draws the whole scene into its own strip
+ *     of the frame, through a projection narrowed to that strip, so that
+ *     frustum culling drops whatever lies outside of it.
+ *   OBJECTS (sort-last): the node draws the whole frame with every
+ *     numNodes-th object. Node 0 also draws the scenery (ground, sun, HUD
+ *     and static batches). The depth buffer is sent too, for compositing.
+ * Messages are the structs below followed by the pixels, bottom row first.
+ * They are in the host's byte order, so nodes on other hosts must share the
+ * coordinator's.
+ */
+class RenderNode
+{
+public:
+	enum {
+		TILES = 0,
+		OBJECTS
+	};
+
+	struct Request
+	{
+		int frame;
+		int mode;
+		int node;
+		int numNodes;
+		int width; // of the whole frame
+		int height;
+		int x; // this node's region, from the bottom left of the frame
+		int y;
+		int regionWidth;
+		int regionHeight;
+		glm::vec3 position;
+		float yaw; // radians, like FreeLookCamera
+		float pitch;
+		float fovy;
+		double time; // the coordinator's, so that every node animates alike
+	};
+	struct Reply
+	{
+		int frame;
+		int width;
+		int height;
+		int hasDepth; // a float per pixel follows the RGB
+		float renderMs; // from receiving the request to the pixels in memory
+	};
+
+	RenderNode();
+	virtual ~RenderNode();
+	// Connects to the coordinator at HOST:PORT
+	bool connect(const std::string &address);
+	// Waits for the next request. False once the coordinator hangs up.
+	bool receive();
+	const Request &getRequest() const { return request; }
+	// Reads back the default framebuffer and sends it
+	bool send();
+	// The whole frame's aspect ratio, for the projection
+	float getAspect() const;
+	// Maps this node's region of normalized device coordinates to all of it
+	glm::mat4 getRegionMatrix() const;
+	bool drawsScenery() const;
+	bool drawsObject(int index) const;
+	double getTime() const { return request.time; }
+
+	static bool sendAll(int fd, const void *data, size_t size);
+	static bool receiveAll(int fd, void *data, size_t size);
+	static bool isSupported();
+
+private:
+	RenderNode(const RenderNode &);
+	RenderNode &operator=(const RenderNode &);
+
+	int fd;
+	Request request;
+	std::chrono::steady_clock::time_point received;
+	std::vector<unsigned char> color;
+	std::vector<float> depth;
+};
+
+#endif
@@ -0,0 +1,448 @@
+#include "RenderServer.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "stb_image_write.h"
+
+using namespace std;
+
+namespace {
+
+// Latencies kept for the percentiles
+const size_t NUM_LATENCIES = 1024;
+const int MAX_SIZE = 8192;
+// What one client can hold up: a longer request line closes the
+// connection, renders past MAX_QUEUED in flight (MAX_QUEUE over all
+// clients) get an error, and a client with more than MAX_OUTPUT bytes of
+// replies unread isn't read from until it catches up.
+const size_t MAX_LINE = 1024;
+const int MAX_QUEUED = 64;
+const size_t MAX_QUEUE = 1024;
+const size_t MAX_OUTPUT = 64 << 20;
+
+float radians(float degrees)
+{
+	return degrees * (float)M_PI / 180.0f;
+}
+
+void appendPNG(void *context, void *data, int size)
+{
+	vector<unsigned char> *png = (vector<unsigned char> *)context;
+	png->insert(png->end(), (unsigned char *)data, (unsigned char *)data + size);
+}
+
+#ifndef _WIN32
+bool setNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+#endif
+
+}
+
+RenderServer::RenderServer() :
+	listenFD(-1),
+	stopping(false),
+	nextFrame(0),
+	latencies(NUM_LATENCIES),
+	numLatencies(0),
+	numCompleted(0),
+	totalCompleted(0),
+	statsStart(chrono::steady_clock::now()),
+	serverStart(statsStart)
+{
+	wakeFDs[0] = wakeFDs[1] = -1;
+	// GL's rows go bottom to top
+	stbi_flip_vertically_on_write(true);
+}
+
+RenderServer::~RenderServer()
+{
+#ifndef _WIN32
+	if(server.joinable()) {
+		stopping = true;
+		char c = 0;
+		if(::write(wakeFDs[1], &c, 1) == 1) {
+			server.join();
+		} else {
+			server.detach();
+		}
+	}
+	if(listenFD >= 0) {
+		close(listenFD);
+		unlink(path.c_str());
+	}
+	for(int i = 0; i < 2; i++) {
+		if(wakeFDs[i] >= 0) {
+			close(wakeFDs[i]);
+		}
+	}
+#endif
+}
+
+RenderServer::Connection::Connection(int fd) :
+	fd(fd),
+	numQueued(0),
+	outputSent(0),
+	outputSize(0),
+	closed(false)
+{
+}
+
+// Closed once the last request that holds it is answered
+RenderServer::Connection::~Connection()
+{
+#ifndef _WIN32
+	close(fd);
+#endif
+}
+
+bool RenderServer::isSupported()
+{
+#ifdef _WIN32
+	return false;
+#else
+	return true;
+#endif
+}
+
+bool RenderServer::start(const string &path)
+{
+#ifdef _WIN32
+	cerr << "The render server needs Unix domain sockets" << endl;
+	return false;
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)) {
+		cerr << "Socket path " << path << " is too long" << endl;
+		return false;
+	}
+	strcpy(address.sun_path, path.c_str());
+	listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listenFD < 0) {
+		cerr << "Could not create a socket" << endl;
+		return false;
+	}
+	unlink(path.c_str());
+	if(bind(listenFD, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenFD, 16) != 0) {
+		cerr << "Could not listen on " << path << endl;
+		close(listenFD);
+		listenFD = -1;
+		return false;
+	}
+	// Replies wake the server thread, and must not block if it is behind
+	if(pipe(wakeFDs) != 0 || !setNonBlocking(wakeFDs[0]) || !setNonBlocking(wakeFDs[1])) {
+		cerr << "Could not create a pipe" << endl;
+		return false;
+	}
+	this->path = path;
+	// A client that hangs up shows up as a failed send instead
+	signal(SIGPIPE, SIG_IGN);
+	server = thread(&RenderServer::serverLoop, this);
+	cout << "Serving renders on " << path << endl;
+	return true;
+#endif
+}
+
+void RenderServer::serverLoop()
+{
+#ifndef _WIN32
+	vector< shared_ptr<Connection> > connections;
+	for(;;) {
+		vector<pollfd> fds(2 + connections.size());
+		fds[0].fd = wakeFDs[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = listenFD;
+		fds[1].events = POLLIN;
+		for(size_t i = 0; i < connections.size(); i++) {
+			Connection &c = *connections[i];
+			lock_guard<mutex> lock(c.outputMutex);
+			fds[2 + i].fd = c.fd;
+			fds[2 + i].events = (c.outputSize < MAX_OUTPUT ? POLLIN : 0) | (c.output.empty() ? 0 : POLLOUT);
+		}
+		for(size_t i = 0; i < fds.size(); i++) {
+			fds[i].revents = 0;
+		}
+		if(poll(&fds[0], fds.size(), -1) < 0) {
+			continue;
+		}
+		if(fds[0].revents) {
+			char buffer[256];
+			while(read(wakeFDs[0], buffer, sizeof(buffer)) > 0) {
+			}
+			if(stopping) {
+				break;
+			}
+		}
+		if(fds[1].revents & POLLIN) {
+			int fd = accept(listenFD, 0, 0);
+			if(fd >= 0 && setNonBlocking(fd)) {
+				connections.push_back(make_shared<Connection>(fd));
+			} else if(fd >= 0) {
+				close(fd);
+			}
+		}
+		// Newest first, so a closed one can be removed in place
+		for(size_t i = fds.size() - 1; i >= 2; i--) {
+			if(!fds[i].revents) {
+				continue;
+			}
+			shared_ptr<Connection> c = connections[i - 2];
+			bool ok = !(fds[i].revents & POLLOUT) || flush(*c);
+			if(ok && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				ok = receive(c);
+			}
+			if(!ok) {
+				// Replies still on the way are dropped
+				drop(*c);
+				connections.erase(connections.begin() + (i - 2));
+			}
+		}
+	}
+	for(size_t i = 0; i < connections.size(); i++) {
+		drop(*connections[i]);
+	}
+#endif
+}
+
+bool RenderServer::receive(shared_ptr<Connection> c)
+{
+#ifndef _WIN32
+	char buffer[4096];
+	ssize_t n = read(c->fd, buffer, sizeof(buffer));
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return true;
+	}
+	if(n <= 0) {
+		return false;
+	}
+	c->input.append(buffer, n);
+	size_t start = 0;
+	size_t end;
+	while((end = c->input.find('\n', start)) != string::npos) {
+		handleLine(c, c->input.substr(start, end - start));
+		start = end + 1;
+	}
+	c->input.erase(0, start);
+	return c->input.size() <= MAX_LINE;
+#else
+	return false;
+#endif
+}
+
+bool RenderServer::flush(Connection &c)
+{
+#ifndef _WIN32
+	lock_guard<mutex> lock(c.outputMutex);
+	while(!c.output.empty()) {
+		const string &front = c.output.front();
+		ssize_t n = send(c.fd, front.data() + c.outputSent, front.size() - c.outputSent, 0);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			return true;
+		}
+		if(n <= 0) {
+			return false;
+		}
+		c.outputSent += n;
+		if(c.outputSent == front.size()) {
+			c.outputSize -= front.size();
+			c.outputSent = 0;
+			c.output.pop_front();
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void RenderServer::drop(Connection &c)
+{
+#ifndef _WIN32
+	lock_guard<mutex> lock(c.outputMutex);
+	c.closed = true;
+	c.output.clear();
+	c.outputSent = 0;
+	c.outputSize = 0;
+	shutdown(c.fd, SHUT_RDWR);
+#endif
+}
+
+void RenderServer::handleLine(shared_ptr<Connection> c, const string &line)
+{
+	istringstream fields(line);
+	string command;
+	fields >> command;
+	if(command == "stats") {
+		string stats = getStats(true) + "\n";
+		reply(*c, stats, 0, 0);
+		return;
+	}
+	string id;
+	fields >> id;
+	if(command != "render") {
+		reply(*c, "error " + id + " unknown request " + command + "\n", 0, 0);
+		return;
+	}
+	Request r;
+	float yaw, pitch, fov;
+	string format;
+	if(!(fields >> r.position.x >> r.position.y >> r.position.z >> yaw >> pitch >> fov >> r.width >> r.height >> format)) {
+		reply(*c, "error " + id + " expected render ID x y z yaw pitch fov width height png|rgb\n", 0, 0);
+		return;
+	}
+	if(r.width < 1 || r.height < 1 || r.width > MAX_SIZE || r.height > MAX_SIZE || (format != "png" && format != "rgb")) {
+		reply(*c, "error " + id + " bad size or format\n", 0, 0);
+		return;
+	}
+	r.yaw = radians(yaw);
+	r.pitch = radians(pitch);
+	r.fovy = radians(fov);
+	Pending p;
+	p.connection = c;
+	p.id = id;
+	p.png = format == "png";
+	p.received = chrono::steady_clock::now();
+	const char *refused = 0;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if(c->numQueued >= MAX_QUEUED) {
+			refused = " too many renders in flight\n";
+		} else if(queue.size() >= MAX_QUEUE) {
+			refused = " server busy\n";
+		} else {
+			c->numQueued++;
+			r.frame = nextFrame++;
+			pending[r.frame] = p;
+			queue.push_back(r);
+		}
+	}
+	if(refused) {
+		reply(*c, "error " + id + refused, 0, 0);
+		return;
+	}
+	queued.notify_one();
+}
+
+vector<RenderServer::Request> RenderServer::takeBatch(int maxBatch, int timeout)
+{
+	vector<Request> batch;
+	unique_lock<mutex> lock(queueMutex);
+	queued.wait_for(lock, chrono::milliseconds(timeout), [this]() { return !queue.empty(); });
+	if(queue.empty()) {
+		return batch;
+	}
+	batch.push_back(queue.front());
+	queue.pop_front();
+	// Later requests of the same size join it, the others keep their place
+	for(deque<Request>::iterator it = queue.begin(); it != queue.end() && (int)batch.size() < maxBatch; ) {
+		if(it->width == batch[0].width && it->height == batch[0].height) {
+			batch.push_back(*it);
+			it = queue.erase(it);
+		} else {
+			++it;
+		}
+	}
+	return batch;
+}
+
+bool RenderServer::write(int frame, const unsigned char *rgb, int width, int height, int stride)
+{
+	Pending p;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		map<int, Pending>::iterator it = pending.find(frame);
+		if(it == pending.end()) {
+			return false;
+		}
+		p = it->second;
+		p.connection->numQueued--;
+		pending.erase(it);
+	}
+	vector<unsigned char> data;
+	if(p.png) {
+		if(!stbi_write_png_to_func(appendPNG, &data, width, height, 3, rgb, stride)) {
+			reply(*p.connection, "error " + p.id + " could not encode the PNG\n", 0, 0);
+			return false;
+		}
+	} else {
+		data.resize((size_t)width * height * 3);
+		for(int y = 0; y < height; y++) {
+			memcpy(&data[(size_t)y * width * 3], rgb + (size_t)(height - 1 - y) * stride, (size_t)width * 3);
+		}
+	}
+	ostringstream header;
+	header << "ok " << p.id << " " << width << " " << height << " " << (p.png ? "png" : "rgb") << " " << data.size() << "\n";
+	reply(*p.connection, header.str(), &data[0], data.size());
+	double latency = chrono::duration<double, milli>(chrono::steady_clock::now() - p.received).count();
+	lock_guard<mutex> lock(queueMutex);
+	latencies[numLatencies++ % NUM_LATENCIES] = latency;
+	numCompleted++;
+	totalCompleted++;
+	return true;
+}
+
+void RenderServer::reply(Connection &c, const string &header, const unsigned char *data, size_t size)
+{
+#ifndef _WIN32
+	{
+		// Whole replies, as the encoder threads may answer the same client
+		lock_guard<mutex> lock(c.outputMutex);
+		if(c.closed) {
+			return;
+		}
+		c.output.push_back(header);
+		if(size > 0) {
+			c.output.back().append((const char *)data, size);
+		}
+		c.outputSize += c.output.back().size();
+	}
+	// A full pipe already has the server thread on its way
+	char w = 1;
+	if(::write(wakeFDs[1], &w, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		cerr << "Could not wake the render server" << endl;
+	}
+#endif
+}
+
+string RenderServer::getStats(bool sinceStart)
+{
+	lock_guard<mutex> lock(queueMutex);
+	vector<double> sorted(latencies.begin(), latencies.begin() + min(numLatencies, NUM_LATENCIES));
+	sort(sorted.begin(), sorted.end());
+	double p50 = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+	double p99 = sorted.empty() ? 0.0 : sorted[min(sorted.size() - 1, sorted.size() * 99 / 100)];
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - (sinceStart ? serverStart : statsStart)).count();
+	int completed = sinceStart ? totalCompleted : numCompleted;
+	ostringstream stats;
+	stats << "stats queue " << queue.size() << " p50 " << p50 << " ms p99 " << p99 << " ms " << completed << " requests " << completed / seconds << " requests/s";
+	return stats.str();
+}
+
+void RenderServer::printStats()
+{
+	// Quiet while idle
+	if(numCompleted > 0) {
+		cout << "Render server: " << getStats(false).substr(6) << endl;
+	}
+	lock_guard<mutex> lock(queueMutex);
+	numCompleted = 0;
+	statsStart = chrono::steady_clock::now();
+}
@@ -0,0 +1,127 @@
+#pragma once
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "FrameSink.h"
+
+/**
+ * Renders views of the resident scene for other processes. Clients
+ * connect to a Unix domain socket and send one request per line:
+ *   render ID x y z yaw pitch fov width height png|rgb
+ *   stats
+ * The angles are in degrees and ID is any word the client chooses. A
+ * render gets back
+ *   ok ID width height png|rgb bytes\n
+ * followed by the image: a PNG file, or RGB rows from top to bottom. A
+ * stats request gets back one line with the queue depth, the p50 and p99
+ * latency and the throughput since the server started. Errors come back as "error ID message".
+ *
+ * A thread accepts connections and queues the requests. The GL thread
+ * takes them with takeBatch(), which groups requests of the same size so
+ * that a batch is rendered back to back at one framebuffer size. The frames
+ * go through a FrameCapture with this as its sink, so write() encodes the
+ * responses on the encoder threads. They are queued on the connection and
+ * sent by the server thread as the socket takes them, so a slow client
+ * only holds up itself. A client gets an error for renders past a limit in
+ * flight, isn't read from while too many reply bytes wait for it, and is
+ * disconnected if a line gets too long.
+ */
+class RenderServer : public FrameSink
+{
+public:
+	struct Request
+	{
+		int frame; // the FrameCapture frame number that identifies it
+		int width;
+		int height;
+		glm::vec3 position;
+		float yaw; // radians, like FreeLookCamera
+		float pitch;
+		float fovy;
+	};
+
+	RenderServer();
+	virtual ~RenderServer();
+	// Listens on the socket at path, replacing a stale one
+	bool start(const std::string &path);
+	// Waits up to timeout ms for a request. Returns the oldest one and the
+	// queued requests of the same size after it, up to maxBatch.
+	std::vector<Request> takeBatch(int maxBatch, int timeout);
+	// Queue depth, latency percentiles and requests per second since the
+	// last call. Prints nothing if no request was completed.
+	void printStats();
+	bool write(int frame, const unsigned char *rgb, int width, int height, int stride);
+	bool isStream() const { return false; }
+	static bool isSupported();
+
+private:
+	RenderServer(const RenderServer &);
+	RenderServer &operator=(const RenderServer &);
+
+	struct Connection
+	{
+		Connection(int fd);
+		~Connection();
+		int fd;
+		std::string input;              // received, not yet a whole line
+		int numQueued;                  // renders not answered yet, guarded by queueMutex
+		std::mutex outputMutex;         // guards the rest
+		std::deque<std::string> output; // replies not sent yet
+		size_t outputSent;              // of output.front()
+		size_t outputSize;              // in output, sent or not
+		bool closed;
+	};
+	struct Pending
+	{
+		std::shared_ptr<Connection> connection;
+		std::string id;
+		bool png;
+		std::chrono::steady_clock::time_point received;
+	};
+
+	void serverLoop();
+	// Reads what the client sent. False if it hung up or broke a limit.
+	bool receive(std::shared_ptr<Connection> c);
+	// Sends what the socket takes. False if the client is gone.
+	bool flush(Connection &c);
+	void drop(Connection &c);
+	void handleLine(std::shared_ptr<Connection> c, const std::string &line);
+	// Queues the reply for the server thread to send
+	void reply(Connection &c, const std::string &header, const unsigned char *data, size_t size);
+	// Throughput since the last printStats() or since start
+	std::string getStats(bool sinceStart);
+
+	std::string path;
+	int listenFD;
+	int wakeFDs[2]; // a pipe that wakes serverLoop() for replies and to stop
+	std::atomic<bool> stopping;
+	std::thread server;
+
+	std::mutex queueMutex; // guards everything below
+	std::condition_variable queued;
+	std::deque<Request> queue;
+	std::map<int, Pending> pending;
+	int nextFrame;
+	std::vector<double> latencies; // ms, the last ones in a ring
+	size_t numLatencies;
+	int numCompleted; // since the last printStats()
+	int totalCompleted;
+	std::chrono::steady_clock::time_point statsStart;
+	std::chrono::steady_clock::time_point serverStart;
+};
+
+#endif
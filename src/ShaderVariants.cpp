@@ -0,0 +1,98 @@
+#include "ShaderVariants.h"
+
+#include <iostream>
+
+#include "Program.h"
+#include "ProgramBatch.h"
+
+using namespace std;
+
+namespace {
+
+const char *FEATURE_NAMES[ShaderVariants::NUM_FEATURES] = {
+	"HAS_TEXTURE", "HAS_DIFFUSE", "HAS_SPECULAR", "NUM_LIGHTS", "CEL_SHADING", "INSTANCED", "VIRTUAL_TEXTURE"
+};
+
+}
+
+ShaderVariants::ShaderVariants()
+{
+}
+
+ShaderVariants::~ShaderVariants()
+{
+}
+
+void ShaderVariants::setShaderNames(const string &v, const string &f)
+{
+	vShaderName = v;
+	fShaderName = f;
+	variants.clear();
+}
+
+void ShaderVariants::add(ProgramBatch &batch, unsigned mask)
+{
+	if(variants.find(mask) != variants.end()) {
+		return;
+	}
+	// Cached right away, so that the batch is what finishes it
+	variants[mask] = create(mask);
+	batch.add(variants[mask], [this](shared_ptr<Program> prog) {
+		if(setup) {
+			setup(prog);
+		}
+		prog->setVerbose(false);
+	}, [this, mask](shared_ptr<Program>) {
+		cerr << "Shader variant 0x" << hex << mask << dec << " failed to compile" << endl;
+		variants[mask].reset();
+	});
+}
+
+shared_ptr<Program> ShaderVariants::get(unsigned mask)
+{
+	map< unsigned, shared_ptr<Program> >::iterator it = variants.find(mask);
+	if(it != variants.end()) {
+		return it->second;
+	}
+	shared_ptr<Program> prog = create(mask);
+	if(prog->init()) {
+		if(setup) {
+			setup(prog);
+		}
+		prog->setVerbose(false);
+	} else {
+		cerr << "Shader variant 0x" << hex << mask << dec << " failed to compile" << endl;
+		prog.reset();
+	}
+	// Failures are cached too, so that they are only reported once
+	variants[mask] = prog;
+	return prog;
+}
+
+shared_ptr<Program> ShaderVariants::create(unsigned mask) const
+{
+	shared_ptr<Program> prog = make_shared<Program>();
+	prog->setShaderNames(vShaderName, fShaderName);
+	for(int i = 0; i < NUM_FEATURES; i++) {
+		bool on = (mask & (1u << i)) != 0;
+		// TWO_LIGHTS is a count in the shader
+		prog->addDefine(FEATURE_NAMES[i], (1u << i) == TWO_LIGHTS ? (on ? 2 : 1) : (on ? 1 : 0));
+	}
+	prog->setVerbose(true);
+	return prog;
+}
+
+unsigned ShaderVariants::select(const glm::vec3 &kd, const glm::vec3 &ks, bool textured)
+{
+	unsigned mask = 0;
+	if(textured) {
+		mask |= HAS_TEXTURE;
+	}
+	if(kd != glm::vec3(0.0f)) {
+		mask |= HAS_DIFFUSE;
+	}
+	if(ks != glm::vec3(0.0f)) {
+		mask |= HAS_SPECULAR;
+	}
+	return mask;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <functional>
+
+#include <glm/glm.hpp>
+
+class Program;
+class ProgramBatch;
+
+/**
+ * Compiles specialized versions of one vertex/fragment shader pair. Each
+ * feature bit becomes a #define (1 if set, 0 if not) in front of the
+ * sources, so a variant without a feature has none of its code. The
+ * exception is TWO_LIGHTS, which is defined as NUM_LIGHTS, 2 if set and 1
+ * if not; shaders test #if NUM_LIGHTS > 1, never TWO_LIGHTS. Variants
+ * known up front are compiled with a ProgramBatch through add(); any other
+ * is compiled the first time get() asks for it. Either way they are cached
+ * by mask. The setup function registers the attributes and uniforms of
+ * each new Program.
+ */
+class ShaderVariants
+{
+public:
+	enum Feature {
+		HAS_TEXTURE     = 1 << 0,
+		HAS_DIFFUSE     = 1 << 1,
+		HAS_SPECULAR    = 1 << 2,
+		TWO_LIGHTS      = 1 << 3,
+		CEL_SHADING     = 1 << 4,
+		INSTANCED       = 1 << 5,
+		VIRTUAL_TEXTURE = 1 << 6,
+		NUM_FEATURES    = 7
+	};
+
+	ShaderVariants();
+	virtual ~ShaderVariants();
+	void setShaderNames(const std::string &v, const std::string &f);
+	void setSetup(const std::function<void(std::shared_ptr<Program>)> &setup) { this->setup = setup; }
+	// Adds the variant for the mask to the batch, unless it is known already
+	void add(ProgramBatch &batch, unsigned mask);
+	// Returns the variant for the mask, or null if it failed to compile
+	std::shared_ptr<Program> get(unsigned mask);
+	int getNumCompiled() const { return (int)variants.size(); }
+	// The cheapest mask that gives the same color as the full shader. Terms
+	// that are zero for the material are left out.
+	static unsigned select(const glm::vec3 &kd, const glm::vec3 &ks, bool textured);
+
+private:
+	std::shared_ptr<Program> create(unsigned mask) const;
+
+	std::string vShaderName;
+	std::string fShaderName;
+	std::function<void(std::shared_ptr<Program>)> setup;
+	std::map< unsigned, std::shared_ptr<Program> > variants;
+};
+
+#endif
@@ -81,6 +81,8 @@ void Shape::loadMesh(const string &meshName)
 		vmax.z = max(vmax.z, v.z);
 	}
 	minY = vmin.y;
+	bmin = vmin;
+	bmax = vmax;
 	//std::cout << vmin.y << std::endl;
 }
 
@@ -138,7 +140,7 @@ void Shape::init()
 	GLSL::checkError(GET_FILE_LINE);
 }
 
-void Shape::draw(const shared_ptr<Program> prog) const
+void Shape::draw(const shared_ptr<Program> prog, int instances) const
 {
 	// Bind position buffer
 	int h_pos = prog->getAttribute("aPos");
@@ -164,7 +166,12 @@ void Shape::draw(const shared_ptr<Program> prog) const
 	
 	// Draw
 	int count = posBuf.size()/3; // number of indices to be rendered
-	glDrawArrays(GL_TRIANGLES, 0, count);
+	if(instances > 0) {
+		glDrawArraysInstanced(GL_TRIANGLES, 0, count, instances);
+	} else {
+		glDrawArrays(GL_TRIANGLES, 0, count);
+	}
+	GLSL::countDraw(count, max(instances, 1));
 	
 	// Disable and unbind
 	if(h_tex != -1) {
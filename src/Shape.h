@@ -6,6 +6,9 @@
 #include <vector>
 #include <memory>
 
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
 class Program;
 
 /**
@@ -23,8 +26,14 @@ public:
 	void loadMesh(const std::string &meshName);
 	void fitToUnitBox();
 	void init();
-	void draw(const std::shared_ptr<Program> prog) const;
+	// Draws instances copies with glDrawArraysInstanced if instances > 0
+	void draw(const std::shared_ptr<Program> prog, int instances = 0) const;
 	float getMinY();
+	const glm::vec3 &getBoundsMin() const { return bmin; }
+	const glm::vec3 &getBoundsMax() const { return bmax; }
+	const std::vector<float> &getPosBuf() const { return posBuf; }
+	const std::vector<float> &getNorBuf() const { return norBuf; }
+	const std::vector<float> &getTexBuf() const { return texBuf; }
 	
 private:
 	std::vector<float> posBuf;
@@ -34,6 +43,8 @@ private:
 	unsigned norBufID;
 	unsigned texBufID;
 	float minY;
+	glm::vec3 bmin;
+	glm::vec3 bmax;
 };
 
 #endif
@@ -0,0 +1,156 @@
+#include "StaticBatcher.h"
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <utility>
+
+#include "GLSL.h"
+#include "Program.h"
+#include "Object.h"
+#include "Frustum.h"
+
+using namespace std;
+
+StaticBatcher::StaticBatcher() :
+	cellSize(5.0f),
+	bytes(0)
+{
+}
+
+StaticBatcher::~StaticBatcher()
+{
+	clear();
+}
+
+void StaticBatcher::clear()
+{
+	for(size_t i = 0; i < batches.size(); i++) {
+		glDeleteBuffers(1, &batches[i].posBufID);
+		glDeleteBuffers(1, &batches[i].norBufID);
+		glDeleteBuffers(1, &batches[i].kdBufID);
+	}
+	batches.clear();
+	bytes = 0;
+}
+
+bool StaticBatcher::update(const vector<Object*> &objects)
+{
+	vector<int> statics;
+	for(int i = 0; i < (int)objects.size(); i++) {
+		if(objects[i]->getStatic()) {
+			statics.push_back(i);
+		}
+	}
+	if(statics == members) {
+		return false;
+	}
+	members = statics;
+	clear();
+
+	// Group by cell, then merge each group's meshes in world space
+	map< pair<int,int>, vector<int> > cells;
+	for(size_t k = 0; k < members.size(); k++) {
+		glm::vec3 t = objects[members[k]]->getTranslation();
+		pair<int,int> key((int)floor(t.x / cellSize), (int)floor(t.z / cellSize));
+		cells[key].push_back(members[k]);
+	}
+	for(map< pair<int,int>, vector<int> >::iterator it = cells.begin(); it != cells.end(); ++it) {
+		vector<float> posBuf;
+		vector<float> norBuf;
+		vector<float> kdBuf;
+		for(size_t k = 0; k < it->second.size(); k++) {
+			Object *obj = objects[it->second[k]];
+			const vector<float> &pos = obj->getShape()->getPosBuf();
+			const vector<float> &nor = obj->getShape()->getNorBuf();
+			glm::vec3 T = obj->getTranslation();
+			glm::vec3 S = obj->getScale();
+			glm::vec3 kd = obj->getColor();
+			for(size_t v = 0; v + 2 < pos.size(); v += 3) {
+				glm::vec3 p = T + S * glm::vec3(pos[v], pos[v+1], pos[v+2]);
+				// Inverse transpose of a scale is the reciprocal scale
+				glm::vec3 n(0.0f, 0.0f, 0.0f);
+				if(!nor.empty()) {
+					n = glm::normalize(glm::vec3(nor[v], nor[v+1], nor[v+2]) / S);
+				}
+				for(int c = 0; c < 3; c++) {
+					posBuf.push_back(p[c]);
+					norBuf.push_back(n[c]);
+					kdBuf.push_back(kd[c]);
+				}
+			}
+		}
+		if(posBuf.empty()) {
+			continue;
+		}
+
+		Batch b;
+		glm::vec3 bmin(posBuf[0], posBuf[1], posBuf[2]);
+		glm::vec3 bmax = bmin;
+		for(size_t v = 0; v < posBuf.size(); v += 3) {
+			glm::vec3 p(posBuf[v], posBuf[v+1], posBuf[v+2]);
+			bmin = glm::min(bmin, p);
+			bmax = glm::max(bmax, p);
+		}
+		b.center = 0.5f * (bmin + bmax);
+		b.radius = glm::length(0.5f * (bmax - bmin));
+		b.count = (int)posBuf.size() / 3;
+
+		glGenBuffers(1, &b.posBufID);
+		glBindBuffer(GL_ARRAY_BUFFER, b.posBufID);
+		glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &b.norBufID);
+		glBindBuffer(GL_ARRAY_BUFFER, b.norBufID);
+		glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &b.kdBufID);
+		glBindBuffer(GL_ARRAY_BUFFER, b.kdBufID);
+		glBufferData(GL_ARRAY_BUFFER, kdBuf.size()*sizeof(float), &kdBuf[0], GL_STATIC_DRAW);
+		bytes += (posBuf.size() + norBuf.size() + kdBuf.size()) * sizeof(float);
+		batches.push_back(b);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+
+	cout << "Static batches: " << members.size() << " objects in " << batches.size() << " draws ("
+		<< (int)members.size() - (int)batches.size() << " fewer draw calls), "
+		<< bytes / 1024 << " KB of extra vertex data" << endl;
+	return true;
+}
+
+void StaticBatcher::draw(const shared_ptr<Program> prog, const Frustum *frustum) const
+{
+	int h_pos = prog->getAttribute("aPos");
+	int h_nor = prog->getAttribute("aNor");
+	int h_kd = prog->getAttribute("aKd");
+	for(size_t i = 0; i < batches.size(); i++) {
+		const Batch &b = batches[i];
+		if(frustum && !frustum->testSphere(b.center, b.radius)) {
+			continue;
+		}
+		glEnableVertexAttribArray(h_pos);
+		glBindBuffer(GL_ARRAY_BUFFER, b.posBufID);
+		glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+		if(h_nor != -1) {
+			glEnableVertexAttribArray(h_nor);
+			glBindBuffer(GL_ARRAY_BUFFER, b.norBufID);
+			glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+		}
+		if(h_kd != -1) {
+			glEnableVertexAttribArray(h_kd);
+			glBindBuffer(GL_ARRAY_BUFFER, b.kdBufID);
+			glVertexAttribPointer(h_kd, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+		}
+		glDrawArrays(GL_TRIANGLES, 0, b.count);
+		GLSL::countDraw(b.count);
+	}
+	if(h_kd != -1) {
+		glDisableVertexAttribArray(h_kd);
+	}
+	if(h_nor != -1) {
+		glDisableVertexAttribArray(h_nor);
+	}
+	glDisableVertexAttribArray(h_pos);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GLSL::checkError(GET_FILE_LINE);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef STATIC_BATCHER_H
+#define STATIC_BATCHER_H
+
+#include <vector>
+#include <memory>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+class Object;
+class Program;
+class Frustum;
+
+/**
+ * Merges the meshes of static Objects into one set of vertex buffers per
+ * spatial cell of the ground plane, so that each cell costs a single draw.
+ * Vertices are pre-transformed to world space, and the per-object diffuse
+ * color becomes a vertex attribute (aKd) so that differently colored
+ * objects can share a batch. Objects that are not static are left to the
+ * usual per-object path.
+ */
+class StaticBatcher
+{
+public:
+	StaticBatcher();
+	virtual ~StaticBatcher();
+	void setCellSize(float s) { cellSize = s; }
+	// Rebuilds the batches only if the set of static objects changed.
+	// Returns true if it did.
+	bool update(const std::vector<Object*> &objects);
+	// Draws every batch that touches the frustum (all of them if null)
+	void draw(const std::shared_ptr<Program> prog, const Frustum *frustum = 0) const;
+	int getNumBatches() const { return (int)batches.size(); }
+	int getNumObjects() const { return (int)members.size(); }
+	size_t getMemoryBytes() const { return bytes; }
+
+private:
+	struct Batch
+	{
+		glm::vec3 center;
+		float radius;
+		unsigned posBufID;
+		unsigned norBufID;
+		unsigned kdBufID;
+		int count;
+	};
+
+	void clear();
+
+	float cellSize;
+	std::vector<int> members; // indices of the batched objects
+	std::vector<Batch> batches;
+	size_t bytes;
+};
+
+#endif
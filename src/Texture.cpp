@@ -1,6 +1,7 @@
 #include "Texture.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <chrono>
 #include <iostream>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -19,8 +20,43 @@ Texture::~Texture()
 	
 }
 
+bool Texture::isCompressionSupported()
+{
+	return GLEW_EXT_texture_compression_s3tc;
+}
+
+size_t Texture::getBoundMemory()
+{
+	size_t total = 0;
+	for(int level = 0; ; level++) {
+		GLint w = 0, h = 0, compressed = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &w);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &h);
+		if(w == 0 || h == 0) {
+			break;
+		}
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+		if(compressed) {
+			GLint size = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			total += size;
+		} else {
+			GLint bits = 0, r = 0, g = 0, b = 0, a = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_RED_SIZE, &r);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_GREEN_SIZE, &g);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_BLUE_SIZE, &b);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_ALPHA_SIZE, &a);
+			bits = r + g + b + a;
+			total += (size_t)w * h * bits / 8;
+		}
+	}
+	return total;
+}
+
 void Texture::init()
 {
+	auto t0 = chrono::steady_clock::now();
+	
 	// Load texture
 	int w, h, ncomps;
 	stbi_set_flip_vertically_on_load(true);
@@ -52,10 +88,14 @@ void Texture::init()
 	// Set filtering mode for magnification and minimification
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	size_t memory = getBoundMemory();
 	// Unbind
 	glBindTexture(GL_TEXTURE_2D, 0);
 	// Free image, since the data is now on the GPU
 	stbi_image_free(data);
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	cout << filename << ": uncompressed, " << width << "x" << height << " with mipmaps, "
+		<< memory / 1024 << " KB, " << ms << " ms" << endl;
 }
 
 void Texture::setWrapModes(GLint wrapS, GLint wrapT)
@@ -7,6 +7,11 @@
 
 #include <string>
 
+/**
+ * A 2D texture loaded with stb_image. init() prints the load time and the
+ * texture memory. BC1 textures go through TextureRegistry instead, which
+ * asks isCompressionSupported() whether the driver has S3TC.
+ */
 class Texture
 {
 public:
@@ -19,8 +24,12 @@ public:
 	void bind(GLint handle);
 	void unbind();
 	void setWrapModes(GLint wrapS, GLint wrapT); // Must be called after init()
+	static bool isCompressionSupported();
 	
 private:
+	// Bytes used by all levels of the bound texture, as reported by GL
+	static size_t getBoundMemory();
+
 	std::string filename;
 	int width;
 	int height;
@@ -0,0 +1,354 @@
+#include "TextureRegistry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "stb_image.h"
+
+#include "CompressedImage.h"
+#include "GLSL.h"
+#include "MappedFile.h"
+#include "Texture.h"
+#include "TextureUploader.h"
+
+using namespace std;
+
+namespace {
+
+// "dir/grass2.jpg" -> "grass2"
+string getBaseName(const string &filename)
+{
+	size_t slash = filename.find_last_of("/\\");
+	string name = filename.substr(slash == string::npos ? 0 : slash + 1);
+	return name.substr(0, name.find_last_of('.'));
+}
+
+// Reads a layer from the BC1 cache, or decodes the image and either
+// refreshes the cache or builds an RGBA mip chain. Runs on worker threads.
+bool loadImage(const string &filename, uint64_t hash, const string &cacheFile, bool compress, TextureUploader::Image &image)
+{
+	image.compressed = compress;
+	if(!compress || !image.blocks.load(cacheFile, hash)) {
+		MappedFile file;
+		if(!file.open(filename)) {
+			return false;
+		}
+		int w, h, ncomps;
+		unsigned char *data = stbi_load_from_memory(file.getData(), (int)file.getSize(), &w, &h, &ncomps, 4);
+		if(!data) {
+			cerr << filename << " could not be decoded" << endl;
+			return false;
+		}
+		if(!compress) {
+			CompressedImage::Level level;
+			level.width = w;
+			level.height = h;
+			level.offset = 0;
+			level.size = w * h * 4;
+			image.pixels.assign(data, data + level.size);
+			stbi_image_free(data);
+			for(;;) {
+				image.levels.push_back(level);
+				if(level.width == 1 && level.height == 1) {
+					break;
+				}
+				CompressedImage::Level next;
+				next.width = max(level.width / 2, 1u);
+				next.height = max(level.height / 2, 1u);
+				next.offset = level.offset + level.size;
+				next.size = next.width * next.height * 4;
+				image.pixels.resize(next.offset + next.size);
+				CompressedImage::downsample(&image.pixels[level.offset], level.width, level.height, &image.pixels[next.offset]);
+				level = next;
+			}
+			for(size_t l = 0; l < image.levels.size(); l++) {
+				image.data.push_back(&image.pixels[image.levels[l].offset]);
+			}
+			return true;
+		}
+		image.blocks.encode(data, w, h, max(1, (int)thread::hardware_concurrency()));
+		image.blocks.save(cacheFile, hash);
+		stbi_image_free(data);
+	}
+	for(int l = 0; l < image.blocks.getNumLevels(); l++) {
+		image.levels.push_back(image.blocks.getLevel(l));
+		image.data.push_back(image.blocks.getLevelData(l));
+	}
+	return true;
+}
+
+}
+
+TextureRegistry::TextureRegistry() :
+	numAcquired(0),
+	fallback(0),
+	uploading(false),
+	levelsChanged(false),
+	numBinds(0)
+{
+}
+
+TextureRegistry::~TextureRegistry()
+{
+	for(size_t i = 0; i < arrays.size(); i++) {
+		glDeleteTextures(1, &arrays[i].tid);
+	}
+	glDeleteTextures(1, &fallback);
+}
+
+int TextureRegistry::acquire(const string &filename)
+{
+	numAcquired++;
+	map<string, int>::iterator name = byName.find(filename);
+	if(name != byName.end()) {
+		return name->second;
+	}
+	MappedFile file;
+	if(!file.open(filename)) {
+		cerr << filename << " not found" << endl;
+		return -1;
+	}
+	uint64_t hash = CompressedImage::hash(file.getData(), file.getSize());
+	map<uint64_t, int>::iterator same = byHash.find(hash);
+	if(same != byHash.end()) {
+		byName[filename] = same->second;
+		return same->second;
+	}
+	Entry e;
+	e.filename = filename;
+	e.hash = hash;
+	e.array = -1;
+	e.layer = -1;
+	int handle = (int)entries.size();
+	entries.push_back(e);
+	byName[filename] = handle;
+	byHash[hash] = handle;
+	return handle;
+}
+
+void TextureRegistry::pack()
+{
+	packStart = chrono::steady_clock::now();
+	bool compress = !cacheDir.empty() && Texture::isCompressionSupported();
+	if(!uploader && TextureUploader::isSupported()) {
+		uploader.reset(new TextureUploader(max(1, (int)thread::hardware_concurrency() / 2)));
+	}
+	if(!fallback) {
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &fallback);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, fallback);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	// Group the new images by size, which only needs their headers
+	map< pair<int, int>, vector<int> > groups;
+	for(size_t i = 0; i < entries.size(); i++) {
+		if(entries[i].array != -1) {
+			continue;
+		}
+		MappedFile file;
+		int w, h, ncomps;
+		if(!file.open(entries[i].filename) || !stbi_info_from_memory(file.getData(), (int)file.getSize(), &w, &h, &ncomps)) {
+			cerr << entries[i].filename << " could not be decoded" << endl;
+			continue;
+		}
+		groups[make_pair(w, h)].push_back((int)i);
+	}
+	// Set here rather than by the threads that decode
+	stbi_set_flip_vertically_on_load(true);
+
+	// One array per size, with storage for the whole mip chain
+	for(map< pair<int, int>, vector<int> >::iterator g = groups.begin(); g != groups.end(); ++g) {
+		const vector<int> &members = g->second;
+		int index = (int)arrays.size();
+		Array a;
+		a.width = g->first.first;
+		a.height = g->first.second;
+		a.compressed = compress;
+		a.numLayers = (int)members.size();
+		a.numLevels = 0;
+		a.memory = 0;
+		glGenTextures(1, &a.tid);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, a.tid);
+		for(int w = a.width, h = a.height; ; w = max(w / 2, 1), h = max(h / 2, 1)) {
+			if(compress) {
+				GLsizei size = ((w + 3) / 4) * ((h + 3) / 4) * 8 * a.numLayers;
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, a.numLevels, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, w, h, a.numLayers, 0, size, 0);
+				a.memory += size;
+			} else {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, a.numLevels, GL_RGBA8, w, h, a.numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+				a.memory += (size_t)w * h * 4 * a.numLayers;
+			}
+			a.numLevels++;
+			if(w == 1 && h == 1) {
+				break;
+			}
+		}
+		a.levelLayers.assign(a.numLevels, 0);
+		a.baseLevel = a.numLevels;
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, a.numLevels - 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		arrays.push_back(a);
+
+		for(int k = 0; k < a.numLayers; k++) {
+			Entry &e = entries[members[k]];
+			e.array = index;
+			e.layer = k;
+			string filename = e.filename;
+			uint64_t hash = e.hash;
+			string cacheFile = cacheDir + getBaseName(e.filename) + ".bc1";
+			TextureUploader::Decoder decode = [=](TextureUploader::Image &image) {
+				return loadImage(filename, hash, cacheFile, compress, image);
+			};
+			if(uploader) {
+				uploader->add(a.tid, k, decode, [this, index](int level) { onLevel(index, level); });
+				uploading = true;
+				continue;
+			}
+			// No fences or unpack buffers: upload straight from memory now
+			TextureUploader::Image image;
+			if(!decode(image)) {
+				continue;
+			}
+			glBindTexture(GL_TEXTURE_2D_ARRAY, a.tid);
+			for(int l = 0; l < (int)image.levels.size(); l++) {
+				const CompressedImage::Level &level = image.levels[l];
+				if(compress) {
+					glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, k, level.width, level.height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.size, image.data[l]);
+				} else {
+					glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, k, level.width, level.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, image.data[l]);
+				}
+				onLevel(index, l);
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - packStart).count();
+	cout << "Packed " << entries.size() << " textures into " << arrays.size() << " arrays (" << (compress ? "BC1" : "RGBA8") << "), " << ms << " ms"
+		<< (uploading ? ", streaming the rest" : "") << endl;
+}
+
+bool TextureRegistry::update()
+{
+	if(!uploading) {
+		return false;
+	}
+	uploader->update();
+	if(uploader->getNumPending() == 0) {
+		uploading = false;
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - packStart).count();
+		cout << "Textures resident " << ms << " ms after pack()" << endl;
+	}
+	bool changed = levelsChanged;
+	levelsChanged = false;
+	return changed;
+}
+
+void TextureRegistry::finish()
+{
+	if(uploading) {
+		uploader->finish();
+		update();
+	}
+}
+
+void TextureRegistry::onLevel(int array, int level)
+{
+	Array &a = arrays[array];
+	a.levelLayers[level]++;
+	int base = a.baseLevel;
+	while(base > 0 && a.levelLayers[base - 1] == a.numLayers) {
+		base--;
+	}
+	if(base != a.baseLevel) {
+		a.baseLevel = base;
+		levelsChanged = true;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, a.tid);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, base);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+}
+
+TextureRegistry::Residency TextureRegistry::getResidency(int handle) const
+{
+	if(handle < 0 || handle >= (int)entries.size() || entries[handle].array < 0) {
+		return NOT_RESIDENT;
+	}
+	const Array &a = arrays[entries[handle].array];
+	if(a.baseLevel == 0) {
+		return RESIDENT;
+	}
+	return a.baseLevel < a.numLevels ? PARTIALLY_RESIDENT : NOT_RESIDENT;
+}
+
+GLuint TextureRegistry::getArray(int handle) const
+{
+	if(handle < 0 || handle >= (int)entries.size() || entries[handle].array < 0) {
+		return 0;
+	}
+	return arrays[entries[handle].array].tid;
+}
+
+int TextureRegistry::getLayer(int handle) const
+{
+	if(handle < 0 || handle >= (int)entries.size()) {
+		return 0;
+	}
+	return max(entries[handle].layer, 0);
+}
+
+void TextureRegistry::setWrapModes(int handle, GLint wrapS, GLint wrapT)
+{
+	// Shared by every layer of the array
+	glBindTexture(GL_TEXTURE_2D_ARRAY, getArray(handle));
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TextureRegistry::bind(int handle, GLint unit, GLint samplerHandle, GLint layerHandle)
+{
+	GLuint tid = getArray(handle);
+	int layer = getLayer(handle);
+	if(tid && getResidency(handle) == NOT_RESIDENT) {
+		tid = fallback;
+		layer = 0;
+	}
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tid);
+	numBinds++;
+	glUniform1i(samplerHandle, unit);
+	glUniform1f(layerHandle, (float)layer);
+}
+
+void TextureRegistry::unbind(GLint unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void TextureRegistry::printStats()
+{
+	size_t memory = 0;
+	int layers = 0;
+	for(size_t i = 0; i < arrays.size(); i++) {
+		memory += arrays[i].memory;
+		layers += arrays[i].numLayers;
+	}
+	cout << "Textures: " << numAcquired << " requests for " << entries.size() << " images, " << layers << " layers in "
+		<< arrays.size() << " arrays, " << memory / 1024 << " KB, " << numBinds << " binds";
+	if(uploader) {
+		cout << ", " << uploader->takeUploadedBytes() / 1024 << " KB uploaded, " << uploader->getNumPending() << " pending";
+	}
+	cout << endl;
+	numBinds = 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class TextureUploader;
+
+/**
+ * Owns the scene's image textures. acquire() returns a handle per image,
+ * and the same handle for a path or file contents it has seen before.
+ * pack() then loads every image once and puts the ones with the same size
+ * into the layers of one GL_TEXTURE_2D_ARRAY, so draws with different
+ * textures can share a binding. A handle resolves to an (array, layer)
+ * pair: the shaders sample a sampler2DArray at textureLayer.
+ *
+ * With a cache directory and S3TC, the layers are BC1 with mipmaps from
+ * CompressedImage, cached as <name>.bc1. Otherwise they are RGBA8 with a
+ * box-filtered mip chain.
+ *
+ * Where the driver has fences and pixel buffer objects, pack() only
+ * allocates the arrays and hands the layers to a TextureUploader, which
+ * streams them in over the following frames from update(). An array is
+ * sampled from its coarsest complete level onwards, and bind() substitutes
+ * a grey texel until it has any level at all.
+ */
+class TextureRegistry
+{
+public:
+	enum Residency {
+		NOT_RESIDENT,       // nothing uploaded yet, bind() uses the fallback
+		PARTIALLY_RESIDENT, // the coarser levels are in
+		RESIDENT
+	};
+
+	TextureRegistry();
+	virtual ~TextureRegistry();
+	void setCacheDirectory(const std::string &dir) { cacheDir = dir; }
+	// Returns -1 if the file can't be read
+	int acquire(const std::string &filename);
+	void pack();
+	// Advances the streaming uploads. Call once per frame. Returns true if
+	// any texture gained levels, so cached renderings can be redrawn.
+	bool update();
+	// Blocks until every packed texture is resident
+	void finish();
+	// Shared by all the textures in one array
+	Residency getResidency(int handle) const;
+	GLuint getArray(int handle) const;
+	int getLayer(int handle) const;
+	void setWrapModes(int handle, GLint wrapS, GLint wrapT);
+	// Binds the array of handle to the unit and points the sampler and layer
+	// uniforms at it. Draws with textures in the same array can share the
+	// binding, but untextured draws sample the unit too, so it is unbound
+	// after each textured one.
+	void bind(int handle, GLint unit, GLint samplerHandle, GLint layerHandle);
+	void unbind(GLint unit);
+	bool isStreaming() const { return uploading; }
+	// Memory, deduplication, and the binds since the last call
+	void printStats();
+
+private:
+	struct Entry
+	{
+		std::string filename;
+		uint64_t hash;
+		int array;
+		int layer;
+	};
+	struct Array
+	{
+		GLuint tid;
+		int width;
+		int height;
+		bool compressed;
+		int numLayers;
+		int numLevels;
+		std::vector<int> levelLayers; // layers uploaded per level
+		int baseLevel;                // finest level with all coarser ones in
+		size_t memory;
+	};
+
+	// Bookkeeping for a level of a layer that has reached the GPU
+	void onLevel(int array, int level);
+
+	std::string cacheDir;
+	std::vector<Entry> entries;
+	std::vector<Array> arrays;
+	std::map<std::string, int> byName;
+	std::map<uint64_t, int> byHash;
+	int numAcquired;
+	GLuint fallback;
+	std::unique_ptr<TextureUploader> uploader;
+	bool uploading;
+	bool levelsChanged;
+	std::chrono::steady_clock::time_point packStart;
+	int numBinds;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "TextureUploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "GLSL.h"
+
+using namespace std;
+
+namespace {
+
+// Pixel unpack buffers in the pool. Each grows to the largest level it has
+// carried, so with BC1 they stay small.
+const int NUM_STAGING = 8;
+
+}
+
+TextureUploader::TextureUploader(int numThreads) :
+	budget(256 * 1024),
+	numPending(0),
+	uploadedBytes(0),
+	quit(false)
+{
+	for(int i = 0; i < max(numThreads, 1); i++) {
+		workers.push_back(thread(&TextureUploader::workerLoop, this));
+	}
+}
+
+TextureUploader::~TextureUploader()
+{
+	{
+		lock_guard<mutex> lock(taskMutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+	for(size_t i = 0; i < staging.size(); i++) {
+		if(staging[i].fence) {
+			glDeleteSync(staging[i].fence);
+		}
+		glDeleteBuffers(1, &staging[i].pbo);
+	}
+}
+
+bool TextureUploader::isSupported()
+{
+	return (GLEW_VERSION_3_2 || GLEW_ARB_sync) &&
+		(GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range) &&
+		(GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object);
+}
+
+void TextureUploader::add(GLuint tid, int layer, const Decoder &decode, const LevelCallback &onLevel)
+{
+	shared_ptr<Job> job = make_shared<Job>();
+	job->tid = tid;
+	job->layer = layer;
+	job->decode = decode;
+	job->onLevel = onLevel;
+	job->failed = false;
+	job->nextLevel = -1;
+	job->levelsPending = 0;
+	numPending++;
+	run([this, job]() {
+		job->failed = !job->decode(job->image) || job->image.levels.empty();
+		lock_guard<mutex> lock(taskMutex);
+		decoded.push_back(job);
+	});
+}
+
+void TextureUploader::run(const function<void()> &task)
+{
+	{
+		lock_guard<mutex> lock(taskMutex);
+		tasks.push_back(task);
+	}
+	wake.notify_one();
+}
+
+void TextureUploader::workerLoop()
+{
+	for(;;) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(taskMutex);
+			wake.wait(lock, [this]() { return quit || !tasks.empty(); });
+			if(quit) {
+				return;
+			}
+			task = tasks.front();
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+bool TextureUploader::update()
+{
+	if(staging.empty()) {
+		staging.resize(NUM_STAGING);
+		for(size_t i = 0; i < staging.size(); i++) {
+			glGenBuffers(1, &staging[i].pbo);
+			staging[i].capacity = 0;
+			staging[i].mapped = 0;
+			staging[i].fence = 0;
+			staging[i].state = FREE;
+			staging[i].level = -1;
+		}
+	}
+
+	// Recycle the buffers whose uploads the GPU has consumed
+	for(size_t i = 0; i < staging.size(); i++) {
+		Staging &s = staging[i];
+		if(s.state != IN_FLIGHT) {
+			continue;
+		}
+		GLenum status = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			continue;
+		}
+		glDeleteSync(s.fence);
+		s.fence = 0;
+		s.job->onLevel(s.level);
+		if(--s.job->levelsPending == 0) {
+			numPending--;
+		}
+		s.job.reset();
+		s.state = FREE;
+	}
+
+	// Collect the work the threads have finished
+	{
+		lock_guard<mutex> lock(taskMutex);
+		for(size_t i = 0; i < decoded.size(); i++) {
+			shared_ptr<Job> job = decoded[i];
+			if(job->failed) {
+				numPending--;
+				continue;
+			}
+			job->levelsPending = (int)job->image.levels.size();
+			job->nextLevel = job->levelsPending - 1;
+			ready.push_back(job);
+		}
+		decoded.clear();
+		for(size_t i = 0; i < filled.size(); i++) {
+			staging[filled[i]].state = FILLED;
+			toIssue.push_back(filled[i]);
+		}
+		filled.clear();
+	}
+
+	// Upload from the filled buffers until the budget is spent
+	size_t bytes = 0;
+	while(!toIssue.empty() && (bytes == 0 || bytes < budget)) {
+		bytes += issue(staging[toIssue.front()]);
+		toIssue.pop_front();
+	}
+	uploadedBytes += bytes;
+
+	// Map the free buffers for the next levels and have the threads fill them
+	for(size_t i = 0; i < staging.size() && !ready.empty(); i++) {
+		Staging &s = staging[i];
+		if(s.state != FREE) {
+			continue;
+		}
+		shared_ptr<Job> job = ready.front();
+		int level = job->nextLevel--;
+		if(job->nextLevel < 0) {
+			ready.pop_front();
+		}
+		size_t size = job->image.levels[level].size;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+		if(size > s.capacity) {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+			s.capacity = size;
+		}
+		s.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if(!s.mapped) {
+			cerr << "Could not map a pixel unpack buffer" << endl;
+			if(--job->levelsPending == 0) {
+				numPending--;
+			}
+			continue;
+		}
+		s.state = FILLING;
+		s.job = job;
+		s.level = level;
+		int index = (int)i;
+		void *dst = s.mapped;
+		const unsigned char *src = job->image.data[level];
+		run([this, index, dst, src, size]() {
+			memcpy(dst, src, size);
+			lock_guard<mutex> lock(taskMutex);
+			filled.push_back(index);
+		});
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	GLSL::checkError(GET_FILE_LINE);
+	return numPending > 0;
+}
+
+size_t TextureUploader::issue(Staging &s)
+{
+	const Job &job = *s.job;
+	const CompressedImage::Level &level = job.image.levels[s.level];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	s.mapped = 0;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, job.tid);
+	// With an unpack buffer bound, the data pointer is an offset into it
+	if(job.image.compressed) {
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, s.level, 0, 0, job.layer, level.width, level.height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.size, 0);
+	} else {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, s.level, 0, 0, job.layer, level.width, level.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	s.state = IN_FLIGHT;
+	return level.size;
+}
+
+void TextureUploader::finish()
+{
+	size_t frameBudget = budget;
+	budget = numeric_limits<size_t>::max();
+	while(update()) {
+		this_thread::yield();
+	}
+	budget = frameBudget;
+}
+
+size_t TextureUploader::takeUploadedBytes()
+{
+	size_t bytes = uploadedBytes;
+	uploadedBytes = 0;
+	return bytes;
+}
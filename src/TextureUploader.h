@@ -0,0 +1,110 @@
+#pragma once
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "CompressedImage.h"
+
+/**
+ * Streams texture layers to the GPU without stalling the GL thread. Images
+ * are decoded on worker threads, and each mip level is copied by a worker
+ * into one of a small pool of pixel unpack buffers that the GL thread has
+ * mapped for it. update(), called once per frame, then issues the
+ * glTexSubImage calls from those buffers until the frame's byte budget is
+ * spent, and recycles a buffer once the fence placed after its upload has
+ * signaled. Levels go coarsest first, so a texture can be sampled with a
+ * raised GL_TEXTURE_BASE_LEVEL while its finer levels are still on the way.
+ */
+class TextureUploader
+{
+public:
+	// Every level of one layer, finest first, as RGBA8 or BC1. data points
+	// into pixels or blocks.
+	struct Image
+	{
+		bool compressed;
+		std::vector<CompressedImage::Level> levels;
+		std::vector<const unsigned char *> data;
+		std::vector<unsigned char> pixels;
+		CompressedImage blocks;
+	};
+	// Runs on a worker thread and returns false if the image can't be loaded
+	typedef std::function<bool(Image &)> Decoder;
+	// Runs on the GL thread once a level is on the GPU
+	typedef std::function<void(int)> LevelCallback;
+
+	TextureUploader(int numThreads);
+	virtual ~TextureUploader();
+	// Bytes handed to GL per update(). At least one level goes every time.
+	void setBudget(size_t bytes) { budget = bytes; }
+	size_t getBudget() const { return budget; }
+	// Queues one layer of the GL_TEXTURE_2D_ARRAY tid, whose storage must
+	// already be allocated for every level
+	void add(GLuint tid, int layer, const Decoder &decode, const LevelCallback &onLevel);
+	// Returns true while layers are still being decoded or uploaded
+	bool update();
+	// Blocks until every queued layer is on the GPU
+	void finish();
+	int getNumPending() const { return numPending; }
+	// Bytes uploaded since the last call
+	size_t takeUploadedBytes();
+	static bool isSupported();
+
+private:
+	TextureUploader(const TextureUploader &);
+	TextureUploader &operator=(const TextureUploader &);
+
+	struct Job
+	{
+		GLuint tid;
+		int layer;
+		Decoder decode;
+		LevelCallback onLevel;
+		Image image;
+		bool failed;
+		int nextLevel;     // next to map, counting down to 0
+		int levelsPending; // not yet on the GPU
+	};
+	enum State { FREE, FILLING, FILLED, IN_FLIGHT };
+	struct Staging
+	{
+		GLuint pbo;
+		size_t capacity;
+		void *mapped;
+		GLsync fence;
+		State state;
+		std::shared_ptr<Job> job;
+		int level;
+	};
+
+	void run(const std::function<void()> &task);
+	void workerLoop();
+	size_t issue(Staging &s);
+
+	size_t budget;
+	int numPending;
+	size_t uploadedBytes;
+	std::vector<Staging> staging;
+	std::deque< std::shared_ptr<Job> > ready; // decoded, levels left to map
+	std::deque<int> toIssue;                  // filled staging buffers
+
+	std::vector<std::thread> workers;
+	std::mutex taskMutex; // guards everything below
+	std::condition_variable wake;
+	std::deque< std::function<void()> > tasks;
+	std::vector< std::shared_ptr<Job> > decoded;
+	std::vector<int> filled; // staging buffers the workers are done with
+	bool quit;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int numThreads) :
+	job(0),
+	jobCount(0),
+	next(0),
+	busy(0),
+	jobIndex(0),
+	quit(false)
+{
+	for(int i = 1; i < numThreads; i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(jobMutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void ThreadPool::runItems()
+{
+	for(int i = next++; i < jobCount; i = next++) {
+		(*job)(i);
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	unsigned seen = 0;
+	for(;;) {
+		{
+			unique_lock<std::mutex> lock(jobMutex);
+			wake.wait(lock, [&]() { return quit || jobIndex != seen; });
+			if(quit) {
+				return;
+			}
+			seen = jobIndex;
+		}
+		runItems();
+		{
+			lock_guard<std::mutex> lock(jobMutex);
+			if(--busy == 0) {
+				done.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)> &f)
+{
+	if(count <= 0) {
+		return;
+	}
+	if(workers.empty() || count == 1) {
+		for(int i = 0; i < count; i++) {
+			f(i);
+		}
+		return;
+	}
+	{
+		lock_guard<std::mutex> lock(jobMutex);
+		job = &f;
+		jobCount = count;
+		next = 0;
+		busy = (int)workers.size();
+		jobIndex++;
+	}
+	wake.notify_all();
+	runItems();
+	unique_lock<std::mutex> lock(jobMutex);
+	done.wait(lock, [&]() { return busy == 0; });
+	job = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+/**
+ * A fixed set of worker threads for work that is split up every frame, where
+ * starting new threads each time would cost more than the work itself.
+ * parallelFor() hands out indices from a shared counter, so uneven items
+ * balance themselves, and the calling thread works on them as well.
+ */
+class ThreadPool
+{
+public:
+	// numThreads counts the calling thread, so 1 means no workers
+	ThreadPool(int numThreads);
+	virtual ~ThreadPool();
+	int getNumThreads() const { return (int)workers.size() + 1; }
+	// Calls f(i) for every i in [0, count) and returns once all are done
+	void parallelFor(int count, const std::function<void(int)> &f);
+
+private:
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	void workerLoop();
+	void runItems();
+
+	std::vector<std::thread> workers;
+	std::mutex jobMutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(int)> *job;
+	int jobCount;
+	std::atomic<int> next;
+	int busy;          // workers still inside the current job
+	unsigned jobIndex; // bumped for every job so workers see each one once
+	bool quit;
+};
+
+#endif
@@ -0,0 +1,549 @@
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "CompressedImage.h"
+#include "GLSL.h"
+#include "Program.h"
+#include "Texture.h"
+#include "TextureUploader.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+
+struct PageFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t size;
+	uint32_t page;
+	uint32_t border;
+	uint32_t pad;
+	uint64_t sourceHash;
+};
+
+const char PAGE_FILE_MAGIC[4] = { 'V', 'T', 'X', '1' };
+const uint32_t PAGE_FILE_VERSION = 1;
+
+// lastUsed of the slot holding the coarsest page, which is never evicted
+const unsigned PINNED = ~0u;
+
+// Pages are stored level by level, each level row by row. Fills in where
+// each level starts and returns the total.
+int layoutPages(int pagesX, vector<int> &levelStart)
+{
+	levelStart.clear();
+	int numPages = 0;
+	for(int row = pagesX; row >= 1; row /= 2) {
+		levelStart.push_back(numPages);
+		numPages += row * row;
+	}
+	return numPages;
+}
+
+}
+
+VirtualTexture::VirtualTexture() :
+	pageData(0),
+	size(0),
+	pagesX(0),
+	numLevels(0),
+	scale(1.0f),
+	cachePages(0),
+	cacheTID(0),
+	indirectionTID(0),
+	frame(0),
+	maxUploads(32),
+	feedbackDivisor(8),
+	feedbackWidth(0),
+	feedbackHeight(0),
+	feedbackFBO(0),
+	feedbackColor(0),
+	feedbackDepth(0),
+	feedbackIndex(0),
+	numRequests(0),
+	numHits(0),
+	numEvictions(0),
+	uploadedBytes(0),
+	quit(false)
+{
+	feedbackPBO[0] = feedbackPBO[1] = 0;
+	feedbackFence[0] = feedbackFence[1] = 0;
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	if(loader.joinable()) {
+		{
+			lock_guard<mutex> lock(loadMutex);
+			quit = true;
+		}
+		wake.notify_all();
+		loader.join();
+	}
+	for(int i = 0; i < 2; i++) {
+		if(feedbackFence[i]) {
+			glDeleteSync(feedbackFence[i]);
+		}
+	}
+	if(cacheTID) {
+		glDeleteTextures(1, &cacheTID);
+		glDeleteTextures(1, &indirectionTID);
+		glDeleteBuffers(2, feedbackPBO);
+	}
+	if(feedbackFBO) {
+		glDeleteFramebuffers(1, &feedbackFBO);
+		glDeleteRenderbuffers(1, &feedbackColor);
+		glDeleteRenderbuffers(1, &feedbackDepth);
+	}
+}
+
+bool VirtualTexture::isSupported()
+{
+	return (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) &&
+		TextureUploader::isSupported() && Texture::isCompressionSupported();
+}
+
+bool VirtualTexture::bake(const string &filename, int size, uint64_t sourceHash, const Source &source, int numThreads)
+{
+	if(size < PAGE || (size & (size - 1)) != 0) {
+		cerr << "The virtual texture size must be a power of two of at least " << PAGE << endl;
+		return false;
+	}
+	auto t0 = chrono::steady_clock::now();
+	int pagesX = size / PAGE;
+	vector<int> levelStart;
+	int numPages = layoutPages(pagesX, levelStart);
+	vector<unsigned char> blocks((size_t)numPages * PAGE_BYTES);
+	ThreadPool pool(numThreads);
+	pool.parallelFor(numPages, [&](int index) {
+		int level = (int)(upper_bound(levelStart.begin(), levelStart.end(), index) - levelStart.begin()) - 1;
+		int row = pagesX >> level;
+		int px = (index - levelStart[level]) % row;
+		int py = (index - levelStart[level]) / row;
+		int levelSize = size >> level;
+		// The texels of the level under the page. The border repeats the
+		// level's edge where the page is at it.
+		int x0 = px * PAGE - BORDER;
+		int y0 = py * PAGE - BORDER;
+		int cx0 = max(x0, 0);
+		int cy0 = max(y0, 0);
+		int cw = min(x0 + STRIDE, levelSize) - cx0;
+		int ch = min(y0 + STRIDE, levelSize) - cy0;
+		vector<unsigned char> texels((size_t)cw * ch * 4);
+		source(level, cx0, cy0, cw, ch, &texels[0]);
+		unsigned char *out = &blocks[(size_t)index * PAGE_BYTES];
+		unsigned char pixels[64];
+		for(int by = 0; by < STRIDE / 4; by++) {
+			for(int bx = 0; bx < STRIDE / 4; bx++) {
+				for(int y = 0; y < 4; y++) {
+					int sy = min(max(y0 + 4 * by + y - cy0, 0), ch - 1);
+					for(int x = 0; x < 4; x++) {
+						int sx = min(max(x0 + 4 * bx + x - cx0, 0), cw - 1);
+						memcpy(pixels + 16 * y + 4 * x, &texels[((size_t)sy * cw + sx) * 4], 4);
+					}
+				}
+				CompressedImage::encodeBlock(pixels, out + ((size_t)by * (STRIDE / 4) + bx) * 8);
+			}
+		}
+	});
+
+	PageFileHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PAGE_FILE_MAGIC, 4);
+	hdr.version = PAGE_FILE_VERSION;
+	hdr.size = size;
+	hdr.page = PAGE;
+	hdr.border = BORDER;
+	hdr.sourceHash = sourceHash;
+	// Other processes may be mapping the old page file
+	string temp = MappedFile::tempName(filename);
+	FILE *fp = fopen(temp.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't write to " << temp << endl;
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(&blocks[0], 1, blocks.size(), fp) == blocks.size();
+	ok = fclose(fp) == 0 && ok;
+	if(!ok) {
+		remove(temp.c_str());
+	} else if(!MappedFile::replace(temp, filename)) {
+		cerr << "Couldn't replace " << filename << endl;
+		ok = false;
+	}
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+	cout << "Baked " << filename << ": " << size << "x" << size << " texels in " << numPages << " pages, "
+		<< blocks.size() / (1024 * 1024) << " MB, " << ms << " ms" << endl;
+	return ok;
+}
+
+bool VirtualTexture::init(const string &filename, uint64_t sourceHash, int cachePages)
+{
+	if(!file.open(filename) || file.getSize() < sizeof(PageFileHeader)) {
+		return false;
+	}
+	PageFileHeader hdr;
+	memcpy(&hdr, file.getData(), sizeof(hdr));
+	if(memcmp(hdr.magic, PAGE_FILE_MAGIC, 4) != 0 || hdr.version != PAGE_FILE_VERSION || hdr.sourceHash != sourceHash ||
+	   hdr.page != PAGE || hdr.border != BORDER || hdr.size < PAGE) {
+		file.close();
+		return false;
+	}
+	size = hdr.size;
+	pagesX = size / PAGE;
+	int numPages = layoutPages(pagesX, levelStart);
+	numLevels = (int)levelStart.size();
+	if(file.getSize() < sizeof(hdr) + (size_t)numPages * PAGE_BYTES) {
+		file.close();
+		return false;
+	}
+	// The feedback and the indirection entries have 8 bits per coordinate
+	if(pagesX > 256 || cachePages > 256) {
+		cerr << "Virtual textures are limited to 256 pages per side" << endl;
+		file.close();
+		return false;
+	}
+	pageData = file.getData() + sizeof(hdr);
+	levelOf.resize(numPages);
+	for(int level = 0; level < numLevels; level++) {
+		int end = level + 1 < numLevels ? levelStart[level + 1] : numPages;
+		fill(levelOf.begin() + levelStart[level], levelOf.begin() + end, level);
+	}
+	this->cachePages = cachePages;
+	Slot empty = { -1, 0 };
+	slots.assign(cachePages * cachePages, empty);
+	slotOf.assign(numPages, -1);
+	loading.assign(numPages, false);
+	requested.assign(numPages, 0);
+
+	// One level of BC1 pages with their borders, filtered only bilinearly:
+	// the level is chosen per page in the shader
+	int texels = cachePages * STRIDE;
+	glGenTextures(1, &cacheTID);
+	glBindTexture(GL_TEXTURE_2D, cacheTID);
+	glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, texels, texels, 0, (texels / 4) * (texels / 4) * 8, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Every level's entries in one texture: level l is pagesX >> l square
+	// and starts at row 2 pagesX - 2 (pagesX >> l)
+	indirection.assign((size_t)pagesX * 2 * pagesX * 4, 0);
+	glGenTextures(1, &indirectionTID);
+	glBindTexture(GL_TEXTURE_2D, indirectionTID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pagesX, 2 * pagesX, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The coarsest page stays in slot 0, so every lookup finds something
+	int top = getPage(numLevels - 1, 0, 0);
+	upload(top, 0, pageData + (size_t)top * PAGE_BYTES);
+	slots[0].lastUsed = PINNED;
+	updateIndirection();
+
+	glGenBuffers(2, feedbackPBO);
+	GLSL::checkError(GET_FILE_LINE);
+	loader = thread(&VirtualTexture::loaderLoop, this);
+	uploadedBytes = 0;
+	statsStart = chrono::steady_clock::now();
+	cout << "Virtual texture: " << size << "x" << size << " texels in " << numPages << " pages, cache of "
+		<< slots.size() << " pages (" << (texels / 4) * (texels / 4) * 8 / 1024 << " KB)" << endl;
+	return true;
+}
+
+void VirtualTexture::loaderLoop()
+{
+	for(;;) {
+		int page;
+		{
+			unique_lock<mutex> lock(loadMutex);
+			wake.wait(lock, [this]() { return quit || !toLoad.empty(); });
+			if(quit) {
+				return;
+			}
+			page = toLoad.front();
+			toLoad.pop_front();
+		}
+		// Reading from the mapping is where the disk is touched
+		Loaded l;
+		l.page = page;
+		l.blocks.assign(pageData + (size_t)page * PAGE_BYTES, pageData + (size_t)(page + 1) * PAGE_BYTES);
+		lock_guard<mutex> lock(loadMutex);
+		loaded.push_back(l);
+	}
+}
+
+bool VirtualTexture::update()
+{
+	frame++;
+	readFeedback();
+
+	vector<Loaded> arrived;
+	{
+		lock_guard<mutex> lock(loadMutex);
+		int n = min((int)loaded.size(), maxUploads);
+		arrived.assign(loaded.begin(), loaded.begin() + n);
+		loaded.erase(loaded.begin(), loaded.begin() + n);
+	}
+	bool changed = false;
+	for(size_t i = 0; i < arrived.size(); i++) {
+		int page = arrived[i].page;
+		loading[page] = false;
+		if(slotOf[page] != -1) {
+			continue;
+		}
+		// When every slot is in view the page waits for the next request
+		int slot = findSlot();
+		if(slot == -1) {
+			continue;
+		}
+		upload(page, slot, &arrived[i].blocks[0]);
+		changed = true;
+	}
+	if(changed) {
+		updateIndirection();
+	}
+	GLSL::checkError(GET_FILE_LINE);
+	return changed;
+}
+
+void VirtualTexture::readFeedback()
+{
+	int last = feedbackIndex ^ 1;
+	if(!feedbackFence[last]) {
+		return;
+	}
+	GLenum status = glClientWaitSync(feedbackFence[last], 0, 0);
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+		return;
+	}
+	glDeleteSync(feedbackFence[last]);
+	feedbackFence[last] = 0;
+
+	int w = feedbackSize[last][0];
+	int h = feedbackSize[last][1];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[last]);
+	const unsigned char *texels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)w * h * 4, GL_MAP_READ_BIT);
+	vector<int> misses;
+	if(texels) {
+		for(int i = 0; i < w * h; i++) {
+			const unsigned char *p = texels + 4 * i;
+			int level = p[2];
+			if(p[3] == 0 || level >= numLevels || p[0] >= (pagesX >> level) || p[1] >= (pagesX >> level)) {
+				continue;
+			}
+			int page = getPage(level, p[0], p[1]);
+			if(requested[page] == frame) {
+				continue;
+			}
+			numRequests++;
+			if(slotOf[page] != -1) {
+				numHits++;
+			}
+			// The coarser pages are wanted too, as the fallback while
+			// the finer ones load
+			for(int l = level, x = p[0], y = p[1]; l < numLevels; l++, x /= 2, y /= 2) {
+				int q = getPage(l, x, y);
+				if(requested[q] == frame) {
+					break;
+				}
+				requested[q] = frame;
+				if(slotOf[q] != -1) {
+					if(slots[slotOf[q]].lastUsed != PINNED) {
+						slots[slotOf[q]].lastUsed = frame;
+					}
+				} else if(!loading[q]) {
+					loading[q] = true;
+					misses.push_back(q);
+				}
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	// Pages that were queued but are no longer in view are dropped, so a
+	// fast moving camera doesn't build up a backlog. The rest go coarsest
+	// first.
+	{
+		lock_guard<mutex> lock(loadMutex);
+		for(size_t i = 0; i < toLoad.size(); i++) {
+			if(requested[toLoad[i]] != frame) {
+				loading[toLoad[i]] = false;
+			} else {
+				misses.push_back(toLoad[i]);
+			}
+		}
+		sort(misses.begin(), misses.end(), [this](int a, int b) { return levelOf[a] > levelOf[b]; });
+		toLoad.assign(misses.begin(), misses.end());
+	}
+	wake.notify_one();
+}
+
+int VirtualTexture::findSlot()
+{
+	// A free slot, or else the one unused for the longest, but not one that
+	// is in view this frame
+	int best = -1;
+	for(int i = 0; i < (int)slots.size(); i++) {
+		if(slots[i].page == -1) {
+			return i;
+		}
+		if(slots[i].lastUsed < frame && (best == -1 || slots[i].lastUsed < slots[best].lastUsed)) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+void VirtualTexture::upload(int page, int slot, const unsigned char *blocks)
+{
+	glBindTexture(GL_TEXTURE_2D, cacheTID);
+	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cachePages) * STRIDE, (slot / cachePages) * STRIDE, STRIDE, STRIDE,
+		GL_COMPRESSED_RGB_S3TC_DXT1_EXT, PAGE_BYTES, blocks);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if(slots[slot].page != -1) {
+		slotOf[slots[slot].page] = -1;
+		numEvictions++;
+	}
+	slots[slot].page = page;
+	slots[slot].lastUsed = frame;
+	slotOf[page] = slot;
+	uploadedBytes += PAGE_BYTES;
+}
+
+void VirtualTexture::updateIndirection()
+{
+	// Coarse to fine, so a page that isn't cached can copy its parent's entry
+	for(int level = numLevels - 1; level >= 0; level--) {
+		int row = pagesX >> level;
+		int rowStart = 2 * pagesX - 2 * row;
+		int parentStart = 2 * pagesX - row;
+		for(int y = 0; y < row; y++) {
+			for(int x = 0; x < row; x++) {
+				unsigned char *e = &indirection[((size_t)(rowStart + y) * pagesX + x) * 4];
+				int slot = slotOf[getPage(level, x, y)];
+				if(slot != -1) {
+					e[0] = (unsigned char)(slot % cachePages);
+					e[1] = (unsigned char)(slot / cachePages);
+					e[2] = (unsigned char)level;
+					e[3] = 255;
+				} else {
+					memcpy(e, &indirection[((size_t)(parentStart + y / 2) * pagesX + x / 2) * 4], 4);
+				}
+			}
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, indirectionTID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pagesX, 2 * pagesX, GL_RGBA, GL_UNSIGNED_BYTE, &indirection[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTexture::beginFeedback(int width, int height)
+{
+	int w = max(width / feedbackDivisor, 1);
+	int h = max(height / feedbackDivisor, 1);
+	if(w != feedbackWidth || h != feedbackHeight) {
+		if(!feedbackFBO) {
+			glGenFramebuffers(1, &feedbackFBO);
+			glGenRenderbuffers(1, &feedbackColor);
+			glGenRenderbuffers(1, &feedbackDepth);
+		}
+		feedbackWidth = w;
+		feedbackHeight = h;
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if(status != GL_FRAMEBUFFER_COMPLETE) {
+			cerr << "Feedback framebuffer is incomplete (0x" << hex << status << dec << ")" << endl;
+		}
+	}
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+	glViewport(0, 0, w, h);
+	// Alpha 0 marks the texels that want no page
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+void VirtualTexture::endFeedback()
+{
+	int i = feedbackIndex;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, feedbackPBO[i]);
+	glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)feedbackWidth * feedbackHeight * 4, 0, GL_STREAM_READ);
+	glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if(feedbackFence[i]) {
+		glDeleteSync(feedbackFence[i]);
+	}
+	feedbackFence[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	feedbackSize[i][0] = feedbackWidth;
+	feedbackSize[i][1] = feedbackHeight;
+	feedbackIndex ^= 1;
+	GLSL::bindDefaultFramebuffer();
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void VirtualTexture::bind(const shared_ptr<Program> prog, GLint unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, cacheTID);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_2D, indirectionTID);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(prog->getUniform("vtCache"), unit);
+	glUniform1i(prog->getUniform("vtIndirection"), unit + 1);
+	glUniform4f(prog->getUniform("vtLayout"), (float)size, (float)pagesX, (float)numLevels, scale);
+	glUniform4f(prog->getUniform("vtPage"), (float)PAGE, (float)BORDER, (float)STRIDE, (float)(cachePages * STRIDE));
+	// Only in the feedback shader, whose target is smaller than the window
+	glUniform1f(prog->getUniform("vtLodBias"), -log2((float)feedbackDivisor));
+}
+
+void VirtualTexture::unbind(GLint unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void VirtualTexture::printStats()
+{
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - statsStart).count();
+	int used = 0;
+	for(size_t i = 0; i < slots.size(); i++) {
+		used += slots[i].page != -1;
+	}
+	cout << "Virtual texture: " << (numRequests ? 100.0 * numHits / numRequests : 100.0) << "% of " << numRequests << " page requests hit, "
+		<< used << "/" << slots.size() << " cache pages used, " << (seconds > 0.0 ? uploadedBytes / 1024.0 / seconds : 0.0) << " KB/s streamed, "
+		<< numEvictions << " evictions" << endl;
+	numRequests = 0;
+	numHits = 0;
+	numEvictions = 0;
+	uploadedBytes = 0;
+	statsStart = chrono::steady_clock::now();
+}
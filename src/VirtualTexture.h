@@ -0,0 +1,153 @@
+#pragma once
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <stdint.h>
+
+#include "MappedFile.h"
+
+class Program;
+
+/**
+ * A texture much larger than the GPU copy of it. bake() cuts every mip
+ * level of the texture into square BC1 pages with a border for filtering
+ * and writes them to a page file. At run time only the pages that are in
+ * view live in a physical cache texture, and an indirection texture maps
+ * each virtual page to its cache slot, or to the nearest coarser page that
+ * is cached. frag.glsl samples through both when VIRTUAL_TEXTURE is set.
+ *
+ * The pages in view are found by a feedback pass: the surfaces are drawn
+ * into a small target with vt_feedback_frag.glsl, which writes the page and
+ * level each fragment wants. The target is read back through a pixel pack
+ * buffer and looked at one frame later in update(). Missing pages are read
+ * from the mapped page file on a loader thread, coarsest first, and the
+ * least recently used slots are given up for them.
+ *
+ * Usage per frame:
+ *   if(update()) { anything that cached a rendering of it is stale }
+ *   beginFeedback(w, h); draw with the feedback program; endFeedback();
+ *   bind(prog, unit); draw; unbind(unit);
+ */
+class VirtualTexture
+{
+public:
+	enum {
+		PAGE = 128,                 // texels per page side, without the border
+		BORDER = 4,                 // one BC1 block on each side
+		STRIDE = PAGE + 2 * BORDER, // texels per page side in the file and the cache
+		PAGE_BYTES = (STRIDE / 4) * (STRIDE / 4) * 8
+	};
+	// Fills the w x h texels of a level starting at (x, y) as RGBA, rows
+	// first to last as uploaded to GL. Called from several threads.
+	typedef std::function<void(int level, int x, int y, int w, int h, unsigned char *rgba)> Source;
+
+	VirtualTexture();
+	virtual ~VirtualTexture();
+	// Writes the page file of a size x size texture. size must be a power of
+	// two and at least PAGE.
+	static bool bake(const std::string &filename, int size, uint64_t sourceHash, const Source &source, int numThreads);
+	// Maps the page file and creates a cache of cachePages x cachePages
+	// pages. Returns false if the file is missing or was baked from another
+	// source.
+	bool init(const std::string &filename, uint64_t sourceHash, int cachePages);
+	// Virtual uv = texture coordinates * scale
+	void setScale(float s) { scale = s; }
+	// The feedback target is the window size divided by this
+	void setFeedbackDivisor(int d) { feedbackDivisor = d; }
+	// Reads the last feedback, queues the missing pages, and moves loaded
+	// pages into the cache. Returns true if the indirection changed.
+	bool update();
+	// Binds and clears the feedback target. The depth test is left on.
+	void beginFeedback(int width, int height);
+	// Starts the readback and restores the default framebuffer
+	void endFeedback();
+	// Sets the uniforms of frag.glsl or vt_feedback_frag.glsl and binds the
+	// cache to unit and the indirection texture to unit + 1
+	void bind(const std::shared_ptr<Program> prog, GLint unit);
+	void unbind(GLint unit);
+	// Hit rate, cache use, and streaming bandwidth since the last call
+	void printStats();
+	static bool isSupported();
+
+private:
+	VirtualTexture(const VirtualTexture &);
+	VirtualTexture &operator=(const VirtualTexture &);
+
+	struct Slot
+	{
+		int page;          // -1 if free
+		unsigned lastUsed; // frame
+	};
+	struct Loaded
+	{
+		int page;
+		std::vector<unsigned char> blocks;
+	};
+
+	int getPage(int level, int x, int y) const { return levelStart[level] + y * (pagesX >> level) + x; }
+	void readFeedback();
+	void request(int page);
+	int findSlot();
+	void upload(int page, int slot, const unsigned char *blocks);
+	void updateIndirection();
+	void loaderLoop();
+
+	MappedFile file;
+	const unsigned char *pageData;
+	int size;
+	int pagesX;    // pages per side at level 0
+	int numLevels;
+	std::vector<int> levelStart;
+	std::vector<int> levelOf;
+	float scale;
+
+	int cachePages;
+	GLuint cacheTID;
+	GLuint indirectionTID;
+	std::vector<Slot> slots;
+	std::vector<int> slotOf;         // per page, -1 if not cached
+	std::vector<bool> loading;       // per page
+	std::vector<unsigned> requested; // per page, the last frame it was wanted
+	std::vector<unsigned char> indirection;
+	unsigned frame;
+	int maxUploads; // per update()
+
+	int feedbackDivisor;
+	int feedbackWidth;
+	int feedbackHeight;
+	GLuint feedbackFBO;
+	GLuint feedbackColor;
+	GLuint feedbackDepth;
+	GLuint feedbackPBO[2];
+	GLsync feedbackFence[2];
+	int feedbackSize[2][2];
+	int feedbackIndex;
+	int viewport[4];
+
+	int numRequests;
+	int numHits;
+	int numEvictions;
+	size_t uploadedBytes;
+	std::chrono::steady_clock::time_point statsStart;
+
+	std::thread loader;
+	std::mutex loadMutex; // guards everything below
+	std::condition_variable wake;
+	std::deque<int> toLoad;
+	std::vector<Loaded> loaded;
+	bool quit;
+};
+
+#endif
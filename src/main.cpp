@@ -14,6 +14,7 @@
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "stb_image.h"
 
 #include "Camera.h"
 #include "GLSL.h"
@@ -24,29 +25,120 @@
 #include "Light.h"
 #include "Object.h"
 #include "FreeLookCamera.h"
-#include "Texture.h"
+#include "TextureRegistry.h"
+#include "Culler.h"
+#include "PVS.h"
+#include "StaticBatcher.h"
+#include "ObjectInstancer.h"
+#include "Minimap.h"
+#include "MultiView.h"
+#include "LightClusters.h"
+#include "GBuffer.h"
+#include "GPUTimer.h"
+#include "ShaderVariants.h"
+#include "ProgramBatch.h"
+#include "VirtualTexture.h"
+#include "FrameCapture.h"
+#include "FrameSink.h"
+#include "Headless.h"
+#include "PoseBatch.h"
+#include "RenderServer.h"
+#include "RenderNode.h"
+#include "Compositor.h"
+#include "Profiler.h"
+#include "Benchmark.h"
+#include "CompressedImage.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
 #include <random>
+#include <thread>
 
 using namespace std;
 
 GLFWwindow *window; // Main application window
+shared_ptr<Headless> headless; // in place of the window with --headless
 string RESOURCE_DIR = "./"; // Where the resources are loaded from
 bool OFFLINE = false;
 
 // Initialize these in init()
 
-shared_ptr<Texture> texture0;
+shared_ptr<TextureRegistry> textures;
 shared_ptr<Camera> camera;
 shared_ptr<FreeLookCamera> freeCam;
 shared_ptr<Program> prog;
 shared_ptr<Program> prog2;
 shared_ptr<Program> prog3;
 shared_ptr<Program> prog4;
+shared_ptr<Program> batchProg;
 shared_ptr<Shape> shape;
 shared_ptr<Shape> shape2;
 shared_ptr<Shape> plane;
 shared_ptr<Shape> sun;
 shared_ptr<Shape> frustum;
+shared_ptr<Culler> culler;
+shared_ptr<PVS> pvs;
+bool usePVS = false;
+string pvsFile;       // baked the first time the PVS is used
+bool bakePVS = false; // --bake-pvs: bake the PVS if it is stale, then quit
+shared_ptr<StaticBatcher> batcher;
+bool useBatching = false;
+shared_ptr<ObjectInstancer> instancer;
+bool useInstancing = false;
+shared_ptr<Minimap> minimap;
+bool useMinimapCache = false; // off unless toggled or --minimap-cache
+// Resolution of the cached top-down view relative to its inset, and how
+// often (in seconds) the moving objects in it are redrawn
+float minimapScale = 0.5f;     // --minimap-scale
+double minimapInterval = 0.1;  // --minimap-interval
+shared_ptr<Program> multiViewProg;
+shared_ptr<MultiView> multiView;
+bool useMultiView = false;
+shared_ptr<Program> clusteredProg;
+shared_ptr<LightClusters> clusters;
+bool useClustered = false;
+int numPointLights = 256;
+double statsTime = 0.0;
+int statsFrames = 0;
+shared_ptr<Program> gbufferProg;
+shared_ptr<Program> deferredProg;
+shared_ptr<GBuffer> gbuffer;
+bool useDeferred = false;
+shared_ptr<GPUTimer> forwardTimer;
+shared_ptr<GPUTimer> geometryTimer;
+shared_ptr<GPUTimer> lightingTimer;
+shared_ptr<Program> depthProg;
+bool useDepthPrepass = false;
+shared_ptr<GPUTimer> prepassTimer;
+shared_ptr<ShaderVariants> variants;
+bool useVariants = true;
+shared_ptr<VirtualTexture> terrain;
+shared_ptr<Program> feedbackProg;
+bool useVirtualTexture = false;
+shared_ptr<FrameCapture> frameCapture;
+bool recording = false;
+string captureTarget;      // see FrameSink::open(); capture_%05d.png by default
+string captureFormat;      // png, rgb or y4m, instead of the target's extension
+int captureEvery = 1;      // every Nth frame is recorded
+int captureFrames = 0;     // quit after recording this many, or never if 0
+int captureBuffers = 3;    // frames in flight before rendering waits
+int captureFps = 60;       // written to Y4M headers
+int numCaptureFrames = 0;  // rendered while recording
+int numRecorded = 0;
+shared_ptr<PoseBatch> poseBatch; // --poses: a pose per frame, then quit
+int currentPose = 0;
+shared_ptr<RenderServer> renderServer; // --serve: renders for other processes
+shared_ptr<RenderNode> renderNode; // --node: renders a share of another process's frames
+shared_ptr<Compositor> compositor; // --distribute: frames come from render nodes
+shared_ptr<Profiler> profiler;
+bool profiling = false;
+string profileTarget = "profile.json"; // the Chrome trace written when profiling stops
+shared_ptr<Benchmark> benchmark; // --benchmark: times a fixed camera path, then quits
+string benchmarkTarget = "benchmark.json";
+int numObjects = 100; // --objects
+int numBunnies = 1;   // --mesh-mix=BUNNIES:TEAPOTS
+int numTeapots = 1;
 
 float minYTeapot;
 float minYBunny;
@@ -60,6 +152,7 @@ int progIndex = 0;
 
 vector<Material> materials;
 Material currMaterial;
+Material groundMaterial;
 int matIndex = 0;
 
 vector<Light> lights;
@@ -114,11 +207,162 @@ static void cursor_position_callback(GLFWwindow* window, double xmouse, double y
 	}
 }
 
+// Keeps the sun in lights[0] and scatters n point lights over the objects
+static void setPointLights(int n)
+{
+	lights.resize(1);
+	mt19937 rng(1);
+	uniform_real_distribution<float> xz(-3.0f, 12.0f);
+	uniform_real_distribution<float> height(0.2f, 1.5f);
+	uniform_real_distribution<float> range(1.0f, 2.5f);
+	uniform_real_distribution<float> channel(0.0f, 1.0f);
+	for (int i = 0; i < n; i++) {
+		Light l;
+		l.setPosition({ xz(rng), height(rng), xz(rng) });
+		l.setColor(glm::normalize(glm::vec3(channel(rng), channel(rng), channel(rng)) + 0.1f));
+		l.setRange(range(rng));
+		lights.push_back(l);
+	}
+	currLight = &lights[0];
+}
+
+// The size of the window's framebuffer, or of the headless one
+static void getFramebufferSize(int &width, int &height)
+{
+	if (headless) {
+		width = headless->getWidth();
+		height = headless->getHeight();
+	} else {
+		glfwGetFramebufferSize(window, &width, &height);
+	}
+}
+
+static double getTime()
+{
+	// The benchmark's clock steps a fixed amount per frame
+	if (benchmark) {
+		return benchmark->getTime();
+	}
+	// Every node of a distributed frame animates alike
+	if (renderNode) {
+		return renderNode->getTime();
+	}
+	// Every pose of a batch or request sees the same scene
+	if (poseBatch || renderServer) {
+		return 0.0;
+	}
+	return headless ? headless->getTime() : glfwGetTime();
+}
+
+// A render node drawing a share of the objects leaves the rest of the
+// scene to node 0
+static bool drawsScenery()
+{
+	return !renderNode || renderNode->drawsScenery();
+}
+
+static void closeWindow()
+{
+	if (headless) {
+		headless->setShouldClose(true);
+	} else {
+		glfwSetWindowShouldClose(window, true);
+	}
+}
+
+// Maps the PVS file, baking it first if it is missing or stale. Baking ray
+// casts every cell, so it waits until the PVS is turned on.
+static void preparePVS()
+{
+	if (pvs->isReady() || pvs->load(pvsFile, objects)) {
+		return;
+	}
+	pvs->bake(objects, max(1, (int)thread::hardware_concurrency()));
+	if (pvs->save(pvsFile)) {
+		pvs->load(pvsFile, objects);
+	}
+}
+
+// Opens the capture target. Frames are read back through a ring of pixel
+// pack buffers and handed to the sink off the render thread.
+static bool startCapture()
+{
+	if (!FrameCapture::isSupported()) {
+		cout << "Recording is not supported" << endl;
+		return false;
+	}
+	shared_ptr<FrameSink> sink = FrameSink::open(captureTarget, captureFormat, captureFps);
+	if (!sink) {
+		return false;
+	}
+	frameCapture = make_shared<FrameCapture>(sink, captureBuffers, max(1, (int)thread::hardware_concurrency() - 1));
+	return true;
+}
+
+// Waits for the recorded frames to reach the sink
+static void finishCapture()
+{
+	if (!frameCapture->finish()) {
+		cout << "Some frames couldn't be written to " << captureTarget << endl;
+	} else if (numRecorded == 1) {
+		cout << "Wrote to " << captureTarget << endl;
+	} else {
+		cout << "Wrote " << numRecorded << " frames to " << captureTarget << endl;
+	}
+}
+
+// Flushes a recording that is still running when the program quits. The
+// capture's buffers belong to the context, so this must run before the
+// context is torn down.
+static void releaseCapture()
+{
+	if (recording) {
+		recording = false;
+		finishCapture();
+	}
+	frameCapture.reset();
+}
+
+// Starts timing the phases of render(), if the scopes were compiled in
+static bool startProfiling()
+{
+	if (!Profiler::isSupported()) {
+		cout << "Profiling is not supported (built without FLC_PROFILE)" << endl;
+		return false;
+	}
+	profiler = make_shared<Profiler>();
+	cout << "Profiling" << endl;
+	return true;
+}
+
+// Prints every phase's percentiles and writes the trace
+static void stopProfiling()
+{
+	profiler->finish();
+	profiler->printSummary();
+	profiler->writeTrace(profileTarget);
+	profiler.reset();
+}
+
 /*
 
 	wasd: used to control the camera translation
 	z/Z: zoom in and out (changes fov)
 	t: enable the top down view
+	v: cycle the culling mode (none, full, coherent)
+	p: toggle the precomputed potentially visible sets
+	b: toggle static batching (teapots stop animating and are merged per cell)
+	g: toggle instanced drawing with the pulse animation on the GPU
+	m: toggle caching the top down view in an offscreen framebuffer
+	n: toggle drawing the objects once for both views (multi-view)
+	c: toggle clustered shading with point lights in the main view
+	l/L: double/halve the number of point lights
+	f: toggle deferred shading of the main view (sun and point lights)
+	e: toggle the depth pre-pass for the main view's forward shading
+	x: toggle the specialized variants of the Blinn-Phong shader
+	u: toggle the virtual terrain texture on the ground (Blinn-Phong shading only)
+	r: start/stop recording frames (to capture_NNNNN.png or --capture=TARGET)
+	k: start/stop profiling the frame's phases (to profile.json or --profile=FILE)
 
 */
 
@@ -148,6 +392,108 @@ static void char_callback(GLFWwindow *window, unsigned int key)
 		case 't':
 			activated += 1;
 			break;
+		case 'v':
+			culler->setMode((culler->getMode() + 1) % Culler::NUM_MODES);
+			cout << "Culling: " << culler->getModeName() << endl;
+			break;
+		case 'p':
+			usePVS = !usePVS;
+			if (usePVS) {
+				preparePVS();
+			}
+			cout << "PVS: " << (usePVS ? "on" : "off") << endl;
+			break;
+		case 'b':
+			useBatching = !useBatching;
+			for (size_t i = 0; i < objects.size(); i++) {
+				objects[i]->setStatic(useBatching && objects[i]->getShape() == shape2);
+			}
+			break;
+		case 'g':
+			if (ObjectInstancer::isSupported()) {
+				useInstancing = !useInstancing;
+				cout << "GPU animation: " << (useInstancing ? "on" : "off") << endl;
+			} else {
+				cout << "Instanced arrays are not supported" << endl;
+			}
+			break;
+		case 'm':
+			if (Minimap::isSupported()) {
+				useMinimapCache = !useMinimapCache;
+				minimap->invalidate();
+				cout << "Minimap cache: " << (useMinimapCache ? "on" : "off") << endl;
+			} else {
+				cout << "Framebuffer objects are not supported" << endl;
+			}
+			break;
+		case 'n':
+			if (multiViewProg) {
+				useMultiView = !useMultiView;
+				cout << "Multi-view: " << (useMultiView ? "on" : "off") << endl;
+			} else {
+				cout << "Viewport arrays are not supported" << endl;
+			}
+			break;
+		case 'c':
+			if (clusteredProg) {
+				useClustered = !useClustered;
+				cout << "Clustered shading: " << (useClustered ? "on" : "off") << endl;
+			} else {
+				cout << "Texture buffers are not supported" << endl;
+			}
+			break;
+		case 'f':
+			if (deferredProg) {
+				useDeferred = !useDeferred;
+				cout << "Deferred shading: " << (useDeferred ? "on" : "off") << endl;
+			} else {
+				cout << "Deferred shading is not supported" << endl;
+			}
+			break;
+		case 'e':
+			useDepthPrepass = !useDepthPrepass;
+			cout << "Depth pre-pass: " << (useDepthPrepass ? "on" : "off") << endl;
+			break;
+		case 'x':
+			useVariants = !useVariants;
+			cout << "Shader variants: " << (useVariants ? "on" : "off") << " (" << variants->getNumCompiled() << " compiled)" << endl;
+			break;
+		case 'u':
+			if (VirtualTexture::isSupported()) {
+				useVirtualTexture = !useVirtualTexture;
+				minimap->invalidate();
+				cout << "Virtual texture: " << (useVirtualTexture ? "on" : "off") << endl;
+			} else {
+				cout << "Virtual texturing is not supported" << endl;
+			}
+			break;
+		case 'r':
+			if (recording) {
+				recording = false;
+				finishCapture();
+			} else if (frameCapture || startCapture()) {
+				recording = true;
+				cout << "Recording to " << captureTarget << endl;
+			}
+			break;
+		case 'k':
+			if (profiling) {
+				profiling = false;
+				stopProfiling();
+			} else {
+				profiling = startProfiling();
+			}
+			break;
+		case 'l':
+			numPointLights = min(numPointLights * 2, 4096);
+			setPointLights(numPointLights);
+			cout << numPointLights << " point lights" << endl;
+			break;
+		case 'L':
+			numPointLights = max(numPointLights / 2, 1);
+			setPointLights(numPointLights);
+			cout << numPointLights << " point lights" << endl;
+			break;
 	
 	}
 
@@ -160,17 +506,17 @@ static void resize_callback(GLFWwindow *window, int width, int height)
 }
 
 // https://lencerf.github.io/post/2019-09-21-save-the-opengl-rendering-to-image-file/
-static void saveImage(const char *filepath, GLFWwindow *w)
+static void saveImage(const char *filepath)
 {
 	int width, height;
-	glfwGetFramebufferSize(w, &width, &height);
+	getFramebufferSize(width, height);
 	GLsizei nrChannels = 3;
 	GLsizei stride = nrChannels * width;
 	stride += (stride % 4) ? (4 - stride % 4) : 0;
 	GLsizei bufferSize = stride * height;
 	std::vector<char> buffer(bufferSize);
 	glPixelStorei(GL_PACK_ALIGNMENT, 4);
-	glReadBuffer(GL_BACK);
+	glReadBuffer(GLSL::getDefaultColorBuffer());
 	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
 	stbi_flip_vertically_on_write(true);
 	int rc = stbi_write_png(filepath, width, height, nrChannels, buffer.data(), stride);
@@ -181,47 +527,408 @@ static void saveImage(const char *filepath, GLFWwindow *w)
 	}
 }
 
+// Registers the variables of vert.glsl and frag.glsl. Shared by prog2 and
+// its variants.
+static void addBlinnPhongVariables(shared_ptr<Program> prog)
+{
+	prog->addAttribute("aPos");
+	prog->addAttribute("aNor");
+	prog->addAttribute("aTex");
+	prog->addUniform("MV");
+	prog->addUniform("P");
+	prog->addUniform("lightPos1");
+	prog->addUniform("lightColor1");
+	prog->addUniform("ka");
+	prog->addUniform("kd");
+	prog->addUniform("ks");
+	prog->addUniform("s");
+	prog->addUniform("texture0");
+	prog->addUniform("textureLayer");
+	prog->addUniform("vtCache");
+	prog->addUniform("vtIndirection");
+	prog->addUniform("vtLayout");
+	prog->addUniform("vtPage");
+	prog->addUniform("MVit");
+	prog->addAttribute("aInstPos");
+	prog->addAttribute("aInstScale");
+	prog->addAttribute("aInstKd");
+	prog->addAttribute("aInstPulse");
+	prog->addUniform("instanced");
+	prog->addUniform("t");
+	prog->bind();
+	glUniform1i(prog->getUniform("instanced"), 0);
+	prog->unbind();
+}
+
+// square.obj's texture coordinates run from 0 to 15, so the plain ground
+// repeats the grass 15 times. The terrain keeps that scale.
+const float GROUND_REPEATS = 15.0f;
+// Bump when bakeTerrain() changes, to rebake the page file
+const uint64_t TERRAIN_VERSION = 1;
+
+static float latticeNoise(int x, int y)
+{
+	unsigned h = (unsigned)x * 374761393u + (unsigned)y * 668265263u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	return (h ^ (h >> 16)) / 4294967295.0f;
+}
+
+// Smoothly interpolated noise with one random value per unit square
+static float valueNoise(float x, float y)
+{
+	int ix = (int)floor(x);
+	int iy = (int)floor(y);
+	float fx = x - ix;
+	float fy = y - iy;
+	fx = fx * fx * (3.0f - 2.0f * fx);
+	fy = fy * fy * (3.0f - 2.0f * fy);
+	float bottom = glm::mix(latticeNoise(ix, iy), latticeNoise(ix + 1, iy), fx);
+	float top = glm::mix(latticeNoise(ix, iy + 1), latticeNoise(ix + 1, iy + 1), fx);
+	return glm::mix(bottom, top, fy);
+}
+
+// Writes an 8192^2 terrain texture: the repeated grass, tinted towards dry
+// or lush by noise so that no two places on the ground look the same
+static bool bakeTerrain(const string &filename, uint64_t hash)
+{
+	int w, h, ncomps;
+	stbi_set_flip_vertically_on_load(true);
+	unsigned char *data = stbi_load((RESOURCE_DIR + "grass2.jpg").c_str(), &w, &h, &ncomps, 4);
+	if (!data) {
+		cerr << RESOURCE_DIR << "grass2.jpg could not be decoded" << endl;
+		return false;
+	}
+	// The grass's mip chain, so that coarse terrain levels don't alias it
+	vector< vector<unsigned char> > grass(1, vector<unsigned char>(data, data + w * h * 4));
+	vector<int> grassWidth(1, w);
+	vector<int> grassHeight(1, h);
+	stbi_image_free(data);
+	while (w > 1 || h > 1) {
+		int halfW = max(w / 2, 1);
+		int halfH = max(h / 2, 1);
+		grass.push_back(vector<unsigned char>(halfW * halfH * 4));
+		CompressedImage::downsample(&grass[grass.size() - 2][0], w, h, &grass.back()[0]);
+		w = halfW;
+		h = halfH;
+		grassWidth.push_back(w);
+		grassHeight.push_back(h);
+	}
+
+	const int size = 8192;
+	VirtualTexture::Source source = [&](int level, int x0, int y0, int tw, int th, unsigned char *rgba) {
+		int levelSize = size >> level;
+		// The grass level with about as many texels per tile
+		float tile = levelSize / GROUND_REPEATS;
+		int g = min(max((int)floor(log2(grassWidth[0] / tile) + 0.5f), 0), (int)grass.size() - 1);
+		const unsigned char *img = &grass[g][0];
+		int gw = grassWidth[g];
+		int gh = grassHeight[g];
+		for (int y = 0; y < th; y++) {
+			for (int x = 0; x < tw; x++) {
+				float u = (x0 + x + 0.5f) / levelSize;
+				float v = (y0 + y + 0.5f) / levelSize;
+				// Bilinear and repeating, like the plain ground's sampler
+				float gx = u * GROUND_REPEATS * gw - 0.5f;
+				float gy = v * GROUND_REPEATS * gh - 0.5f;
+				int ix = (int)floor(gx);
+				int iy = (int)floor(gy);
+				float fx = gx - ix;
+				float fy = gy - iy;
+				glm::vec3 c(0.0f);
+				for (int k = 0; k < 4; k++) {
+					int sx = ((ix + (k & 1)) % gw + gw) % gw;
+					int sy = ((iy + (k >> 1)) % gh + gh) % gh;
+					const unsigned char *p = img + (sy * gw + sx) * 4;
+					float weight = ((k & 1) ? fx : 1.0f - fx) * ((k >> 1) ? fy : 1.0f - fy);
+					c += weight * glm::vec3(p[0], p[1], p[2]);
+				}
+				float n = 0.5f * valueNoise(u * 6.0f, v * 6.0f) + 0.3f * valueNoise(u * 17.0f, v * 17.0f) + 0.2f * valueNoise(u * 41.0f, v * 41.0f);
+				c *= glm::mix(glm::vec3(0.75f, 0.95f, 0.75f), glm::vec3(1.25f, 1.05f, 0.7f), glm::smoothstep(0.3f, 0.7f, n));
+				c = glm::clamp(c, 0.0f, 255.0f);
+				unsigned char *out = rgba + (y * tw + x) * 4;
+				out[0] = (unsigned char)c.r;
+				out[1] = (unsigned char)c.g;
+				out[2] = (unsigned char)c.b;
+				out[3] = 255;
+			}
+		}
+	};
+	return VirtualTexture::bake(filename, size, hash, source, max(1, (int)thread::hardware_concurrency()));
+}
+
+// Opens the terrain's page file, baking it first if it is missing or stale,
+// and compiles the feedback shader. Done the first time it is turned on.
+static bool initTerrain()
+{
+	MappedFile grass;
+	if (!grass.open(RESOURCE_DIR + "grass2.jpg")) {
+		cerr << RESOURCE_DIR << "grass2.jpg not found" << endl;
+		return false;
+	}
+	uint64_t hash = CompressedImage::hash(grass.getData(), grass.getSize()) ^ TERRAIN_VERSION;
+	string filename = RESOURCE_DIR + "terrain.vt";
+	terrain = make_shared<VirtualTexture>();
+	terrain->setScale(1.0f / GROUND_REPEATS);
+	if (!terrain->init(filename, hash, 16) && (!bakeTerrain(filename, hash) || !terrain->init(filename, hash, 16))) {
+		terrain.reset();
+		return false;
+	}
+	feedbackProg = make_shared<Program>();
+	feedbackProg->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "vt_feedback_frag.glsl");
+	feedbackProg->setVerbose(true);
+	if (!feedbackProg->init()) {
+		feedbackProg.reset();
+		terrain.reset();
+		return false;
+	}
+	addBlinnPhongVariables(feedbackProg);
+	feedbackProg->addUniform("vtLodBias");
+	feedbackProg->setVerbose(false);
+	return true;
+}
+
 // This function is called once to initialize the scene and OpenGL
 static void init()
 {
 	// Initialize time.
-	glfwSetTime(0.0);
+	if (headless) {
+		headless->setTime(0.0);
+	} else {
+		glfwSetTime(0.0);
+	}
 	
 	// Set background color.
 	glClearColor(0.529f, 0.8f, 1.0f, 0.921f);
 	// Enable z-buffer test.
 	glEnable(GL_DEPTH_TEST);
 
+	// Linked programs are kept next to the resources, like the PVS
+	Program::setCacheDirectory(RESOURCE_DIR + "programs");
 	currProgram = make_shared<Program>();
 
 
+	// All programs are submitted together and set up as they finish, so the
+	// driver can compile them while the scene below is loaded
+	ProgramBatch programBatch;
+
 	// Blinn-Phong Shader
 	prog2 = make_shared<Program>();
 	prog2->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "frag.glsl");
 	prog2->setVerbose(true);
-	prog2->init();
-	prog2->addAttribute("aPos");
-	prog2->addAttribute("aNor");
-	prog2->addAttribute("aTex");
-	prog2->addUniform("MV");
-	prog2->addUniform("P");
-	prog2->addUniform("lightPos1");
-	prog2->addUniform("lightColor1");
-	prog2->addUniform("ka");
-	prog2->addUniform("kd");
-	prog2->addUniform("ks");
-	prog2->addUniform("s");
-	prog2->addUniform("texture0");
-	prog2->setVerbose(false);
-	prog2->addUniform("MVit");
+	programBatch.add(prog2, [](shared_ptr<Program> prog) {
+		prog->setVerbose(false);
+		addBlinnPhongVariables(prog);
+	});
 	programs.push_back(prog2);
 
-	// Grass Texture
-	texture0 = make_shared<Texture>();
-	texture0->setFilename(RESOURCE_DIR + "grass2.jpg");
-	texture0->init();
-	texture0->setUnit(0);
-	texture0->setWrapModes(GL_REPEAT, GL_REPEAT);
+	// Specializations of prog2, submitted below once the materials are known
+	variants = make_shared<ShaderVariants>();
+	variants->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "frag.glsl");
+	variants->setSetup(addBlinnPhongVariables);
+
+	// Static batch shader (world space vertices with a per-vertex kd)
+	batchProg = make_shared<Program>();
+	batchProg->setShaderNames(RESOURCE_DIR + "batch_vert.glsl", RESOURCE_DIR + "batch_frag.glsl");
+	batchProg->setVerbose(true);
+	programBatch.add(batchProg, [](shared_ptr<Program> prog) {
+		prog->addAttribute("aPos");
+		prog->addAttribute("aNor");
+		prog->addAttribute("aKd");
+		prog->addUniform("MV");
+		prog->addUniform("P");
+		prog->addUniform("MVit");
+		prog->addUniform("lightPos1");
+		prog->addUniform("lightColor1");
+		prog->addUniform("ka");
+		prog->addUniform("ks");
+		prog->addUniform("s");
+		prog->setVerbose(false);
+	});
+
+	// Clustered forward shader (the sun plus the point lights of each froxel)
+	clusters = make_shared<LightClusters>();
+	if (LightClusters::isSupported()) {
+		clusteredProg = make_shared<Program>();
+		clusteredProg->setShaderNames(RESOURCE_DIR + "clustered_vert.glsl", RESOURCE_DIR + "clustered_frag.glsl");
+		clusteredProg->setVerbose(true);
+		programBatch.add(clusteredProg, [](shared_ptr<Program> prog) {
+			prog->addAttribute("aPos");
+			prog->addAttribute("aNor");
+			prog->addAttribute("aTex");
+			prog->addAttribute("aInstPos");
+			prog->addAttribute("aInstScale");
+			prog->addAttribute("aInstKd");
+			prog->addAttribute("aInstPulse");
+			prog->addUniform("MV");
+			prog->addUniform("P");
+			prog->addUniform("MVit");
+			prog->addUniform("lightPos1");
+			prog->addUniform("lightColor1");
+			prog->addUniform("ka");
+			prog->addUniform("kd");
+			prog->addUniform("ks");
+			prog->addUniform("s");
+			prog->addUniform("texture0");
+			prog->addUniform("textureLayer");
+			prog->addUniform("instanced");
+			prog->addUniform("t");
+			prog->addUniform("lightData");
+			prog->addUniform("clusterOffsets");
+			prog->addUniform("clusterLights");
+			prog->addUniform("clusterGrid");
+			prog->addUniform("viewport");
+			prog->addUniform("clusterDepth");
+			prog->setVerbose(false);
+			prog->bind();
+			glUniform1i(prog->getUniform("instanced"), 0);
+			prog->unbind();
+		}, [](shared_ptr<Program>) {
+			clusteredProg.reset();
+		});
+	}
+
+	// Deferred shading: a geometry pass into the G-buffer, then one full
+	// screen lighting pass that reads the same froxel light lists. It needs
+	// the clustered shader too, which is checked once the batch is done.
+	gbuffer = make_shared<GBuffer>();
+	if (clusteredProg && GBuffer::isSupported()) {
+		gbufferProg = make_shared<Program>();
+		gbufferProg->setShaderNames(RESOURCE_DIR + "vert.glsl", RESOURCE_DIR + "gbuffer_frag.glsl");
+		deferredProg = make_shared<Program>();
+		deferredProg->setShaderNames(RESOURCE_DIR + "deferred_vert.glsl", RESOURCE_DIR + "deferred_frag.glsl");
+		programBatch.add(gbufferProg, [](shared_ptr<Program> prog) {
+			prog->addAttribute("aPos");
+			prog->addAttribute("aNor");
+			prog->addAttribute("aTex");
+			prog->addAttribute("aInstPos");
+			prog->addAttribute("aInstScale");
+			prog->addAttribute("aInstKd");
+			prog->addAttribute("aInstPulse");
+			prog->addUniform("MV");
+			prog->addUniform("P");
+			prog->addUniform("MVit");
+			prog->addUniform("lightColor1");
+			prog->addUniform("ka");
+			prog->addUniform("kd");
+			prog->addUniform("ks");
+			prog->addUniform("s");
+			prog->addUniform("texture0");
+			prog->addUniform("textureLayer");
+			prog->addUniform("instanced");
+			prog->addUniform("t");
+			prog->setVerbose(false);
+			prog->bind();
+			glUniform1i(prog->getUniform("instanced"), 0);
+			prog->unbind();
+		}, [](shared_ptr<Program>) {
+			gbufferProg.reset();
+		});
+		programBatch.add(deferredProg, [](shared_ptr<Program> prog) {
+			prog->addAttribute("aPos");
+			prog->addUniform("lightPos1");
+			prog->addUniform("lightColor1");
+			prog->addUniform("Pinv");
+			prog->addUniform("gAlbedo");
+			prog->addUniform("gSpecular");
+			prog->addUniform("gNormal");
+			prog->addUniform("gEmissive");
+			prog->addUniform("gDepth");
+			prog->addUniform("lightData");
+			prog->addUniform("clusterOffsets");
+			prog->addUniform("clusterLights");
+			prog->addUniform("clusterGrid");
+			prog->addUniform("viewport");
+			prog->addUniform("clusterDepth");
+			prog->setVerbose(false);
+		}, [](shared_ptr<Program>) {
+			deferredProg.reset();
+		});
+	}
+	if (GPUTimer::isSupported()) {
+		forwardTimer = make_shared<GPUTimer>();
+		geometryTimer = make_shared<GPUTimer>();
+		lightingTimer = make_shared<GPUTimer>();
+		prepassTimer = make_shared<GPUTimer>();
+	}
+
+	// Depth-only shader for the pre-pass (positions only, no shading)
+	depthProg = make_shared<Program>();
+	depthProg->setShaderNames(RESOURCE_DIR + "depth_vert.glsl", RESOURCE_DIR + "depth_frag.glsl");
+	depthProg->setVerbose(true);
+	programBatch.add(depthProg, [](shared_ptr<Program> prog) {
+		prog->addAttribute("aPos");
+		prog->addAttribute("aInstPos");
+		prog->addAttribute("aInstScale");
+		prog->addAttribute("aInstPulse");
+		prog->addUniform("P");
+		prog->addUniform("MV");
+		prog->addUniform("instanced");
+		prog->addUniform("t");
+		prog->setVerbose(false);
+		prog->bind();
+		glUniform1i(prog->getUniform("instanced"), 0);
+		prog->unbind();
+	});
+
+	// Multi-view shader (world space lighting, one copy of each triangle per view)
+	multiView = make_shared<MultiView>();
+	if (MultiView::isSupported()) {
+		multiViewProg = make_shared<Program>();
+		multiViewProg->setShaderNames(RESOURCE_DIR + "multiview_vert.glsl", RESOURCE_DIR + "multiview_frag.glsl", RESOURCE_DIR + "multiview_geom.glsl");
+		multiViewProg->setVerbose(true);
+		programBatch.add(multiViewProg, [](shared_ptr<Program> prog) {
+			prog->addAttribute("aPos");
+			prog->addAttribute("aNor");
+			prog->addAttribute("aInstPos");
+			prog->addAttribute("aInstScale");
+			prog->addAttribute("aInstKd");
+			prog->addAttribute("aInstPulse");
+			prog->addUniform("M");
+			prog->addUniform("Mit");
+			prog->addUniform("numViews");
+			prog->addUniform("PV");
+			prog->addUniform("eye");
+			prog->addUniform("lightPos1");
+			prog->addUniform("lightColor1");
+			prog->addUniform("ka");
+			prog->addUniform("kd");
+			prog->addUniform("ks");
+			prog->addUniform("s");
+			prog->addUniform("instanced");
+			prog->addUniform("t");
+			prog->setVerbose(false);
+			prog->bind();
+			glUniform1i(prog->getUniform("instanced"), 0);
+			prog->unbind();
+		}, [](shared_ptr<Program>) {
+			multiViewProg.reset();
+		});
+	}
+	programBatch.submit();
+
+	// Grass Texture. Images are shared through the registry, which packs
+	// them into texture arrays once all of them are known.
+	textures = make_shared<TextureRegistry>();
+	textures->setCacheDirectory(RESOURCE_DIR);
+	groundMaterial.setAmbient({ 0.0f, 0.0f, 0.0f });
+	groundMaterial.setDiffuse({ 0.0f, 0.0f, 0.0f });
+	groundMaterial.setSpecular({ 1.0f, 0.9f, 0.8f });
+	groundMaterial.setTexture(textures->acquire(RESOURCE_DIR + "grass2.jpg"));
+	textures->pack();
+	textures->setWrapModes(groundMaterial.getTexture(), GL_REPEAT, GL_REPEAT);
+	if(OFFLINE || poseBatch || renderServer || renderNode || benchmark) {
+		// The recorded frames can't wait for the streaming
+		textures->finish();
+	}
+
+	// Recording from the start. Without the capture path the offline frame
+	// falls back to saveImage().
+	if (recording && !startCapture()) {
+		recording = false;
+	}
+	if (profiling) {
+		profiling = startProfiling();
+	}
 
 
 	Material m1;
@@ -245,10 +952,28 @@ static void init()
 	m3.setShiny(2.0f);
 	materials.push_back(m3);
 
+	// The variants render() asks for, now that the materials are known.
+	// Objects of any color have the diffuse term.
+	variants->add(programBatch, ShaderVariants::select(glm::vec3(0.0f), glm::vec3(0.0f), false)); // sun
+	variants->add(programBatch, ShaderVariants::select(glm::vec3(0.6f), glm::vec3(1.0f, 0.9f, 0.8f), false)); // HUD
+	variants->add(programBatch, ShaderVariants::select(groundMaterial.getDiffuse(), groundMaterial.getSpecular(), groundMaterial.getTexture() != -1));
+	if (VirtualTexture::isSupported()) {
+		variants->add(programBatch, ShaderVariants::select(groundMaterial.getDiffuse(), groundMaterial.getSpecular(), true) | ShaderVariants::VIRTUAL_TEXTURE);
+	}
+	for (size_t i = 0; i < materials.size(); i++) {
+		unsigned mask = ShaderVariants::select(glm::vec3(1.0f), materials[i].getSpecular(), false);
+		variants->add(programBatch, mask);
+		if (ObjectInstancer::isSupported()) {
+			variants->add(programBatch, mask | ShaderVariants::INSTANCED);
+		}
+	}
+	programBatch.submit();
+
 	Light l1;
 	l1.setPosition({ 5.0f, 2.0f, 3.0f });
 	l1.setColor({ 1.0f, 1.0f, 1.0f });
 	lights.push_back(l1);
+	setPointLights(numPointLights);
 
 
 	//set default program
@@ -265,6 +990,11 @@ static void init()
 	// Free Look Camera
 	freeCam = make_shared<FreeLookCamera>();
 	freeCam->setInitDistance(2.0f); // Free Cam's initial Z translation
+
+	// The scene is small, so the depth slices stop well before the far plane
+	clusters->setGrid(16, 8, 24);
+	clusters->setDepthRange(freeCam->getNear(), min(freeCam->getFar(), 100.0f));
+	clusters->setNumThreads(max(1, (int)thread::hardware_concurrency()));
 	
 	// Initialize bunny object
 	shape = make_shared<Shape>();
@@ -293,43 +1023,535 @@ static void init()
 	frustum = make_shared<Shape>();
 	frustum->loadMesh(RESOURCE_DIR + "frustum.obj");
 	frustum->init();
+	programBatch.poll();
 
 	/*
 	
-		Dynamically create 100 objects in the scene.
+		Dynamically create numObjects objects in the scene (100 by default).
 		Each object is given a unique translation to space them out.
 		Objects will be drawn to the screen in render().
 	
 	*/
 
-	for (int i = 0; i < 10; i++) {
-		for (int j = 0; j < 10; j++) {
-
-			Object* obj = new Object();
-			if (j % 2 == 0) {
-				obj->setShape(shape); // bunny
-				obj->setTranslation(glm::vec3(j, obj->getScale()[1] * -0.066618, i));
-				obj->setScale(glm::vec3(0.2, 0.2, 0.2));
+	// Rows of a square grid. Of every numBunnies + numTeapots objects,
+	// numTeapots are teapots, spread evenly.
+	int side = (int)ceil(sqrt((double)numObjects));
+	for (int k = 0; k < numObjects; k++) {
+		int i = k / side;
+		int j = k % side;
+		bool teapot = (k + 1) * numTeapots / (numBunnies + numTeapots) > k * numTeapots / (numBunnies + numTeapots);
 
-			}
-			else {
-				obj->setShape(shape2); // teapot
-				obj->setTranslation(glm::vec3(j, 0, i));
-				obj->setScale(glm::vec3(0.2, 0.2, 0.2));
-			}
+		Object* obj = new Object();
+		if (!teapot) {
+			obj->setShape(shape); // bunny
+			obj->setTranslation(glm::vec3(j, obj->getScale()[1] * -0.066618, i));
+			obj->setScale(glm::vec3(0.2, 0.2, 0.2));
 
-			objects.push_back(obj);
 		}
+		else {
+			obj->setShape(shape2); // teapot
+			obj->setTranslation(glm::vec3(j, 0, i));
+			obj->setScale(glm::vec3(0.2, 0.2, 0.2));
+		}
+
+		objects.push_back(obj);
 	}
 	currObject = objects[0];
 
+	// Without a --benchmark-path, the benchmark circles the grid. The
+	// camera's position is offset from its eye by its initial distance.
+	if (benchmark && !benchmark->hasPath()) {
+		int rows = (numObjects + side - 1) / side;
+		glm::vec3 center(0.5f * (side - 1), 0.0f, 0.5f * (rows - 1));
+		benchmark->setOrbit(center + glm::vec3(0.0f, 0.0f, freeCam->getInitDistance()), 0.75f * max(side, rows) + 2.0f);
+	}
+
+	// Bounding spheres cover the whole range of the pulse animation in render()
+	culler = make_shared<Culler>();
+	culler->setObjects(objects, 1.0f, 1.1f);
+
+	// The object layout is static, so the PVS is baked once per layout and
+	// memory-mapped from then on, but only once it is turned on (or with
+	// --bake-pvs). The grid covers the ground plane.
+	pvs = make_shared<PVS>();
+	pvs->setGrid(glm::vec2(-12.5f, -12.5f), glm::vec2(12.5f, 12.5f), 0.5f);
+	glm::vec3 eye = freeCam->getEye();
+	pvs->setEyeHeights(eye.y, eye.y);
+	pvsFile = RESOURCE_DIR + "scene.pvs";
+	if (numObjects != 100 || numBunnies != numTeapots) {
+		// Other layouts keep their own, rather than replacing it
+		pvsFile = RESOURCE_DIR + "scene_" + to_string(numObjects) + "_" + to_string(numBunnies) + "-" + to_string(numTeapots) + ".pvs";
+	}
+	if (usePVS || bakePVS) {
+		preparePVS();
+	}
+	if (bakePVS) {
+		closeWindow();
+	}
+
+	batcher = make_shared<StaticBatcher>();
+
+	// Same pulse as the CPU path in render()
+	instancer = make_shared<ObjectInstancer>();
+	instancer->setPulse(0.1f, 0.25f);
+
+	minimap = make_shared<Minimap>();
+	minimap->setUpdateInterval(minimapInterval);
+	useMinimapCache = useMinimapCache && Minimap::isSupported();
+
+	programBatch.finish();
+	if (!clusteredProg || !gbufferProg || !deferredProg) {
+		gbufferProg.reset();
+		deferredProg.reset();
+	}
+
+	// A cold start compiles everything, a warm one loads the cached binaries
+	cout << "Programs: " << Program::getNumCompiled() << " compiled, " << Program::getNumLoaded()
+		<< " loaded from the cache, " << 1000.0 * Program::getInitSeconds() << " ms" << endl;
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+// Returns the cheapest variant of prog2 for the material. Other programs are
+// returned as they are. Each variant keeps its own uniforms, so every draw
+// has to set the light as well as the material.
+static shared_ptr<Program> variantOf(shared_ptr<Program> prog, const glm::vec3 &kd, const glm::vec3 &ks, bool textured, bool instanced = false)
+{
+	if (prog != prog2 || !useVariants) {
+		return prog;
+	}
+	unsigned mask = ShaderVariants::select(kd, ks, textured);
+	if (instanced) {
+		mask |= ShaderVariants::INSTANCED;
+	}
+	shared_ptr<Program> variant = variants->get(mask);
+	return variant ? variant : prog;
+}
+
+// The program for the ground in place of prog. With the terrain on, the
+// Blinn-Phong shader is replaced by its virtual texture variant.
+static shared_ptr<Program> groundProgramOf(shared_ptr<Program> prog, bool &virtualTextured)
+{
+	virtualTextured = false;
+	if (useVirtualTexture && prog == prog2) {
+		unsigned mask = ShaderVariants::select(groundMaterial.getDiffuse(), groundMaterial.getSpecular(), true);
+		shared_ptr<Program> variant = variants->get(mask | ShaderVariants::VIRTUAL_TEXTURE);
+		if (variant) {
+			virtualTextured = true;
+			return variant;
+		}
+	}
+	return variantOf(prog, groundMaterial.getDiffuse(), groundMaterial.getSpecular(), groundMaterial.getTexture() != -1);
+}
+
+// Draws the main view's ground into the terrain's feedback target. Objects
+// are left out, so pages behind them are asked for as well.
+static void drawTerrainFeedback(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, int width, int height)
+{
+	terrain->beginFeedback(width, height);
+	MV->pushMatrix();
+	MV->scale(25, 1, 25);
+	MV->rotate(M_PI / 2, { 1, 0, 0 });
+	feedbackProg->bind();
+	terrain->bind(feedbackProg, 0);
+	glUniformMatrix4fv(feedbackProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+	glUniformMatrix4fv(feedbackProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	glUniformMatrix4fv(feedbackProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+	plane->draw(feedbackProg);
+	terrain->unbind(0);
+	feedbackProg->unbind();
+	MV->popMatrix();
+	terrain->endFeedback();
+}
+
+// Sets the sun as the light of prog. lightPos is in camera space.
+static void setSunLight(shared_ptr<Program> prog, const glm::vec3 &lightPos)
+{
+	glUniform3f(prog->getUniform("lightPos1"), lightPos[0], lightPos[1], lightPos[2]);
+	glUniform3f(prog->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+}
+
+// Draws the merged static objects. MV holds the view matrix and lightPos is
+// already in camera space.
+static void drawStaticBatches(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const glm::vec3 &lightPos, const Frustum *f)
+{
+	if (batcher->getNumBatches() == 0) {
+		return;
+	}
+	batchProg->bind();
+	glUniformMatrix4fv(batchProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+	glUniformMatrix4fv(batchProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	glUniformMatrix4fv(batchProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+	glUniform3f(batchProg->getUniform("lightPos1"), lightPos[0], lightPos[1], lightPos[2]);
+	glUniform3f(batchProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+	glUniform3f(batchProg->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
+	glUniform3f(batchProg->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
+	glUniform1f(batchProg->getUniform("s"), currMaterial.getShiny());
+	batcher->draw(batchProg, f);
+	batchProg->unbind();
+}
+
+// Draws every dynamic object with one instanced call per mesh. MV holds the
+// view matrix and the pulse animation is evaluated in vert.glsl. The colors
+// are per instance, so the variant always has the diffuse term.
+static void drawInstancedObjects(shared_ptr<Program> prog, shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const glm::vec3 &lightPos, double t)
+{
+	instancer->update(objects);
+	prog = variantOf(prog, glm::vec3(1.0f), currMaterial.getSpecular(), false, true);
+	prog->bind();
+	setSunLight(prog, lightPos);
+	glUniform1i(prog->getUniform("instanced"), 1);
+	glUniform1f(prog->getUniform("t"), (float)t);
+	glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+	glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	glUniformMatrix4fv(prog->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+	glUniform3f(prog->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
+	glUniform3f(prog->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
+	glUniform1f(prog->getUniform("s"), currMaterial.getShiny());
+	instancer->draw(prog);
+	glUniform1i(prog->getUniform("instanced"), 0);
+	prog->unbind();
+}
+
+// Draws the dynamic objects once into every view of multiView. The objects
+// are culled against the union of the view frusta.
+static void drawMultiViewObjects(double t)
+{
+	culler->update(multiView->getViewProjections());
+	multiViewProg->bind();
+	multiView->apply(multiViewProg);
+	glm::vec3 lightPos = lights[0].getPosition();
+	glUniform3f(multiViewProg->getUniform("lightPos1"), lightPos[0], lightPos[1], lightPos[2]);
+	glUniform3f(multiViewProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+	glUniform3f(multiViewProg->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
+	glUniform3f(multiViewProg->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
+	glUniform1f(multiViewProg->getUniform("s"), currMaterial.getShiny());
+	glUniform1f(multiViewProg->getUniform("t"), (float)t);
+	if (useInstancing) {
+		instancer->update(objects);
+		glUniform1i(multiViewProg->getUniform("instanced"), 1);
+		instancer->draw(multiViewProg);
+		glUniform1i(multiViewProg->getUniform("instanced"), 0);
+	}
+	float scale_factor = 1 + (0.1 / 2) + ((0.1 / 2) * (sin(2 * M_PI * 0.25 * t)));
+	for (size_t i = 0; i < objects.size() && !useInstancing; i++) {
+		if (objects[i]->getStatic() || !culler->isVisible(i)) {
+			continue;
+		}
+		currObject = objects[i];
+
+		MatrixStack M;
+		M.translate(currObject->getTranslation());
+		M.scale(currObject->getScale());
+		M.scale(scale_factor);
+		glUniformMatrix4fv(multiViewProg->getUniform("M"), 1, GL_FALSE, glm::value_ptr(M.topMatrix()));
+		glUniformMatrix4fv(multiViewProg->getUniform("Mit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(M.topMatrix()))));
+		glUniform3f(multiViewProg->getUniform("kd"), currObject->getColor()[0], currObject->getColor()[1], currObject->getColor()[2]);
+		currObject->getShape()->draw(multiViewProg);
+	}
+	multiViewProg->unbind();
+}
+
+// Fills the depth buffer with everything the forward color pass draws in the
+// main view, so that the color pass only shades the visible fragments. The
+// transforms must be computed exactly as in render(), since the color pass
+// tests with GL_EQUAL. MV holds the view matrix.
+static void drawDepthPrepass(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const Frustum *f, const vector<int> &drawList, double t)
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	depthProg->bind();
+	glUniformMatrix4fv(depthProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+
+	if (drawsScenery()) {
+		MV->pushMatrix();
+		MV->translate(0, 0, 0);
+		MV->scale(25, 1, 25);
+		MV->rotate(M_PI / 2, { 1, 0, 0 });
+		glUniformMatrix4fv(depthProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		plane->draw(depthProg);
+		MV->popMatrix();
+
+		glUniformMatrix4fv(depthProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		batcher->draw(depthProg, f);
+	}
+
+	if (useInstancing) {
+		instancer->update(objects);
+		glUniform1i(depthProg->getUniform("instanced"), 1);
+		glUniform1f(depthProg->getUniform("t"), (float)t);
+		instancer->draw(depthProg);
+		glUniform1i(depthProg->getUniform("instanced"), 0);
+	}
+	float scale_factor = 1 + (0.1 / 2) + ((0.1 / 2) * (sin(2 * M_PI * 0.25 * t)));
+	for (size_t k = 0; k < drawList.size() && !useInstancing; k++) {
+		Object *obj = objects[drawList[k]];
+		MV->pushMatrix();
+		MV->translate(obj->getTranslation());
+		MV->scale(obj->getScale());
+		MV->scale(scale_factor);
+		glUniformMatrix4fv(depthProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		obj->getShape()->draw(depthProg);
+		MV->popMatrix();
+	}
+	depthProg->unbind();
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// Prints the average GPU time of the main view's shading passes since the
+// last call. Passes that did not run are left out.
+static void printPassTimes()
+{
+	if (!forwardTimer) {
+		return;
+	}
+	const char *names[4] = { "depth pre-pass", "forward", "geometry", "lighting" };
+	shared_ptr<GPUTimer> timers[4] = { prepassTimer, forwardTimer, geometryTimer, lightingTimer };
+	cout << "GPU time:";
+	for (int i = 0; i < 4; i++) {
+		double ms = timers[i]->getAverageMilliseconds();
+		if (timers[i]->getNumSamples() > 0) {
+			cout << " " << names[i] << " " << ms << " ms";
+		}
+		timers[i]->reset();
+	}
+	cout << endl;
+}
+
+// The top-down view is drawn in three parts so that the minimap can cache the
+// parts that do not change. MV holds the top-down view matrix in all of them.
+static void drawTopDownGround(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const glm::vec3 &temp)
+{
+	// Draw Sun --------------------------------------------------------------------------------------
+
+	MV->pushMatrix();
+	{
+		MV->translate(lights[0].getPosition());
+		MV->scale(0.2, 0.2, 0.2);
+
+		shared_ptr<Program> sunProg = variantOf(prog2, glm::vec3(0.0f), glm::vec3(0.0f), false);
+		sunProg->bind();
+		glUniform3f(sunProg->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
+		glUniform3f(sunProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+		glUniformMatrix4fv(sunProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(sunProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(sunProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3f(sunProg->getUniform("ka"), 1.0f, 1.0, 0);
+		glUniform3f(sunProg->getUniform("kd"), 0, 0, 0);
+		glUniform3f(sunProg->getUniform("ks"), 0, 0, 0);
+		glUniform1f(sunProg->getUniform("s"), currMaterial.getShiny());
+		sun->draw(sunProg);
+		sunProg->unbind();
+
+	}
+	MV->popMatrix();
+	// ---------------------------------------------------------------------------------------------------
+
+	//Draw Ground
+	MV->pushMatrix();
+	{
+
+		MV->translate(0, 0, 0);
+		MV->scale(50, 1, 50);
+		MV->rotate(M_PI / 2, { 1, 0, 0 });
+
+
+		bool virtualGround;
+		shared_ptr<Program> groundProg = groundProgramOf(prog2, virtualGround);
+		groundProg->bind();
+		if (virtualGround) {
+			terrain->bind(groundProg, 0);
+		} else {
+			textures->bind(groundMaterial.getTexture(), 0, groundProg->getUniform("texture0"), groundProg->getUniform("textureLayer"));
+		}
+		setSunLight(groundProg, temp);
+		glUniformMatrix4fv(groundProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(groundProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(groundProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3fv(groundProg->getUniform("ka"), 1, glm::value_ptr(groundMaterial.getAmbient()));
+		glUniform3fv(groundProg->getUniform("kd"), 1, glm::value_ptr(groundMaterial.getDiffuse()));
+		glUniform3fv(groundProg->getUniform("ks"), 1, glm::value_ptr(groundMaterial.getSpecular()));
+		glUniform1f(groundProg->getUniform("s"), currMaterial.getShiny());
+		plane->draw(groundProg);
+		// Untextured draws sample unit 0 too and must see it empty
+		if (virtualGround) {
+			terrain->unbind(0);
+		} else {
+			textures->unbind(0);
+		}
+		groundProg->unbind();
+
+
+	}
+	MV->popMatrix();
+}
+
+static void drawTopDownFrustum(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const glm::vec3 &lightPos, int width, int height)
+{
+	// Draw Frustum --------------------------------------------------------------------------------------------
+
+	glDisable(GL_DEPTH_TEST);
+	MV->pushMatrix();
+	glm::vec3 forward = glm::vec3(sin(freeCam->getYaw()), 0, cos(freeCam->getYaw()));
+	glm::vec3 eye = freeCam->getPosition();
+	glm::mat4 inverse_view_matrix = glm::inverse(glm::lookAt(eye, eye + forward, { 0, 1,0 }));
+	MV->multMatrix(inverse_view_matrix);
+	float s_x = (float)width / (float)height * tan(freeCam->getFOV() / 2.0f);
+	float s_y = tan(freeCam->getFOV() / 2.0f);
+	MV->scale(s_x, s_y, 1);
+
+	// Shaded like the ground. The ground may be drawn with a variant, so
+	// prog2 has to get the material here.
+	prog2->bind();
+	setSunLight(prog2, lightPos);
+	glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+	glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+	glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+	glUniform3f(prog2->getUniform("ka"), 0.0f, 0.0, 0.0);
+	glUniform3f(prog2->getUniform("kd"), 0.0f, 0.0f, 0.0f);
+	glUniform3f(prog2->getUniform("ks"), 1, 0.9, 0.8);
+	glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
+	frustum->draw(prog2);
+	prog2->unbind();
+	MV->popMatrix();
+	glEnable(GL_DEPTH_TEST);
+}
+
+static void drawTopDownObjects(shared_ptr<MatrixStack> P, shared_ptr<MatrixStack> MV, const glm::vec3 &lightPos, double t)
+{
+	// Draw Objects --------------------------------------------------------------------------------------------
+
+	if (useInstancing) {
+		drawInstancedObjects(prog2, P, MV, lightPos, t);
+	}
+	float scale_factor = 1 + (0.1 / 2) + ((0.1 / 2) * (sin(2 * M_PI * 0.25 * t)));
+	for (int i = 0; i < objects.size() && !useInstancing; i++) {
+
+		if (objects[i]->getStatic()) {
+			continue;
+		}
+		currObject = objects[i];
+
+		MV->pushMatrix();
+		{
+			MV->translate(currObject->getTranslation());
+			MV->scale(currObject->getScale());
+			MV->scale(scale_factor);
+
+			shared_ptr<Program> objProg = variantOf(prog2, currObject->getColor(), currMaterial.getSpecular(), false);
+			objProg->bind();
+			setSunLight(objProg, lightPos);
+			glUniformMatrix4fv(objProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+			glUniformMatrix4fv(objProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+			glUniformMatrix4fv(objProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+			glUniform3f(objProg->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
+			glUniform3f(objProg->getUniform("kd"), currObject->getColor()[0], currObject->getColor()[1], currObject->getColor()[2]);
+			glUniform3f(objProg->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
+			glUniform1f(objProg->getUniform("s"), currMaterial.getShiny());
+			currObject->getShape()->draw(objProg);
+			objProg->unbind();
+		}
+		MV->popMatrix();
+	}
+}
+
+// Records the frame just drawn, and quits once the recording, the pose
+// batch or the offline frame is done
+static void endFrame(int width, int height)
+{
+	PROFILE_SCOPE(profiler, "capture");
+	bool recorded = false;
+	if (recording && numCaptureFrames++ % captureEvery == 0) {
+		// A batch's images are numbered by pose, so that shards don't collide
+		frameCapture->capture(width, height, poseBatch ? currentPose : numRecorded);
+		recorded = ++numRecorded == captureFrames;
+	}
+	// A batch ends after its last pose, even if recording was turned off
+	bool lastPose = poseBatch && poseBatch->isDone();
+	if (recorded || (recording && lastPose)) {
+		recording = false;
+		finishCapture();
+		if (poseBatch) {
+			poseBatch->printStats();
+		}
+		closeWindow();
+	} else if (lastPose) {
+		closeWindow();
+	}
+	
+	if(OFFLINE && !frameCapture) {
+		saveImage("output.png");
+		GLSL::checkError(GET_FILE_LINE);
+		closeWindow();
+	}
+}
+
+// Has the render nodes draw the frame and puts it together in the
+// framebuffer. Only the camera and the time reach the nodes, which render
+// the main view with their own settings.
+static void composite()
+{
+	if (poseBatch) {
+		currentPose = poseBatch->apply(freeCam);
+	}
+	if (frameCapture) {
+		frameCapture->update();
+	}
+	int width, height;
+	getFramebufferSize(width, height);
+	double t = getTime();
+	PROFILE_BEGIN(profiler, "nodes");
+	if (!compositor->render(width, height, freeCam->getPosition(), freeCam->getYaw(), freeCam->getPitch(), freeCam->getFOV(), t)) {
+		closeWindow();
+		return;
+	}
+	PROFILE_END(profiler);
+	if (t - statsTime >= 1.0) {
+		compositor->printStats();
+		statsTime = t;
+	}
+	endFrame(width, height);
+}
+
 // This function is called every frame to draw the scene.
 static void render()
 {
+	// The benchmark moves the camera along its path, and quits once every
+	// frame has been timed
+	if (benchmark && !benchmark->beginFrame(freeCam)) {
+		int width, height;
+		getFramebufferSize(width, height);
+		benchmark->writeReport(benchmarkTarget, width, height, numObjects, to_string(numBunnies) + ":" + to_string(numTeapots));
+		closeWindow();
+		return;
+	}
+	PROFILE_FRAME(profiler);
+	// With --distribute the render nodes draw the frame
+	if (compositor) {
+		composite();
+		return;
+	}
+	// Batch mode moves the camera to the next pose every frame
+	if (poseBatch) {
+		currentPose = poseBatch->apply(freeCam);
+	}
+	// Streams in the textures queued by init(), a budget's worth per frame
+	PROFILE_BEGIN(profiler, "streaming");
+	if (textures->update()) {
+		minimap->invalidate();
+	}
+	// The terrain's page file is baked the first time it is turned on
+	if (useVirtualTexture && !terrain && !initTerrain()) {
+		useVirtualTexture = false;
+	}
+	if (useVirtualTexture && terrain->update()) {
+		minimap->invalidate();
+	}
+	// Frames captured earlier whose readback has finished go to the encoders
+	if (frameCapture) {
+		frameCapture->update();
+	}
+	PROFILE_END(profiler);
+
 	// Clear framebuffer.
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	if (keyToggles[(unsigned)'c']) {
@@ -347,13 +1569,21 @@ static void render()
 
 	// Get current frame buffer size.
 	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
-	camera->setAspect((float)width / (float)height);
-	freeCam->setAspect((float)width / (float)height);
+	getFramebufferSize(width, height);
+	// A render node's framebuffer only holds its region of the frame
+	float aspect_ratio = renderNode ? renderNode->getAspect() : (float)width / (float)height;
+	camera->setAspect(aspect_ratio);
+	freeCam->setAspect(aspect_ratio);
+
 
+	double t = getTime();
 
-	float aspect_ratio = (float)width / (float)height;
-	double t = glfwGetTime();
+	// Top-down inset
+	bool topDown = activated % 2 != 0;
+	int mapWidth = 0.5 * width;
+	int mapHeight = 0.5 * height;
+	glm::mat4 topDownP(1.0f);
+	glm::mat4 topDownV(1.0f);
 	
 
 	// Matrix stacks
@@ -361,34 +1591,46 @@ static void render()
 	auto MV = make_shared<MatrixStack>();
 
 	glViewport(0, 0, width, height);
+	if (useMultiView && topDown) {
+		// The inset overlaps the main view in the shared depth buffer, so
+		// the main view gets the far half of the depth range
+		glDepthRange(0.5, 1.0);
+	}
 	// Apply camera transforms
 	P->pushMatrix();
 	// Apply projection matrix only. After the HUD is drawn, then apply view matrix.
 	// This ensures the HUD to be drawn in front of all objects
+	if (renderNode) {
+		P->multMatrix(renderNode->getRegionMatrix());
+	}
 	freeCam->applyProjectionMatrix(P);
 	MV->pushMatrix();
 	
 	//Draw HUD --------------------------------------------------------------------------------------
 	P->pushMatrix();
 	MV->pushMatrix();
-	{	
+	if (drawsScenery()) {
+		PROFILE_SCOPE(profiler, "HUD");
+		// Both models share one material
+		shared_ptr<Program> hudProg = variantOf(prog2, glm::vec3(0.6, 0.6, 0.6), glm::vec3(1.0, 0.9, 0.8), false);
+
 		//bunny transformations
 		MV->pushMatrix();
 		MV->translate(0.6 * aspect_ratio, 0.3 * aspect_ratio, -2); // Place in top corner
 		MV->scale(0.1);
 		MV->rotate(t, { 0, 1, 0 }); // Rotate with time
-		prog2->bind();
-		glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-		glUniform3f(prog2->getUniform("lightPos1"), 1.0, 1.0, 1.0);
-		glUniform3f(prog2->getUniform("lightColor1"), 1.0, 1.0, 1.0);
-		glUniform3f(prog2->getUniform("ka"), 0.2, 0.2, 0.2);
-		glUniform3f(prog2->getUniform("kd"), 0.6, 0.6, 0.6);
-		glUniform3f(prog2->getUniform("ks"), 1.0, 0.9, 0.8);
-		glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-		shape->draw(prog2); // Draw bunny
-		prog2->unbind();
+		hudProg->bind();
+		glUniformMatrix4fv(hudProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(hudProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(hudProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3f(hudProg->getUniform("lightPos1"), 1.0, 1.0, 1.0);
+		glUniform3f(hudProg->getUniform("lightColor1"), 1.0, 1.0, 1.0);
+		glUniform3f(hudProg->getUniform("ka"), 0.2, 0.2, 0.2);
+		glUniform3f(hudProg->getUniform("kd"), 0.6, 0.6, 0.6);
+		glUniform3f(hudProg->getUniform("ks"), 1.0, 0.9, 0.8);
+		glUniform1f(hudProg->getUniform("s"), currMaterial.getShiny());
+		shape->draw(hudProg); // Draw bunny
+		hudProg->unbind();
 		MV->popMatrix();
 
 		// Teapot transforms
@@ -396,18 +1638,18 @@ static void render()
 		MV->translate(-0.6 * aspect_ratio, 0.33 * aspect_ratio, -2);
 		MV->scale(0.1);
 		MV->rotate(t, { 0, 1, 0 });
-		prog2->bind();
-		glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-		glUniform3f(prog2->getUniform("lightPos1"), 1.0, 1.0, 1.0);
-		glUniform3f(prog2->getUniform("lightColor1"), 1.0, 1.0, 1.0);
-		glUniform3f(prog2->getUniform("ka"), 0.2, 0.2, 0.2);
-		glUniform3f(prog2->getUniform("kd"), 0.6, 0.6, 0.6);
-		glUniform3f(prog2->getUniform("ks"), 1.0, 0.9, 0.8);
-		glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-		shape2->draw(prog2); // Draw teapot
-		prog2->unbind();
+		hudProg->bind();
+		glUniformMatrix4fv(hudProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(hudProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(hudProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3f(hudProg->getUniform("lightPos1"), 1.0, 1.0, 1.0);
+		glUniform3f(hudProg->getUniform("lightColor1"), 1.0, 1.0, 1.0);
+		glUniform3f(hudProg->getUniform("ka"), 0.2, 0.2, 0.2);
+		glUniform3f(hudProg->getUniform("kd"), 0.6, 0.6, 0.6);
+		glUniform3f(hudProg->getUniform("ks"), 1.0, 0.9, 0.8);
+		glUniform1f(hudProg->getUniform("s"), currMaterial.getShiny());
+		shape2->draw(hudProg); // Draw teapot
+		hudProg->unbind();
 		MV->popMatrix();
 	}
 	MV->popMatrix();
@@ -425,22 +1667,24 @@ static void render()
 	glm::vec3 temp = MV->topMatrix() * glm::vec4(lights[0].getPosition(), 1);
 
 	MV->pushMatrix();
-	{
+	if (drawsScenery()) {
+		PROFILE_SCOPE(profiler, "sun");
 		MV->translate(lights[0].getPosition());
 		MV->scale(0.2, 0.2, 0.2);
 
-		prog2->bind();
-		glUniform3f(prog2->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
-		glUniform3f(prog2->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
-		glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-		glUniform3f(prog2->getUniform("ka"), 1.0f, 1.0, 0);
-		glUniform3f(prog2->getUniform("kd"), 0, 0, 0);
-		glUniform3f(prog2->getUniform("ks"), 0, 0, 0);
-		glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-		sun->draw(prog2);
-		prog2->unbind();
+		shared_ptr<Program> sunProg = variantOf(prog2, glm::vec3(0.0f), glm::vec3(0.0f), false);
+		sunProg->bind();
+		glUniform3f(sunProg->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
+		glUniform3f(sunProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+		glUniformMatrix4fv(sunProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(sunProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(sunProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3f(sunProg->getUniform("ka"), 1.0f, 1.0, 0);
+		glUniform3f(sunProg->getUniform("kd"), 0, 0, 0);
+		glUniform3f(sunProg->getUniform("ks"), 0, 0, 0);
+		glUniform1f(sunProg->getUniform("s"), currMaterial.getShiny());
+		sun->draw(sunProg);
+		sunProg->unbind();
 
 	}
 	MV->popMatrix();
@@ -449,37 +1693,156 @@ static void render()
 	glm::mat4 S(1.0f);
 	S[0][1] = 0.5f * cos(t);
 
+	// Visible objects, front to back so that the depth test rejects as much
+	// as possible before shading
+	PROFILE_BEGIN(profiler, "culling");
+	if (!useMultiView) {
+		culler->update(P->topMatrix(), MV->topMatrix());
+	}
+	int cell = pvs->findCell(freeCam->getEye());
+	if (batcher->update(objects)) {
+		minimap->invalidate();
+	}
+	Frustum viewFrustum;
+	viewFrustum.extract(P->topMatrix() * MV->topMatrix());
+	vector<pair<float, int> > byDepth;
+	for (int i = 0; i < objects.size(); i++) {
+		if (objects[i]->getStatic() || !culler->isVisible(i) || (usePVS && !pvs->isVisible(cell, i)) || (renderNode && !renderNode->drawsObject(i))) {
+			continue;
+		}
+		glm::vec4 p = MV->topMatrix() * glm::vec4(objects[i]->getTranslation(), 1.0f);
+		byDepth.push_back(make_pair(-p.z, i));
+	}
+	sort(byDepth.begin(), byDepth.end());
+	vector<int> drawList;
+	for (size_t k = 0; k < byDepth.size(); k++) {
+		drawList.push_back(byDepth[k].second);
+	}
+	PROFILE_END(profiler);
+
+	if (useVirtualTexture) {
+		PROFILE_SCOPE(profiler, "terrain feedback");
+		drawTerrainFeedback(P, MV, width, height);
+	}
+
+	// Point lights are binned for this view and read by litProg. The
+	// deferred path writes the G-buffer here and shades it after the objects.
+	shared_ptr<Program> litProg = prog2;
+	if (useClustered || useDeferred) {
+		PROFILE_SCOPE(profiler, "light clusters");
+		clusters->update(lights, P->topMatrix(), MV->topMatrix());
+	}
+	statsFrames++;
+	if (t - statsTime >= 1.0) {
+		if (useClustered || useDeferred || useDepthPrepass) {
+			clusters->printStats();
+			printPassTimes();
+			cout << "Frame time: " << 1000.0 * (t - statsTime) / statsFrames << " ms" << endl;
+		}
+		if (textures->isStreaming() || useClustered || useDeferred || useDepthPrepass) {
+			textures->printStats();
+		}
+		if (useVirtualTexture) {
+			terrain->printStats();
+		}
+		if (recording) {
+			frameCapture->printStats();
+		}
+		statsTime = t;
+		statsFrames = 0;
+	}
+	if (useDeferred) {
+		gbuffer->setResolution(width, height);
+		gbuffer->bind();
+		litProg = gbufferProg;
+		litProg->bind();
+		glUniform3f(litProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+		litProg->unbind();
+		if (geometryTimer) {
+			geometryTimer->begin();
+		}
+	} else {
+		// With the pre-pass, the color pass only shades fragments whose
+		// depth matches the nearest one
+		bool prepass = useDepthPrepass && !useMultiView;
+		if (prepass) {
+			PROFILE_SCOPE(profiler, "depth pre-pass");
+			if (prepassTimer) {
+				prepassTimer->begin();
+			}
+			drawDepthPrepass(P, MV, culler->getMode() != Culler::NONE ? &viewFrustum : 0, drawList, t);
+			if (prepassTimer) {
+				prepassTimer->end();
+			}
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+		if (useClustered) {
+			litProg = clusteredProg;
+			litProg->bind();
+			clusters->bind(litProg, 1, glm::vec2(width, height));
+			glUniform3f(litProg->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
+			glUniform3f(litProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+			litProg->unbind();
+		}
+		if (forwardTimer) {
+			forwardTimer->begin();
+		}
+	}
+
 	//Draw Ground ---------------------------------------------------------------------------------------
 	MV->pushMatrix();
-	{
+	if (drawsScenery()) {
+		PROFILE_SCOPE(profiler, "ground");
 
 		MV->translate(0, 0, 0);
 		MV->scale(25, 1, 25);
 		MV->rotate(M_PI / 2, { 1, 0, 0 });
 
 
-		prog2->bind();
-		texture0->bind(prog2->getUniform("texture0"));
-		glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-		glUniform3f(prog2->getUniform("ka"), 0.0f, 0.0, 0.0);
-		glUniform3f(prog2->getUniform("kd"), 0.0f, 0.0f, 0.0f);
-		glUniform3f(prog2->getUniform("ks"), 1, 0.9, 0.8);
-		glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-		plane->draw(prog2);
-		texture0->unbind();
-		prog2->unbind();
+		bool virtualGround;
+		shared_ptr<Program> groundProg = groundProgramOf(litProg, virtualGround);
+		groundProg->bind();
+		if (virtualGround) {
+			terrain->bind(groundProg, 0);
+		} else {
+			textures->bind(groundMaterial.getTexture(), 0, groundProg->getUniform("texture0"), groundProg->getUniform("textureLayer"));
+		}
+		setSunLight(groundProg, temp);
+		glUniformMatrix4fv(groundProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(groundProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniformMatrix4fv(groundProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+		glUniform3fv(groundProg->getUniform("ka"), 1, glm::value_ptr(groundMaterial.getAmbient()));
+		glUniform3fv(groundProg->getUniform("kd"), 1, glm::value_ptr(groundMaterial.getDiffuse()));
+		glUniform3fv(groundProg->getUniform("ks"), 1, glm::value_ptr(groundMaterial.getSpecular()));
+		glUniform1f(groundProg->getUniform("s"), currMaterial.getShiny());
+		plane->draw(groundProg);
+		// Untextured draws sample unit 0 too and must see it empty
+		if (virtualGround) {
+			terrain->unbind(0);
+		} else {
+			textures->unbind(0);
+		}
+		groundProg->unbind();
 	
 
 	}
 	MV->popMatrix();
 	
 	// Draw Objects ---------------------------------------------------------------------------------
+	PROFILE_BEGIN(profiler, "objects");
+	if (!useDeferred && drawsScenery()) {
+		drawStaticBatches(P, MV, temp, culler->getMode() != Culler::NONE ? &viewFrustum : 0);
+	}
+	glm::mat4 mainP = P->topMatrix();
+	glm::mat4 mainV = MV->topMatrix();
+	if (useInstancing && !useMultiView) {
+		drawInstancedObjects(litProg, P, MV, temp, t);
+	}
 	float scale_factor = 1 + (0.1 / 2) + ((0.1 / 2) * (sin(2 * M_PI * 0.25 * t)));
-	for (int i = 0; i < objects.size(); i++) {
+	for (size_t k = 0; k < drawList.size() && !useInstancing && !useMultiView; k++) {
 
-		currObject = objects[i];
+		currObject = objects[drawList[k]];
 
 		MV->pushMatrix();
 		{
@@ -487,33 +1850,75 @@ static void render()
 			MV->scale(currObject->getScale());
 			MV->scale(scale_factor);
 
-			prog2->bind();
-			glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-			glUniform3f(prog2->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
-			glUniform3f(prog2->getUniform("kd"), currObject->getColor()[0], currObject->getColor()[1], currObject->getColor()[2]);
-			glUniform3f(prog2->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
-			glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-			currObject->getShape()->draw(prog2);
-			prog2->unbind();
+			shared_ptr<Program> objProg = variantOf(litProg, currObject->getColor(), currMaterial.getSpecular(), false);
+			objProg->bind();
+			setSunLight(objProg, temp);
+			glUniformMatrix4fv(objProg->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+			glUniformMatrix4fv(objProg->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+			glUniformMatrix4fv(objProg->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
+			glUniform3f(objProg->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
+			glUniform3f(objProg->getUniform("kd"), currObject->getColor()[0], currObject->getColor()[1], currObject->getColor()[2]);
+			glUniform3f(objProg->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
+			glUniform1f(objProg->getUniform("s"), currMaterial.getShiny());
+			currObject->getShape()->draw(objProg);
+			objProg->unbind();
 		}
 		MV->popMatrix();
 	}
+	PROFILE_END(profiler);
+	
+	if (useDeferred) {
+		if (geometryTimer) {
+			geometryTimer->end();
+		}
+		gbuffer->unbind();
+
+		// Lighting pass. It writes the stored depth, so the forward draws
+		// before (HUD, sun) and after (static batches) still sort correctly.
+		PROFILE_SCOPE(profiler, "deferred lighting");
+		if (lightingTimer) {
+			lightingTimer->begin();
+		}
+		deferredProg->bind();
+		clusters->bind(deferredProg, 1, glm::vec2(width, height));
+		gbuffer->bindTextures(4);
+		glUniform1i(deferredProg->getUniform("gAlbedo"), 4 + GBuffer::ALBEDO);
+		glUniform1i(deferredProg->getUniform("gSpecular"), 4 + GBuffer::SPECULAR);
+		glUniform1i(deferredProg->getUniform("gNormal"), 4 + GBuffer::NORMAL);
+		glUniform1i(deferredProg->getUniform("gEmissive"), 4 + GBuffer::EMISSIVE);
+		glUniform1i(deferredProg->getUniform("gDepth"), 4 + GBuffer::DEPTH);
+		glUniformMatrix4fv(deferredProg->getUniform("Pinv"), 1, GL_FALSE, glm::value_ptr(inverse(P->topMatrix())));
+		glUniform3f(deferredProg->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
+		glUniform3f(deferredProg->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
+		plane->draw(deferredProg);
+		gbuffer->unbindTextures(4);
+		deferredProg->unbind();
+		if (lightingTimer) {
+			lightingTimer->end();
+		}
+
+		if (drawsScenery()) {
+			drawStaticBatches(P, MV, temp, culler->getMode() != Culler::NONE ? &viewFrustum : 0);
+		}
+	} else {
+		if (forwardTimer) {
+			forwardTimer->end();
+		}
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+	if (useClustered || useDeferred) {
+		clusters->unbind(1);
+	}
 	
 	MV->popMatrix();
 	P->popMatrix();
 	
 	// Top Down view ------------------------------------------------------------------------------------
 
-	if (activated % 2 != 0) {
+	if (topDown) {
+		PROFILE_SCOPE(profiler, "top-down");
 
-		double s = 0.5;
-		glViewport(0, 0, s* width, s* height);
-		glEnable(GL_SCISSOR_TEST);
-		glScissor(0, 0, s * width, s* height);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glDisable(GL_SCISSOR_TEST);
 		P->pushMatrix();
 		MV->pushMatrix();
 
@@ -522,109 +1927,53 @@ static void render()
 		camera->applyViewMatrix(MV);
 		MV->translate(-5, 5, -12);
 		MV->rotate(M_PI / 2, { 1, 0, 0 });
-		
-		// Draw Scene Again
-		
-		// Draw Sun --------------------------------------------------------------------------------------
 		glm::vec3 temp = MV->topMatrix() * glm::vec4(lights[0].getPosition(), 1);
-
-		MV->pushMatrix();
-		{
-			MV->translate(lights[0].getPosition());
-			MV->scale(0.2, 0.2, 0.2);
-
-			prog2->bind();
-			glUniform3f(prog2->getUniform("lightPos1"), temp[0], temp[1], temp[2]);
-			glUniform3f(prog2->getUniform("lightColor1"), lights[0].getColor()[0], lights[0].getColor()[1], lights[0].getColor()[2]);
-			glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-			glUniform3f(prog2->getUniform("ka"), 1.0f, 1.0, 0);
-			glUniform3f(prog2->getUniform("kd"), 0, 0, 0);
-			glUniform3f(prog2->getUniform("ks"), 0, 0, 0);
-			glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-			sun->draw(prog2);
-			prog2->unbind();
-
-		}
-		MV->popMatrix();
-		// ---------------------------------------------------------------------------------------------------
-
-		glm::mat4 S(1.0f);
-		S[0][1] = 0.5f * cos(t);
-
-		//Draw Ground
-		MV->pushMatrix();
-		{
-
-			MV->translate(0, 0, 0);
-			MV->scale(50, 1, 50);
-			MV->rotate(M_PI / 2, { 1, 0, 0 });
-
-
-			prog2->bind();
-			texture0->bind(prog2->getUniform("texture0"));
-			glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-			glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-			glUniform3f(prog2->getUniform("ka"), 0.0f, 0.0, 0.0);
-			glUniform3f(prog2->getUniform("kd"), 0.0f, 0.0f, 0.0f);
-			glUniform3f(prog2->getUniform("ks"), 1, 0.9, 0.8);
-			glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-			plane->draw(prog2);
-			texture0->unbind();
-			prog2->unbind();
-
-
-		}
-		MV->popMatrix();
-
-		// Draw Frustum --------------------------------------------------------------------------------------------
-
-		glDisable(GL_DEPTH_TEST);
-		MV->pushMatrix();
-		glm::vec3 forward = glm::vec3(sin(freeCam->getYaw()), 0, cos(freeCam->getYaw()));
-		glm::vec3 eye = freeCam->getPosition();
-		glm::mat4 inverse_view_matrix = glm::inverse(glm::lookAt(eye, eye + forward, { 0, 1,0 }));
-		MV->multMatrix(inverse_view_matrix);
-		float s_x = (float)width / (float)height * tan(freeCam->getFOV() / 2.0f);
-		float s_y = tan(freeCam->getFOV() / 2.0f);
-		MV->scale(s_x, s_y, 1);
-
-		prog2->bind();
-		glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-		frustum->draw(prog2);
-		prog2->unbind();
-		MV->popMatrix();
-		glEnable(GL_DEPTH_TEST);
-
-		// Draw Objects --------------------------------------------------------------------------------------------
-
-		float scale_factor = 1 + (0.1 / 2) + ((0.1 / 2) * (sin(2 * M_PI * 0.25 * t)));
-		for (int i = 0; i < objects.size(); i++) {
-
-			currObject = objects[i];
-
-			MV->pushMatrix();
-			{
-				MV->translate(currObject->getTranslation());
-				MV->scale(currObject->getScale());
-				MV->scale(scale_factor);
-
-				prog2->bind();
-				glUniformMatrix4fv(prog2->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-				glUniformMatrix4fv(prog2->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-				glUniformMatrix4fv(prog2->getUniform("MVit"), 1, GL_FALSE, glm::value_ptr(transpose(inverse(MV->topMatrix()))));
-				glUniform3f(prog2->getUniform("ka"), currMaterial.getAmbient()[0], currMaterial.getAmbient()[1], currMaterial.getAmbient()[2]);
-				glUniform3f(prog2->getUniform("kd"), currObject->getColor()[0], currObject->getColor()[1], currObject->getColor()[2]);
-				glUniform3f(prog2->getUniform("ks"), currMaterial.getSpecular()[0], currMaterial.getSpecular()[1], currMaterial.getSpecular()[2]);
-				glUniform1f(prog2->getUniform("s"), currMaterial.getShiny());
-				currObject->getShape()->draw(prog2);
-				prog2->unbind();
+		topDownP = P->topMatrix();
+		topDownV = MV->topMatrix();
+
+		if (useMultiView) {
+			// Clearing the depth to the middle of the range keeps the main
+			// view's objects out of the inset. The objects are drawn below.
+			glViewport(0, 0, mapWidth, mapHeight);
+			glDepthRange(0.0, 0.5);
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(0, 0, mapWidth, mapHeight);
+			glClearDepth(0.5);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glClearDepth(1.0);
+			glDisable(GL_SCISSOR_TEST);
+
+			drawTopDownGround(P, MV, temp);
+			drawTopDownFrustum(P, MV, temp, width, height);
+			drawStaticBatches(P, MV, temp, 0);
+		} else if (useMinimapCache) {
+			// Redraw the offscreen copy at a reduced rate and resolution,
+			// then paste it in. Only the frustum is drawn every frame.
+			minimap->setResolution(mapWidth * minimapScale, mapHeight * minimapScale);
+			if (minimap->needsUpdate(t)) {
+				if (minimap->beginStatic()) {
+					drawTopDownGround(P, MV, temp);
+					drawStaticBatches(P, MV, temp, 0);
+				}
+				minimap->beginDynamic(t);
+				drawTopDownObjects(P, MV, temp, t);
+				minimap->end();
 			}
-			MV->popMatrix();
+			minimap->composite(0, 0, mapWidth, mapHeight);
+			glViewport(0, 0, mapWidth, mapHeight);
+			drawTopDownFrustum(P, MV, temp, width, height);
+		} else {
+			glViewport(0, 0, mapWidth, mapHeight);
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(0, 0, mapWidth, mapHeight);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glDisable(GL_SCISSOR_TEST);
+
+			// Draw Scene Again
+			drawTopDownGround(P, MV, temp);
+			drawTopDownFrustum(P, MV, temp, width, height);
+			drawStaticBatches(P, MV, temp, 0);
+			drawTopDownObjects(P, MV, temp, t);
 		}
 
 		P->popMatrix();
@@ -632,6 +1981,17 @@ static void render()
 		
 	}
 
+	if (useMultiView) {
+		PROFILE_SCOPE(profiler, "multi-view objects");
+		multiView->clear();
+		multiView->addView(mainP, mainV, 0, 0, width, height, topDown ? 0.5f : 0.0f, 1.0f);
+		if (topDown) {
+			multiView->addView(topDownP, topDownV, 0, 0, mapWidth, mapHeight, 0.0f, 0.5f);
+		}
+		drawMultiViewObjects(t);
+		MultiView::restore(width, height);
+	}
+
 	// -------------------------------------------------------------------
 
 
@@ -639,11 +1999,55 @@ static void render()
 	
 	GLSL::checkError(GET_FILE_LINE);
 	
-	if(OFFLINE) {
-		saveImage("output.png", window);
-		GLSL::checkError(GET_FILE_LINE);
-		glfwSetWindowShouldClose(window, true);
+	endFrame(width, height);
+}
+
+// Renders the render server's requests until the process is stopped. Each
+// batch is drawn back to back at its size, and the frames reach the
+// clients through a FrameCapture with the server as its sink.
+static void serve()
+{
+	const int maxBatch = 8;
+	shared_ptr<FrameCapture> replies = make_shared<FrameCapture>(renderServer, maxBatch, max(1, (int)thread::hardware_concurrency() - 1));
+	chrono::steady_clock::time_point lastStats = chrono::steady_clock::now();
+	while (!headless->shouldClose()) {
+		replies->update();
+		// Short waits while readbacks are in flight, so that they go out
+		vector<RenderServer::Request> batch = renderServer->takeBatch(maxBatch, replies->getNumPending() > 0 ? 1 : 100);
+		if (!batch.empty()) {
+			headless->resize(batch[0].width, batch[0].height);
+			for (size_t i = 0; i < batch.size(); i++) {
+				const RenderServer::Request &r = batch[i];
+				freeCam->setPose(r.position, r.yaw, r.pitch, r.fovy);
+				render();
+				replies->capture(r.width, r.height, r.frame);
+			}
+			headless->swapBuffers();
+		}
+		if (chrono::steady_clock::now() - lastStats >= chrono::seconds(1)) {
+			renderServer->printStats();
+			lastStats = chrono::steady_clock::now();
+		}
+	}
+	replies->finish();
+}
+
+// Renders the coordinator's requests until it hangs up, then quits. Frustum
+// culling is what keeps a node from drawing the objects outside its tile.
+static void runNode()
+{
+	culler->setMode(Culler::FULL);
+	while (!headless->shouldClose() && renderNode->receive()) {
+		const RenderNode::Request &r = renderNode->getRequest();
+		headless->resize(r.regionWidth, r.regionHeight);
+		freeCam->setPose(r.position, r.yaw, r.pitch, r.fovy);
+		render();
+		if (!renderNode->send()) {
+			break;
+		}
+		headless->swapBuffers();
 	}
+	closeWindow();
 }
 
 int main(int argc, char **argv)
@@ -651,33 +2055,211 @@ int main(int argc, char **argv)
 	/*cout << minYCube << endl;
 	cout << minYBunny << endl;*/
 	if(argc < 2) {
-		cout << "Usage: A3 RESOURCE_DIR" << endl;
+		cout << "Usage: A3 RESOURCE_DIR [OFFLINE] [--headless] [--capture=TARGET] [--capture-format=png|rgb|y4m]" << endl;
+		cout << "       [--capture-every=N] [--capture-frames=N] [--capture-buffers=N] [--capture-fps=N]" << endl;
+		cout << "       [--poses=FILE] [--shards=N] [--serve=SOCKET]" << endl;
+		cout << "       [--distribute=N] [--distribute-mode=tiles|objects] [--distribute-port=PORT] [--node=HOST:PORT]" << endl;
+		cout << "       [--profile[=FILE]] [--benchmark[=FILE]] [--benchmark-frames=N] [--benchmark-path=FILE]" << endl;
+		cout << "       [--objects=N] [--mesh-mix=BUNNIES:TEAPOTS] [--bake-pvs]" << endl;
+		cout << "       [--minimap-cache] [--minimap-scale=S] [--minimap-interval=SECONDS]" << endl;
 		return 0;
 	}
 	RESOURCE_DIR = argv[1] + string("/");
 	
-	// Optional argument
-	if(argc >= 3) {
-		OFFLINE = atoi(argv[2]) != 0;
+	// Optional arguments
+	string posesFile;
+	int numShards = 1;
+	int shardIndex = 0;
+	int shardCount = 0;
+	int numNodes = 0;
+	int distributeMode = RenderNode::TILES;
+	int distributePort = 0;
+	int benchmarkFrames = 600;
+	string benchmarkPath;
+	bool benchmarking = false;
+	for(int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if(arg.compare(0, 2, "--") != 0) {
+			OFFLINE = atoi(argv[i]) != 0;
+			continue;
+		}
+		size_t eq = arg.find('=');
+		string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+		string value = eq == string::npos ? "" : arg.substr(eq + 1);
+		if(name == "headless") {
+			headless = make_shared<Headless>();
+		} else if(name == "capture") {
+			captureTarget = value;
+			recording = true;
+		} else if(name == "capture-format") {
+			captureFormat = value;
+		} else if(name == "capture-every") {
+			captureEvery = max(1, atoi(value.c_str()));
+		} else if(name == "capture-frames") {
+			captureFrames = max(0, atoi(value.c_str()));
+		} else if(name == "capture-buffers") {
+			captureBuffers = max(1, atoi(value.c_str()));
+		} else if(name == "capture-fps") {
+			captureFps = max(1, atoi(value.c_str()));
+		} else if(name == "serve") {
+			renderServer = make_shared<RenderServer>();
+			if(!renderServer->start(value)) {
+				return -1;
+			}
+		} else if(name == "distribute") {
+			numNodes = max(1, atoi(value.c_str()));
+		} else if(name == "distribute-mode") {
+			if(value != "tiles" && value != "objects") {
+				cerr << "Expected --distribute-mode=tiles|objects" << endl;
+				return -1;
+			}
+			distributeMode = value == "objects" ? RenderNode::OBJECTS : RenderNode::TILES;
+		} else if(name == "distribute-port") {
+			distributePort = atoi(value.c_str());
+		} else if(name == "node") {
+			renderNode = make_shared<RenderNode>();
+			if(!renderNode->connect(value)) {
+				return -1;
+			}
+		} else if(name == "profile") {
+			profiling = true;
+			if(!value.empty()) {
+				profileTarget = value;
+			}
+		} else if(name == "benchmark") {
+			benchmarking = true;
+			if(!value.empty()) {
+				benchmarkTarget = value;
+			}
+		} else if(name == "benchmark-frames") {
+			benchmarkFrames = max(1, atoi(value.c_str()));
+		} else if(name == "benchmark-path") {
+			benchmarkPath = value;
+		} else if(name == "bake-pvs") {
+			bakePVS = true;
+		} else if(name == "minimap-cache") {
+			useMinimapCache = true;
+		} else if(name == "minimap-scale") {
+			minimapScale = min(1.0f, max(0.05f, (float)atof(value.c_str())));
+		} else if(name == "minimap-interval") {
+			minimapInterval = max(0.0, atof(value.c_str()));
+		} else if(name == "objects") {
+			numObjects = max(1, atoi(value.c_str()));
+		} else if(name == "mesh-mix") {
+			if(sscanf(value.c_str(), "%d:%d", &numBunnies, &numTeapots) != 2 || numBunnies < 0 || numTeapots < 0 || numBunnies + numTeapots == 0) {
+				cerr << "Expected --mesh-mix=BUNNIES:TEAPOTS" << endl;
+				return -1;
+			}
+			// Equal mixes make equal layouts
+			int d = gcd(numBunnies, numTeapots);
+			numBunnies /= d;
+			numTeapots /= d;
+		} else if(name == "poses") {
+			posesFile = value;
+		} else if(name == "shards") {
+			numShards = max(1, atoi(value.c_str()));
+		} else if(name == "shard") {
+			// Added by runShards() for the processes it starts
+			if(sscanf(value.c_str(), "%d/%d", &shardIndex, &shardCount) != 2 || shardIndex < 0 || shardIndex >= shardCount) {
+				cerr << "Expected --shard=INDEX/COUNT" << endl;
+				return -1;
+			}
+		} else {
+			cerr << "Unknown option " << arg << endl;
+		}
 	}
-
-	// Set error callback.
-	glfwSetErrorCallback(error_callback);
-	// Initialize the library.
-	if(!glfwInit()) {
-		return -1;
+	// A pose list renders every pose, or this process's shard of them. With
+	// several shards, this process only starts and waits for the others,
+	// each with its own headless context.
+	if(!posesFile.empty()) {
+		poseBatch = make_shared<PoseBatch>();
+		if(!poseBatch->load(posesFile)) {
+			return -1;
+		}
+		if(numShards > 1 && shardCount == 0) {
+			vector<string> args(argv, argv + argc);
+			if(!headless) {
+				args.push_back("--headless");
+			}
+			return PoseBatch::runShards(args, numShards, poseBatch->getNumPoses());
+		}
+		if(shardCount > 1) {
+			poseBatch->setShard(shardIndex, shardCount);
+		}
+		if(poseBatch->getNumPoses() == 0) {
+			cout << "No poses to render" << endl;
+			return 0;
+		}
+		recording = true;
+		captureEvery = 1;
+		captureFrames = poseBatch->getNumPoses();
+		if(captureTarget.empty()) {
+			captureTarget = "pose_%06d.png";
+		}
 	}
-	// Create a windowed mode window and its OpenGL context.
-	window = glfwCreateWindow(640, 480, "YOUR NAME", NULL, NULL);
-	if(!window) {
-		glfwTerminate();
-		return -1;
+	// The benchmark follows the key poses in a --poses style file, or circles
+	// the objects
+	if(benchmarking) {
+		benchmark = make_shared<Benchmark>(benchmarkFrames);
+		if(!benchmarkPath.empty()) {
+			PoseBatch keys;
+			if(!keys.load(benchmarkPath)) {
+				return -1;
+			}
+			benchmark->setKeys(keys.getPoses());
+		}
+	}
+	// The server and the render nodes only render what they are asked for,
+	// off screen
+	if((renderServer || renderNode) && !headless) {
+		headless = make_shared<Headless>();
+	}
+	// The render nodes load the scene while this process opens its window
+	if(numNodes > 0) {
+		compositor = make_shared<Compositor>(distributeMode, numNodes);
+		if(!compositor->start(argv[0], argv[1], distributePort)) {
+			return -1;
+		}
 	}
-	// Make the window's context current.
-	glfwMakeContextCurrent(window);
-	// Initialize GLEW.
+	// OFFLINE records a single frame to output.png unless told otherwise
+	if(OFFLINE) {
+		recording = true;
+		if(captureTarget.empty()) {
+			captureTarget = "output.png";
+		}
+		if(captureFrames == 0) {
+			captureFrames = 1;
+		}
+	}
+	if(captureTarget.empty()) {
+		captureTarget = "capture_%05d.png";
+	}
+
+	if(headless) {
+		// An EGL context with an FBO in place of the window
+		if(!headless->init()) {
+			return -1;
+		}
+	} else {
+		// Set error callback.
+		glfwSetErrorCallback(error_callback);
+		// Initialize the library.
+		if(!glfwInit()) {
+			return -1;
+		}
+		// Create a windowed mode window and its OpenGL context.
+		window = glfwCreateWindow(640, 480, "YOUR NAME", NULL, NULL);
+		if(!window) {
+			glfwTerminate();
+			return -1;
+		}
+		// Make the window's context current.
+		glfwMakeContextCurrent(window);
+	}
+	// Initialize GLEW. Without a window system, only the context's
+	// functions can be loaded.
 	glewExperimental = true;
-	if(glewInit() != GLEW_OK) {
+	if((headless ? glewContextInit() : glewInit()) != GLEW_OK) {
 		cerr << "Failed to initialize GLEW" << endl;
 		return -1;
 	}
@@ -685,8 +2267,33 @@ int main(int argc, char **argv)
 	cout << "OpenGL version: " << glGetString(GL_VERSION) << endl;
 	cout << "GLSL version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 	GLSL::checkVersion();
-	// Set vsync.
-	glfwSwapInterval(1);
+	if(headless) {
+		if(!headless->createFramebuffer(640, 480)) {
+			return -1;
+		}
+		init();
+		if(poseBatch && !frameCapture) {
+			cerr << "Could not start the capture for --poses" << endl;
+			return -1;
+		}
+		if(renderServer) {
+			serve();
+		} else if(renderNode) {
+			runNode();
+		}
+		while(!headless->shouldClose()) {
+			render();
+			headless->swapBuffers();
+		}
+		if(profiling) {
+			stopProfiling();
+		}
+		releaseCapture();
+		headless.reset();
+		return 0;
+	}
+	// Set vsync. The benchmark runs as fast as it can.
+	glfwSwapInterval(benchmark ? 0 : 1);
 	// Set keyboard callback.
 	glfwSetKeyCallback(window, key_callback);
 	// Set char callback.
@@ -699,6 +2306,10 @@ int main(int argc, char **argv)
 	glfwSetFramebufferSizeCallback(window, resize_callback);
 	// Initialize scene.
 	init();
+	if(poseBatch && !frameCapture) {
+		cerr << "Could not start the capture for --poses" << endl;
+		return -1;
+	}
 	// Loop until the user closes the window.
 	while(!glfwWindowShouldClose(window)) {
 		// Render scene.
@@ -708,6 +2319,10 @@ int main(int argc, char **argv)
 		// Poll for and process events.
 		glfwPollEvents();
 	}
+	if(profiling) {
+		stopProfiling();
+	}
+	releaseCapture();
 	// Quit program.
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Requests renders from a running `FreeLookCamera RESOURCE_DIR --serve=SOCKET`.
+
+Each pose is "x y z yaw pitch fov" with the angles in degrees, the same as
+a line of a --poses file. All requests are sent before any reply is read,
+so that the server can batch them.
+
+  render_client.py /tmp/flc.sock 0 0.1 0 0 0 45 -o view.png
+  render_client.py /tmp/flc.sock --poses poses.txt -o 'out/%04d.png'
+  render_client.py /tmp/flc.sock --stats
+"""
+
+import argparse
+import socket
+import sys
+
+
+def read_line(f):
+    line = f.readline()
+    if not line:
+        raise EOFError('the server closed the connection')
+    return line.decode().rstrip('\n')
+
+
+def read_poses(filename):
+    poses = []
+    with open(filename) as f:
+        for line in f:
+            line = line.strip()
+            if line and not line.startswith('#'):
+                poses.append(line.split())
+    return poses
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('socket')
+    parser.add_argument('pose', nargs='*', help='x y z yaw pitch fov')
+    parser.add_argument('--poses', help='file with one pose per line')
+    parser.add_argument('--size', default='640x480', help='WIDTHxHEIGHT (default 640x480)')
+    parser.add_argument('--format', choices=['png', 'rgb'], default='png')
+    parser.add_argument('-o', '--output', default='render%04d.png', help='printf pattern for the files, numbered by pose')
+    parser.add_argument('--stats', action='store_true', help='print the server\'s stats')
+    args = parser.parse_args()
+
+    poses = []
+    if args.pose:
+        if len(args.pose) != 6:
+            parser.error('a pose is x y z yaw pitch fov')
+        poses.append(args.pose)
+    if args.poses:
+        poses += read_poses(args.poses)
+    if not poses and not args.stats:
+        parser.error('nothing to request')
+    width, height = (int(v) for v in args.size.split('x'))
+
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(args.socket)
+    f = s.makefile('rb')
+    requests = ''.join('render %d %s %d %d %s\n' % (i, ' '.join(p), width, height, args.format) for i, p in enumerate(poses))
+    s.sendall(requests.encode())
+
+    failed = 0
+    # Batches may finish out of order, so replies are matched by ID
+    for _ in poses:
+        fields = read_line(f).split(' ', 2)
+        if fields[0] != 'ok':
+            print(' '.join(fields), file=sys.stderr)
+            failed += 1
+            continue
+        i = int(fields[1])
+        w, h, fmt, size = fields[2].split()
+        data = f.read(int(size))
+        if len(data) != int(size):
+            raise EOFError('the server closed the connection')
+        filename = args.output % i if '%' in args.output else args.output
+        with open(filename, 'wb') as out:
+            out.write(data)
+        print('%s: %sx%s %s' % (filename, w, h, fmt))
+
+    if args.stats:
+        s.sendall(b'stats\n')
+        print(read_line(f))
+    s.close()
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())